@@ -34,6 +34,7 @@
 #define B1MAPSIM_B1MAPPING_H_
 
 #include <array>
+#include <cstdint>
 
 #include "b1map/body.h"
 #include "b1map/image.h"
@@ -57,17 +58,39 @@ class B1Mapping {
         /**
          * Abstract method performing the b1-mapping.
 		 * 
-		 * @param alpha_est Pointer to the flip-angle estimate destination.
+		 * @param alpha_est Pointer to the flip-angle estimate destination
+		 *     (its buffer is reused if it has the right size).
 		 * @param sigma Standard deviation of the noise in the images.
+		 * @param sample Index of the Monte Carlo sample, selecting the
+		 *     noise realisation.
          */
-        virtual void Run(Image<double> *alpha_est, const double sigma) = 0;
+        virtual void Run(Image<double> *alpha_est, const double sigma,
+			const std::uint64_t sample = 0) = 0;
 		/**
 		 * 
 		 */
 		Image<std::complex<double> >& GetImg(const int d);
+		/**
+		 * Get a constant reference to the complex-valued MRI images.
+		 * 
+		 * @return a constant reference to the images.
+		 */
+		const std::array<Image<std::complex<double> >,2>& GetImgs() const;
+		/**
+		 * Set the noise realisations.
+		 * 
+		 * @param seed Seed of the noise.
+		 * @param offset Global index of the first voxel of the images, when
+		 *     they are a slab of the whole volume.
+		 */
+		void SetNoise(const std::uint64_t seed, const Index offset);
 	protected:
 		/// Complex-valued MRI images.
 		std::array<Image<std::complex<double> >,2> imgs;
+		/// Seed of the noise.
+		std::uint64_t noise_seed;
+		/// Global index of the first voxel of the images.
+		Index noise_offset;
 };
 
 /**
@@ -86,11 +109,20 @@ class DoubleAngle : public B1Mapping {
 		 * @param spoiling Spoiling coefficient for transverse magnetization:
 		 *     1 is ideal spoiling; 0 is no spoiling.
 		 * @param body Physical description of the imaging body.
+		 * @param b1p_avg Average magnitude of the B1+ over the whole body,
+		 *     when `b1p' is only a slab of it: 0 (default) takes the
+		 *     average of `b1p'.
          */
         DoubleAngle(const double alpha_nom, const double TR, const double TE,
 			const Image<std::complex<double> > &b1p,
 			const Image<std::complex<double> > &b1m, const double spoiling,
-			const Body &body);
+			const Body &body, const double b1p_avg = 0.0);
+        /**
+         * Constructor from previously simulated images.
+		 *
+		 * @param imgs Complex-valued MRI images, moved into the method.
+         */
+        explicit DoubleAngle(std::array<Image<std::complex<double> >,2> &&imgs);
         /**
          * Virtual destructor.
          */
@@ -98,10 +130,14 @@ class DoubleAngle : public B1Mapping {
         /**
          * Abstract method performing the b1-mapping.
 		 * 
-		 * @param alpha_est Pointer to the flip-angle estimate destination.
+		 * @param alpha_est Pointer to the flip-angle estimate destination
+		 *     (its buffer is reused if it has the right size).
 		 * @param sigma Standard deviation of the noise in the images.
+		 * @param sample Index of the Monte Carlo sample, selecting the
+		 *     noise realisation.
          */
-        virtual void Run(Image<double> *alpha_est, const double sigma);
+        virtual void Run(Image<double> *alpha_est, const double sigma,
+			const std::uint64_t sample = 0);
 };
 
 /**
@@ -120,12 +156,23 @@ class ActualFlipAngle : public B1Mapping {
 		 * @param spoiling Spoiling coefficient for transverse magnetization:
 		 *     1 is ideal spoiling; 0 is no spoiling.
 		 * @param body Physical description of the imaging body.
+		 * @param b1p_avg Average magnitude of the B1+ over the whole body,
+		 *     when `b1p' is only a slab of it: 0 (default) takes the
+		 *     average of `b1p'.
          */
         ActualFlipAngle(const double alpha_nom, const double TR1,
 			const double TR2, const double TE,
 			const Image<std::complex<double> > &b1p,
 			const Image<std::complex<double> > &b1m, const double spoiling,
-			const Body &body);
+			const Body &body, const double b1p_avg = 0.0);
+        /**
+         * Constructor from previously simulated images.
+		 *
+		 * @param TR1,TR2 Repetition times in millisecond.
+		 * @param imgs Complex-valued MRI images, moved into the method.
+         */
+        ActualFlipAngle(const double TR1, const double TR2,
+			std::array<Image<std::complex<double> >,2> &&imgs);
         /**
          * Virtual destructor.
          */
@@ -133,10 +180,14 @@ class ActualFlipAngle : public B1Mapping {
         /**
          * Abstract method performing the b1-mapping.
 		 * 
-		 * @param alpha_est Pointer to the flip-angle estimate destination.
+		 * @param alpha_est Pointer to the flip-angle estimate destination
+		 *     (its buffer is reused if it has the right size).
 		 * @param sigma Standard deviation of the noise in the images.
+		 * @param sample Index of the Monte Carlo sample, selecting the
+		 *     noise realisation.
          */
-        virtual void Run(Image<double> *alpha_est, const double sigma);
+        virtual void Run(Image<double> *alpha_est, const double sigma,
+			const std::uint64_t sample = 0);
 	private:
 		/// Ratio of the repetition times
 		double TRratio;
@@ -161,12 +212,25 @@ class BlochSiegertShift : public B1Mapping {
 		 * @param spoiling Spoiling coefficient for transverse magnetization:
 		 *     1 is ideal spoiling; 0 is no spoiling.
 		 * @param body Physical description of the imaging body.
+		 * @param b1p_avg Average magnitude of the B1+ over the whole body,
+		 *     when `b1p' is only a slab of it: 0 (default) takes the
+		 *     average of `b1p'.
          */
         BlochSiegertShift(const double alpha_nom, const double TR,
 			const double TE, const double bss_offres, const double bss_length,
 			const Image<std::complex<double> > &b1p,
 			const Image<std::complex<double> > &b1m, const double spoiling,
-			const Body &body);
+			const Body &body, const double b1p_avg = 0.0);
+        /**
+         * Constructor from previously simulated images.
+		 *
+		 * @param bss_offres Off-resonance frequency of the Bloch-Siegert pulse in
+    	 *     radian per millisecond.
+    	 * @param bss_length Length of the Bloch-Siegert pulse in millisecond.
+		 * @param imgs Complex-valued MRI images, moved into the method.
+         */
+        BlochSiegertShift(const double bss_offres, const double bss_length,
+			std::array<Image<std::complex<double> >,2> &&imgs);
         /**
          * Virtual destructor.
          */
@@ -174,10 +238,14 @@ class BlochSiegertShift : public B1Mapping {
         /**
          * Abstract method performing the b1-mapping.
 		 * 
-		 * @param alpha_est Pointer to the flip-angle estimate destination.
+		 * @param alpha_est Pointer to the flip-angle estimate destination
+		 *     (its buffer is reused if it has the right size).
 		 * @param sigma Standard deviation of the noise in the images.
+		 * @param sample Index of the Monte Carlo sample, selecting the
+		 *     noise realisation.
          */
-        virtual void Run(Image<double> *alpha_est, const double sigma);
+        virtual void Run(Image<double> *alpha_est, const double sigma,
+			const std::uint64_t sample = 0);
 	private:
 		/// 
 		double Kbs;
@@ -199,11 +267,20 @@ class TRxPhaseGRE : public B1Mapping {
 		 * @param spoiling Spoiling coefficient for transverse magnetization:
 		 *     1 is ideal spoiling; 0 is no spoiling.
 		 * @param body Physical description of the imaging body.
+		 * @param b1p_avg Average magnitude of the B1+ over the whole body,
+		 *     when `b1p' is only a slab of it: 0 (default) takes the
+		 *     average of `b1p'.
          */
         TRxPhaseGRE(const double alpha_nom, const double TR, const double TE,
 			const Image<std::complex<double> > &b1p,
 			const Image<std::complex<double> > &b1m, const double spoiling,
-			const Body &body);
+			const Body &body, const double b1p_avg = 0.0);
+        /**
+         * Constructor from previously simulated images.
+		 *
+		 * @param imgs Complex-valued MRI images, moved into the method.
+         */
+        explicit TRxPhaseGRE(std::array<Image<std::complex<double> >,2> &&imgs);
         /**
          * Virtual destructor.
          */
@@ -211,10 +288,14 @@ class TRxPhaseGRE : public B1Mapping {
         /**
          * Abstract method performing the b1-mapping.
 		 * 
-		 * @param alpha_est Pointer to the flip-angle estimate destination.
+		 * @param alpha_est Pointer to the flip-angle estimate destination
+		 *     (its buffer is reused if it has the right size).
 		 * @param sigma Standard deviation of the noise in the images.
+		 * @param sample Index of the Monte Carlo sample, selecting the
+		 *     noise realisation.
          */
-        virtual void Run(Image<double> *alpha_est, const double sigma);
+        virtual void Run(Image<double> *alpha_est, const double sigma,
+			const std::uint64_t sample = 0);
 };
 
 /**
@@ -222,20 +303,51 @@ class TRxPhaseGRE : public B1Mapping {
  */
 double ComputeSigma(const std::array<Image<std::complex<double> >,2> &imgs,
 	const double noise);
+/**
+ * Compute the standard deviation of the noise from the average magnitude of
+ * the two images.
+ * 
+ * @param avg Average magnitude of the images.
+ * @param noise Inverse of the average SNR.
+ * 
+ * @return the standard deviation.
+ */
+double ComputeSigma(const std::array<double,2> &avg, const double noise);
 
 /**
+ * Add white Gaussian noise to the two images.
  * 
+ * @param imgs_noise Pointer to the noisy images destination.
+ * @param imgs Noiseless images.
+ * @param sigma Standard deviation of the noise.
+ * @param seed Seed of the noise.
+ * @param sample Index of the Monte Carlo sample.
+ * @param offset Global index of the first voxel of the images.
  */
 void AddNoise(std::array<Image<std::complex<double> >,2> *imgs_noise,
 	const std::array<Image<std::complex<double> >,2> &imgs,
-	const double sigma);
+	const double sigma, const std::uint64_t seed, const std::uint64_t sample,
+	const Index offset);
 
 /**
+ * Add white Gaussian noise to an image.
+ * 
+ * The noise of each voxel depends only on the seed, the stream and the global
+ * index of the voxel, so that a sample is the same whatever the number of
+ * threads, slabs, ranks or shards of the run.
  * 
+ * @param img_noise Pointer to the noisy image destination.
+ * @param img Noiseless image.
+ * @param sigma Standard deviation of the noise.
+ * @param seed Seed of the noise.
+ * @param stream Index of the noise stream (one for each image of each
+ *     sample).
+ * @param offset Global index of the first voxel of the image.
  */
 void AddNoise(Image<std::complex<double> > *img_noise,
 	const Image<std::complex<double> > &img,
-	const double sigma);
+	const double sigma, const std::uint64_t seed, const std::uint64_t stream,
+	const Index offset);
 
 }  // namespace b1map
 
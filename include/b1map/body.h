@@ -35,14 +35,205 @@
 
 #include "b1map/body.h"
 
+#include <array>
+#include <cstdint>
+#include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "b1map/image.h"
 
 namespace b1map {
 
+namespace io {
+class IOtoml;
+}  // namespace io
+
+/**
+ * Constants of the materials derived for a repetition, in structure-of-arrays
+ * form, so that the voxel loops gather them by material code instead of
+ * evaluating the exponentials.
+ */
+struct MaterialTable {
+	/// Signal scale: proton density times the T2* decay at the echo time.
+	Image<double> scale;
+	/// Longitudinal relaxation coefficient over the repetition time.
+	Image<double> e1;
+	/// Transverse relaxation coefficient over the repetition time, spoiled.
+	Image<double> e2;
+	/// 1 if the relaxation coefficients are finite, 0 otherwise.
+	Image<std::uint8_t> valid;
+};
+
+/**
+ * Runs of consecutive voxels of the same material.
+ * 
+ * The runs are split at the boundaries of blocks of fixed size, so that the
+ * blocks can be shared among the threads as the voxels of the plain loops.
+ */
+struct MaterialRuns {
+	/// Number of voxels of each block.
+	static constexpr Index BLOCK = 4096;
+	/// First voxel of each run, followed by the number of voxels.
+	std::vector<Index> begin;
+	/// Material id of each run.
+	std::vector<std::uint16_t> id;
+	/// First run of each block, followed by the number of runs.
+	std::vector<Index> block_first;
+};
+/**
+ * Identity layout of the material ids, for the properties given voxel by
+ * voxel: each voxel is a material on its own, whose id is the voxel index.
+ */
+struct VoxelIds {
+	/// Number of voxels.
+	Index n_vox;
+};
+
+/**
+ * Set if the bodies loaded from then on encode the material ids also as
+ * runs of consecutive voxels, along which the simulation broadcasts the
+ * constants of the material instead of gathering them voxel by voxel.
+ * 
+ * @param enable true to encode the runs, false (default) otherwise.
+ */
+void SetMaterialRuns(const bool enable);
+/**
+ * Get if the bodies encode the material ids as runs.
+ * 
+ * @return true if the runs are encoded, false otherwise.
+ */
+bool GetMaterialRuns();
+
+/**
+ * Clusters of the property maps of a whole body, shared by the bodies of its
+ * slabs so that the materials do not depend on how the planes are split.
+ * 
+ * The maps are added slab by slab in the order of the planes. The properties
+ * of each cluster are summed within each plane first and then over the planes
+ * in their order, so that the means are the same for any slab size and any
+ * number of ranks.
+ */
+class BodyClusters {
+	public:
+		/**
+		 * Default constructor, without clustering.
+		 */
+		BodyClusters();
+		/**
+		 * Constructor from the configuration of the body.
+		 * 
+		 * @param config Content of the .toml file.
+		 */
+		BodyClusters(const io::IOtoml &config);
+		/**
+		 * Check if the body is clustered.
+		 * 
+		 * @return true if the properties are maps with a clustering
+		 *     tolerance, false otherwise.
+		 */
+		bool IsEnabled() const;
+		/**
+		 * Add the maps of the next slab of planes.
+		 * 
+		 * @param config Content of the .toml file.
+		 * @param z0 First plane of the slab.
+		 * @param nz Number of planes of the slab.
+		 * @param nn Size of the mesh the maps must match (empty skips the
+		 *     check).
+		 */
+		void AddSlab(const io::IOtoml &config, const Index z0, const Index nz,
+			const std::vector<Index> &nn = std::vector<Index>());
+		/**
+		 * Gather the planes added by all the ranks and compute the
+		 * properties of the clusters.
+		 * 
+		 * It must be called by all the ranks together, after the planes of
+		 * each of them are added.
+		 */
+		void Finish();
+		/**
+		 * Check if the clusters are computed.
+		 * 
+		 * @return true if Finish has been called, false otherwise.
+		 */
+		bool IsFinished() const;
+	private:
+		friend class Body;
+
+		/// Key of a cluster: kind and value of the three properties.
+		typedef std::array<std::int64_t,6> Key;
+		/**
+		 * Hash of the key of a cluster.
+		 */
+		struct KeyHash {
+			size_t operator()(const Key &key) const;
+		};
+
+		/**
+		 * Constructor with a given tolerance.
+		 * 
+		 * @param tolerance Relative tolerance on the properties of the
+		 *     voxels of a cluster (0 for exactly equal properties).
+		 */
+		explicit BodyClusters(const double tolerance);
+		/**
+		 * Get the key of the cluster of a voxel.
+		 * 
+		 * @param values Properties of the voxel.
+		 * 
+		 * @return the key of the cluster.
+		 */
+		Key GetKey(const std::array<double,3> &values) const;
+		/**
+		 * Add the property maps of some planes.
+		 * 
+		 * @param props Property maps of the planes.
+		 */
+		void Add(const std::array<const Image<double>*,3> &props);
+		/**
+		 * Compute the properties of the clusters from the planes added.
+		 */
+		void Combine();
+
+		/// Clustering enabled.
+		bool enabled_;
+		/// Relative tolerance on the properties.
+		double tolerance_;
+		/// Width of the logarithmic bins of the properties.
+		double width_;
+		/// Clusters computed.
+		bool finished_;
+		/// More than 65536 clusters.
+		bool overflow_;
+		/// Keys of the clusters of each plane, plane after plane.
+		std::vector<Index> plane_keys_;
+		/// Number of voxels of the clusters of each plane.
+		std::vector<Index> plane_counts_;
+		/// Sums of the properties of the clusters of each plane.
+		std::vector<double> plane_sums_;
+		/// Codes of the clusters, in order of appearance.
+		std::unordered_map<Key,int,KeyHash> codes_;
+		/// Lists of the properties of the clusters.
+		std::array<Image<double>,3> lists_;
+};
+
 /**
  * Class for the imaged body description.
+ * 
+ * The material codes are remapped at load time to dense ids of the materials
+ * actually present, stored with the narrowest type (one byte up to 256
+ * materials, two bytes up to 65536), and the property lists are compacted
+ * accordingly. Codes outside the property lists are rejected.
+ * 
+ * Without the material codes, the properties are maps over the voxels (e.g.,
+ * from quantitative MRI). If a clustering tolerance is set, they are clustered
+ * at load time into a material table: the voxels whose properties agree within
+ * the relative tolerance share a material, so that the tables of the constants
+ * keep working. Without a tolerance, or if the clusters are more than 65536,
+ * the properties are kept voxel by voxel (see IsPerVoxel). The slabs of a body
+ * are clustered against the clusters of the whole body (see BodyClusters).
  */
 class Body {
 	public:
@@ -57,17 +248,89 @@ class Body {
 		 */
 		Body(const std::string &fname);
 		/**
-		 * Get a reference to the material codes.
+		 * Slab constructor, loading only some planes of the material codes.
+		 * 
+		 * @param fname Address of the .toml file to read.
+		 * @param z0 First plane of the slab.
+		 * @param nz Number of planes of the slab.
+		 */
+		Body(const std::string &fname, const Index z0, const Index nz);
+		/**
+		 * Constructor from an already parsed configuration.
+		 * 
+		 * The maps stored in the same file are read through a single handle,
+		 * and the files are read concurrently. The sizes of all the maps are
+		 * checked before any of them is read.
+		 * 
+		 * @param config Content of the .toml file.
+		 * @param nn Size of the mesh the material codes must match (empty
+		 *     skips the check).
+		 */
+		Body(const io::IOtoml &config,
+			const std::vector<Index> &nn = std::vector<Index>());
+		/**
+		 * Slab constructor from an already parsed configuration.
+		 * 
+		 * @param config Content of the .toml file.
+		 * @param z0 First plane of the slab.
+		 * @param nz Number of planes of the slab.
+		 * @param nn Size of the mesh the material codes must match (empty
+		 *     skips the check).
+		 */
+		Body(const io::IOtoml &config, const Index z0, const Index nz,
+			const std::vector<Index> &nn = std::vector<Index>());
+		/**
+		 * Slab constructor from an already parsed configuration, with the
+		 * clusters of the whole body.
+		 * 
+		 * While the clusters are not finished, the properties are kept voxel
+		 * by voxel, to be added to them.
+		 * 
+		 * @param config Content of the .toml file.
+		 * @param z0 First plane of the slab.
+		 * @param nz Number of planes of the slab.
+		 * @param nn Size of the mesh the material codes must match (empty
+		 *     skips the check).
+		 * @param clusters Clusters of the whole body.
+		 */
+		Body(const io::IOtoml &config, const Index z0, const Index nz,
+			const std::vector<Index> &nn, const BodyClusters &clusters);
+		/**
+		 * Check if the properties are kept voxel by voxel.
+		 * 
+		 * @return true if the property lists are maps over the voxels (the
+		 *     material ids are then VoxelIds), false otherwise.
+		 */
+		bool IsPerVoxel() const;
+		/**
+		 * Get the size of the material ids.
 		 * 
-		 * @return a reference to the materials image.
+		 * @return the number of bytes of each id (1 or 2).
 		 */
-		Image<int>& GetMaterials();
+		size_t GetMaterialBytes() const;
 		/**
-		 * Get a constant reference to the material codes.
+		 * Get a constant reference to the material ids.
+		 * 
+		 * @tparam Id typename of the ids, std::uint8_t or std::uint16_t
+		 *     according to GetMaterialBytes().
 		 * 
 		 * @return a constant reference to the materials image.
 		 */
-		const Image<int>& GetMaterials() const;
+		template <typename Id>
+		const Image<Id>& GetMaterials() const;
+		/**
+		 * Check if the material ids are also encoded as runs.
+		 * 
+		 * @return true if the runs are available, false otherwise.
+		 */
+		bool HasRuns() const;
+		/**
+		 * Get a constant reference to the runs of the material ids.
+		 * 
+		 * @return a constant reference to the runs (empty if HasRuns() is
+		 *     false).
+		 */
+		const MaterialRuns& GetRuns() const;
 		/**
 		 * Get a reference to the proton density list.
 		 * 
@@ -104,17 +367,82 @@ class Body {
 		 * @return a constant reference to the T2star list.
 		 */
 		const Image<double>& GetT2Star() const;
+		/**
+		 * Get the constants of the materials for a repetition.
+		 * 
+		 * The table is computed at the first request and kept for the
+		 * following ones with the same parameters (e.g., the two images of
+		 * the double-angle method). The non-constant getters of the
+		 * properties drop the kept tables.
+		 * 
+		 * @param TR Repetition time in millisecond.
+		 * @param TE Echo time in millisecond.
+		 * @param spoiling Spoiling coefficient for transverse magnetization.
+		 * 
+		 * @return a constant reference to the table.
+		 */
+		const MaterialTable& GetTable(const double TR, const double TE,
+			const double spoiling) const;
 	private:
-		/// 3D image of the material codes.
-		Image<int> materials_;
+		/**
+		 * Load the maps listed in the configuration.
+		 * 
+		 * @param config Content of the .toml file.
+		 * @param z0 First plane of the slab.
+		 * @param nz Number of planes of the slab (negative for all of them).
+		 * @param nn Size of the mesh the material codes must match (empty
+		 *     skips the check).
+		 * @param clusters Pointer to the clusters of the whole body (nullptr
+		 *     to cluster the maps read).
+		 */
+		void Load(const io::IOtoml &config, const Index z0, const Index nz,
+			const std::vector<Index> &nn, const BodyClusters *clusters);
+		/**
+		 * Cluster the property maps into materials, replacing the maps by
+		 * the lists of the properties of the clusters.
+		 * 
+		 * @param codes Pointer to the material codes, set to the clusters
+		 *     of the voxels.
+		 * @param clusters Finished clusters, including those of the maps.
+		 * 
+		 * @return true if the maps are clustered, false if the clusters are
+		 *     more than 65536 (the maps are then left untouched).
+		 */
+		bool Cluster(Image<int> *codes, const BodyClusters &clusters);
+		/**
+		 * Remap the material codes to dense ids and compact the property
+		 * lists.
+		 * 
+		 * @param codes Material codes, indices of the property lists.
+		 * @param address Address of the codes, for the error messages.
+		 */
+		void Remap(const Image<int> &codes, const std::string &address);
+
+		/// Properties kept voxel by voxel.
+		bool per_voxel_;
+		/// Number of bytes of each material id.
+		size_t material_bytes_;
+		/// 3D image of the material ids, up to 256 materials.
+		Image<std::uint8_t> materials8_;
+		/// 3D image of the material ids, above 256 materials.
+		Image<std::uint16_t> materials16_;
+		/// Runs of the material ids (empty if not encoded).
+		MaterialRuns runs_;
 		/// List of the proton densities.
 		Image<double> rho_;
 		/// List of the longitudinal relaxation times.
 		Image<double> t1_;
 		/// List of the transverse relaxation times.
 		Image<double> t2star_;
+		/// Tables of the material constants, keyed by (TR, TE, spoiling).
+		mutable std::map<std::array<double,3>,MaterialTable> tables_;
 };
 
+template <>
+const Image<std::uint8_t>& Body::GetMaterials<std::uint8_t>() const;
+template <>
+const Image<std::uint16_t>& Body::GetMaterials<std::uint16_t>() const;
+
 }  // namespace b1map
 
 #endif  // B1MAPSIM_BODY_H_
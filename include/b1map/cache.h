@@ -0,0 +1,161 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef B1MAPSIM_CACHE_H_
+#define B1MAPSIM_CACHE_H_
+
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "b1map/image.h"
+#include "b1map/util.h"
+
+namespace b1map {
+
+/**
+ * Key of a simulated image in the on-disk cache.
+ * 
+ * The key is a hash of everything the simulation depends on: the version of
+ * the code, which is hashed at construction, and the inputs and parameters
+ * added afterwards in a fixed order.
+ */
+class CacheKey {
+	public:
+		/**
+		 * Constructor of the key of the current version of the code.
+		 */
+		CacheKey();
+		/**
+		 * Add a scalar parameter to the key.
+		 * 
+		 * @param value Value of the parameter.
+		 * 
+		 * @return a reference to this key.
+		 */
+		CacheKey& Add(const double value);
+		/**
+		 * Add a tag to the key.
+		 * 
+		 * @param tag Tag, e.g. the name of the sequence.
+		 * 
+		 * @return a reference to this key.
+		 */
+		CacheKey& Add(const std::string &tag);
+		/**
+		 * Add an image to the key (its size and its data).
+		 * 
+		 * The data are hashed in parallel by blocks of fixed size, so that
+		 * the key does not depend on the number of threads.
+		 * 
+		 * @tparam T numerical typename of the data.
+		 * 
+		 * @param img Image.
+		 * 
+		 * @return a reference to this key.
+		 */
+		template <typename T>
+		CacheKey& Add(const Image<T> &img);
+		/**
+		 * Get the key as an hexadecimal string.
+		 * 
+		 * @return the key.
+		 */
+		std::string ToString() const;
+	private:
+		/**
+		 * Add a block of memory to the key.
+		 * 
+		 * @param data Pointer to the block.
+		 * @param bytes Size of the block in bytes.
+		 */
+		void AddBytes(const void *data, const size_t bytes);
+
+		/// Hash of the inputs added so far.
+		std::uint64_t hash_;
+};
+
+/**
+ * Set the directory of the cache of the simulated images.
+ * 
+ * @param dir Address of the cache directory (empty disables the cache).
+ */
+void SetCacheDirectory(const std::string &dir);
+/**
+ * Get the directory of the cache of the simulated images.
+ * 
+ * @return the address of the cache directory (empty if it is disabled).
+ */
+const std::string& GetCacheDirectory();
+/**
+ * Set the maximum size of the cache, above which the least recently used
+ * images are evicted.
+ * 
+ * @param bytes Maximum size in bytes (0 means no limit).
+ */
+void SetCacheSize(const size_t bytes);
+/**
+ * Get the maximum size of the cache.
+ * 
+ * @return the maximum size in bytes (0 means no limit).
+ */
+size_t GetCacheSize();
+
+/**
+ * Load a simulated image from the cache.
+ * 
+ * A hit marks the image as the most recently used. The image is mapped when
+ * the mapping of the inputs is enabled.
+ * 
+ * @param[out] img Destination of the image.
+ * @param[in] key Key of the image.
+ * 
+ * @return true on a hit, false if the cache is disabled or on a miss.
+ */
+bool LoadCachedImage(Image<std::complex<double> > *img, const CacheKey &key);
+/**
+ * Store a simulated image in the cache, then evict the least recently used
+ * images in excess of the maximum size.
+ * 
+ * The image is written to a temporary file that is renamed when complete, so
+ * that concurrent runs sharing the cache never read partial images. Any
+ * failure leaves the cache unchanged.
+ * 
+ * @param img Image.
+ * @param key Key of the image.
+ */
+void StoreCachedImage(const Image<std::complex<double> > &img, const CacheKey &key);
+
+}  // namespace b1map
+
+#endif  // B1MAPSIM_CACHE_H_
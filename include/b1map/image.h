@@ -35,6 +35,7 @@
 
 #include <vector>
 
+#include "b1map/storage.h"
 #include "b1map/util.h"
 
 namespace b1map {
@@ -56,14 +57,14 @@ class Image {
 		 * 
 		 * @param n0 Number of voxels along the line.
 		 */
-		Image(const int n0);
+		Image(const Index n0);
 		/**
 		 * 2-D constructor.
 		 * 
 		 * @param n0 Number of voxels along the x-direction.
 		 * @param n1 Number of voxels along the y-direction.
 		 */
-		Image(const int n0, const int n1);
+		Image(const Index n0, const Index n1);
 		/**
 		 * 3-D constructor.
 		 * 
@@ -71,13 +72,13 @@ class Image {
 		 * @param n1 Number of voxels along the y-direction.
 		 * @param n2 Number of voxels along the z-direction.
 		 */
-		Image(const int n0, const int n1, const int n2);
+		Image(const Index n0, const Index n1, const Index n2);
 		/**
 		 * N-D constructor.
 		 * 
 		 * @param nn Number of voxels along each direction.
 		 */
-		Image(const std::vector<int> &nn);
+		Image(const std::vector<Index> &nn);
 
 		/**
 		 * Number of dimensions of the image.
@@ -90,13 +91,13 @@ class Image {
 		 * 
 		 * @return a reference to the dimensions.
 		 */
-		std::vector<int>& GetSize();
+		std::vector<Index>& GetSize();
 		/**
 		 * Get a constant reference to the image dimensions.
 		 * 
 		 * @return a constant reference to the dimensions.
 		 */
-		const std::vector<int>& GetSize() const;
+		const std::vector<Index>& GetSize() const;
 		/**
 		 * Number of voxels along dimension d.
 		 * 
@@ -104,25 +105,25 @@ class Image {
 		 * 
 		 * @return the number of voxels.
 		 */
-		int GetSize(const int d) const;
+		Index GetSize(const int d) const;
 		/**
 		 * Number of voxels of the image.
 		 * 
 		 * @return the number of voxels.
 		 */
-		size_t GetNVox() const;
+		Index GetNVox() const;
 		/**
-		 * Get a reference to the data vector.
+		 * Get a reference to the data buffer.
 		 * 
 		 * @return a reference to the data.
 		 */
-		std::vector<NumType>& GetData();
+		Buffer<NumType>& GetData();
 		/**
-		 * Get a constant reference to the data vector.
+		 * Get a constant reference to the data buffer.
 		 * 
 		 * @return a constant reference to the data.
 		 */
-		const std::vector<NumType>& GetData() const;
+		const Buffer<NumType>& GetData() const;
 		/**
 		 * Get a reference to the idx-th voxel in the image.
 		 * 
@@ -130,7 +131,7 @@ class Image {
 		 * 
 		 * @return a reference to the idx-th voxel.
 		 */
-		NumType& operator[](const size_t idx);
+		NumType& operator[](const Index idx);
 		/**
 		 * Get a copy of the idx-th voxel in the image.
 		 * 
@@ -138,14 +139,42 @@ class Image {
 		 * 
 		 * @return a copy of the idx-th voxel.
 		 */
-		NumType operator[](const size_t idx) const;
+		NumType operator[](const Index idx) const;
 	private:
 		/// Number of voxels in each direction.
-		std::vector<int> nn_;
+		std::vector<Index> nn_;
 		/// Image data.
-		std::vector<NumType> data_;
+		Buffer<NumType> data_;
 };
 
+/**
+ * Accumulate plane by plane, along the last direction, the magnitude of the
+ * non-NaN voxels of an image.
+ * 
+ * Summing the planes separately makes the global averages independent of how
+ * the volume is split in slabs (or among processes).
+ * 
+ * @tparam NumType numerical typename of the image data.
+ * 
+ * @param sum Pointer to the sums of each plane, indexed by the global plane.
+ * @param num Pointer to the number of non-NaN voxels of each plane.
+ * @param img Image, or slab of an image.
+ * @param z0 Global index of the first plane of the image.
+ */
+template <typename NumType>
+void AccumulatePlanes(std::vector<double> *sum, std::vector<Index> *num,
+	const Image<NumType> &img, const Index z0 = 0);
+
+/**
+ * Combine the sums of the planes, in plane order, into an average.
+ * 
+ * @param sum Sums of each plane.
+ * @param num Number of non-NaN voxels of each plane.
+ * 
+ * @return the average.
+ */
+double PlaneAvg(const std::vector<double> &sum, const std::vector<Index> &num);
+
 #include "image.tcc"
 
 }  // namespace b1map
@@ -39,32 +39,32 @@ Image() :
 }
 template <typename NumType>
 Image<NumType>::
-Image(const int n0) :
+Image(const Index n0) :
 	nn_(1,n0), data_(n0) {
 	return;
 }
 template <typename NumType>
 Image<NumType>::
-Image(const int n0, const int n1) :
+Image(const Index n0, const Index n1) :
 	nn_(2), data_(0) {
 	nn_[0] = n0;
 	nn_[1] = n1;
-	data_.resize(Prod(nn_));
+	data_ = Buffer<NumType>(Prod(nn_));
 	return;
 }
 template <typename NumType>
 Image<NumType>::
-Image(const int n0, const int n1, const int n2) :
+Image(const Index n0, const Index n1, const Index n2) :
 	nn_(3), data_(0) {
 	nn_[0] = n0;
 	nn_[1] = n1;
 	nn_[2] = n2;
-	data_.resize(Prod(nn_));
+	data_ = Buffer<NumType>(Prod(nn_));
 	return;
 }
 template <typename NumType>
 Image<NumType>::
-Image(const std::vector<int> &nn) :
+Image(const std::vector<Index> &nn) :
 	nn_(nn), data_(Prod(nn_)) {
 	return;
 }
@@ -76,42 +76,65 @@ GetNDim() const {
 	return static_cast<int>(nn_.size());
 }
 template <typename NumType>
-std::vector<int>& Image<NumType>::
+std::vector<Index>& Image<NumType>::
 GetSize() {
 	return nn_;
 }
 template <typename NumType>
-const std::vector<int>& Image<NumType>::
+const std::vector<Index>& Image<NumType>::
 GetSize() const {
 	return nn_;
 }
 template <typename NumType>
-int Image<NumType>::
+Index Image<NumType>::
 GetSize(const int d) const {
 	return nn_[d];
 }
 template <typename NumType>
-size_t Image<NumType>::
+Index Image<NumType>::
 GetNVox() const {
-	return data_.size();
+	return static_cast<Index>(data_.size());
 }
 template <typename NumType>
-std::vector<NumType>& Image<NumType>::
+Buffer<NumType>& Image<NumType>::
 GetData() {
 	return data_;
 }
 template <typename NumType>
-const std::vector<NumType>& Image<NumType>::
+const Buffer<NumType>& Image<NumType>::
 GetData() const {
 	return data_;
 }
 template <typename NumType>
 NumType& Image<NumType>::
-operator[](const size_t idx) {
+operator[](const Index idx) {
 	return data_[idx];
 }
 template <typename NumType>
 NumType Image<NumType>::
-operator[](const size_t idx) const {
+operator[](const Index idx) const {
 	return data_[idx];
 }
+
+// Accumulate the planes
+template <typename NumType>
+void AccumulatePlanes(std::vector<double> *sum, std::vector<Index> *num,
+	const Image<NumType> &img, const Index z0) {
+	Index n_plane = img.GetNDim()>2 ? img.GetSize(2) : 1;
+	Index n_vox = img.GetNVox()/n_plane;
+	#pragma omp parallel for schedule(static)
+	for (Index k = 0; k<n_plane; ++k) {
+		double plane_sum = 0.0;
+		Index plane_num = 0;
+		for (Index idx = k*n_vox; idx<(k+1)*n_vox; ++idx) {
+			double tmp = std::abs(img[idx]);
+			if (tmp==tmp) {
+				plane_sum += tmp;
+				++plane_num;
+			}
+		}
+		(*sum)[z0+k] += plane_sum;
+		(*num)[z0+k] += plane_num;
+	}
+	return;
+}
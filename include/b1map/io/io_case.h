@@ -0,0 +1,75 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef IO_CASE_H_
+#define IO_CASE_H_
+
+#include <string>
+
+#include "b1map/io/io_util.h"
+
+namespace b1map {
+
+namespace io {
+
+    /// Name of the root attribute holding the configuration of a case file.
+    const std::string CASE_ATTRIBUTE = "b1map-case";
+    /// Placeholder of the case file address in the packed configuration.
+    const std::string CASE_PLACEHOLDER = "${case}";
+
+    /**
+     * Check if a file is an .h5 file, and thus possibly a case file
+     * bundling the configuration with all the input maps.
+     * 
+     * @param fname address of the file.
+     * 
+     * @return true if the file is an .h5 file.
+     */
+    bool IsCaseFile(const std::string &fname);
+    /**
+     * Read the configuration packed in a case file.
+     * 
+     * The placeholders of the case file address in the configuration are
+     * replaced by `fname', so that the case file can be moved.
+     * 
+     * @param config pointer to the destination of the TOML configuration.
+     * @param fname address of the case file.
+     * 
+     * @return the IO state.
+     */
+    State ReadCase(std::string *config, const std::string &fname);
+
+}  // io
+
+}  // b1map
+
+#endif  // IO_CASE_H_
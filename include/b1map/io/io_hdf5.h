@@ -35,7 +35,9 @@
 
 #include <H5Cpp.h>
 
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "b1map/image.h"
 #include "b1map/io/io_util.h"
@@ -44,28 +46,132 @@ namespace b1map {
 
 namespace io {
     
+    /**
+     * Access the lock serialising the calls to the HDF5 library, which is not
+     * thread-safe.
+     * 
+     * @return a reference to the lock.
+     */
+    std::recursive_mutex& HDF5Mutex();
+
+    /**
+     * Set the chunk shape of the datasets created by IOh5::WriteDataset.
+     * 
+     * @param chunk number of voxels of a chunk in each direction (0 for the
+     *     whole dataset size). If empty, the datasets are contiguous unless
+     *     compressed, in which case the chunk is a plane orthogonal to the
+     *     slowest direction. The chunks are reduced below the 4 GiB limit
+     *     of HDF5.
+     */
+    void SetChunkShape(const std::vector<Index> &chunk);
+    /**
+     * Set the compression of the datasets created by IOh5::WriteDataset.
+     * 
+     * @param level deflate level from 1 to 9, combined with the shuffle
+     *     filter, or 0 to disable the compression.
+     */
+    void SetCompressionLevel(const int level);
+    /**
+     * Set if IOh5::ReadDataset maps the datasets in the memory.
+     * 
+     * A dataset of a file opened in input mode is mapped (copy-on-write)
+     * instead of read when it is contiguous and stored with the native type,
+     * so that no copy is made and the pages are shared with the page cache.
+     * The other datasets are read as usual.
+     * 
+     * @param enable true to map the datasets (default), false to read them.
+     */
+    void SetInputMapping(const bool enable);
+    /**
+     * Get if the input datasets are mapped in the memory.
+     * 
+     * @return true if the datasets are mapped, false if they are read.
+     */
+    bool GetInputMapping();
+    /**
+     * Set the alignment in the file of the objects written from then on.
+     * 
+     * Aligning the datasets to the pages lets IOh5::ReadDataset map them.
+     * 
+     * @param bytes alignment in bytes of the objects of at least that size
+     *     (0 disables the alignment).
+     */
+    void SetAlignment(const Index bytes);
+    /**
+     * Set if the ranks write their slabs to the .h5 files together, through
+     * MPI-IO (parallel HDF5 builds only, ignored otherwise).
+     * 
+     * The files opened for output or append from then on are open by all the
+     * ranks at once, and IOh5::WriteSlab is a collective write: every rank
+     * must call it for the same datasets in the same order, a rank with
+     * nothing to write passing an empty slab. The file-handle cache must be
+     * flushed and closed by all the ranks together as well.
+     * 
+     * @param enable true for the collective writes, false for the
+     *     independent ones (default).
+     */
+    void SetParallelWrites(const bool enable);
+    /**
+     * Get if the ranks write their slabs to the .h5 files together.
+     * 
+     * @return true if the writes are collective, false if independent.
+     */
+    bool GetParallelWrites();
+
+    /**
+     * Flush all the .h5 files kept open by the file-handle cache.
+     */
+    void FlushFiles();
+    /**
+     * Flush and close all the .h5 files kept open by the file-handle cache.
+     * 
+     * It is called automatically at exit.
+     */
+    void CloseFiles();
+    /**
+     * Flush and close one .h5 file, if kept open by the file-handle cache.
+     * 
+     * @param fname address of the file.
+     */
+    void CloseFile(const std::string &fname);
+
     /**
      * Class for interacting with .h5 files.
+     * 
+     * The files are opened through a process-wide cache of handles, so that
+     * repeated accesses to the same file cost a single open. Each object
+     * holds the HDF5 lock for its whole lifetime, so that objects living in
+     * different threads do not access the library concurrently.
      */
     class IOh5 {
         public:
             /**
              * Constructor.
              * 
+             * A file already open in a compatible mode is reused. Opening a
+             * file in Mode::Out truncates it even if it is already open.
+             * 
              * @param fname address of the file to open.
              * @param mode file opening mode.
              */
             IOh5(const std::string &fname, const Mode mode);
             /**
              * Destructor.
+             * 
+             * The file is left open in the cache.
              */
             ~IOh5();
             /**
              * Read a dataset from the .h5 file.
              * 
+             * Complex-valued images are read either from a compound dataset
+             * with members `r' and `i', or from a group with the two datasets
+             * `real' and `imag'.
+             * 
              * @tparam T scalar typename.
              * 
-             * @param img pointer to the destination image.
+             * @param img pointer to the destination image (its buffer is
+             *     reused if it has the right size).
              * @param url url of the dataset.
              * @param urn urn of the dataset.
              * 
@@ -76,6 +182,12 @@ namespace io {
             /**
              * Write a datates into the .h5 file.
              * 
+             * Complex-valued images are written as compound datasets with
+             * members `r' and `i'. New datasets are created with the chunk
+             * shape and the compression set by SetChunkShape and
+             * SetCompressionLevel. An existing dataset is overwritten only
+             * if it has the size and the type of the image.
+             * 
              * @tparam T scalar typename.
              * 
              * @param img source image.
@@ -86,11 +198,125 @@ namespace io {
              */
             template <typename T>
             State WriteDataset(const Image<T> &img, const std::string &url, const std::string &urn) const;
+            /**
+             * Get the number of voxels in each direction of a dataset.
+             * 
+             * @param nn pointer to the destination of the sizes.
+             * @param url url of the dataset.
+             * @param urn urn of the dataset.
+             * 
+             * @return the IO state.
+             */
+            State GetDatasetSize(std::vector<Index> *nn, const std::string &url, const std::string &urn);
+            /**
+             * Read a hyperslab of a dataset into a caller-supplied buffer.
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param buffer pointer to the destination, with room for the
+             *     voxels of the hyperslab (first index the fastest).
+             * @param offset first voxel of the hyperslab in each direction.
+             * @param count number of voxels of the hyperslab in each direction.
+             * @param url url of the dataset.
+             * @param urn urn of the dataset.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State ReadSlab(T *buffer, const std::vector<Index> &offset,
+                const std::vector<Index> &count, const std::string &url,
+                const std::string &urn);
+            /**
+             * Create a dataset of given size, to be filled by WriteSlab.
+             * 
+             * An existing dataset with the same address, size and type is
+             * left untouched. A different size or type is an error.
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param nn number of voxels in each direction of the dataset.
+             * @param url url of the dataset.
+             * @param urn urn of the dataset.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State CreateDataset(const std::vector<Index> &nn, const std::string &url, const std::string &urn) const;
+            /**
+             * Write a hyperslab of an existing dataset from a caller-supplied
+             * buffer.
+             * 
+             * A hyperslab with no voxels writes nothing, which lets a rank
+             * take part in a collective write (see SetParallelWrites).
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param buffer pointer to the source, holding the voxels of the
+             *     hyperslab (first index the fastest).
+             * @param offset first voxel of the hyperslab in each direction.
+             * @param count number of voxels of the hyperslab in each direction.
+             * @param url url of the dataset.
+             * @param urn urn of the dataset.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State WriteSlab(const T *buffer, const std::vector<Index> &offset,
+                const std::vector<Index> &count, const std::string &url,
+                const std::string &urn) const;
+            /**
+             * List the datasets of the file.
+             * 
+             * @param uris pointer to the destination of the dataset uris.
+             * 
+             * @return the IO state.
+             */
+            State ListDatasets(std::vector<std::string> *uris) const;
+            /**
+             * Copy a dataset from another file, creating the missing groups.
+             * 
+             * @param source file containing the dataset.
+             * @param uri uri of the dataset, the same in both the files.
+             * 
+             * @return the IO state.
+             */
+            State CopyDataset(const IOh5 &source, const std::string &uri) const;
+            /**
+             * Get the offset in the file of a contiguous dataset.
+             * 
+             * @param offset pointer to the offset in bytes, or -1 if the
+             *     dataset is not contiguous or not allocated.
+             * @param url url of the dataset.
+             * @param urn urn of the dataset.
+             * 
+             * @return the IO state.
+             */
+            State GetDatasetOffset(Index *offset, const std::string &url, const std::string &urn);
+            /**
+             * Read a string attribute of the root group.
+             * 
+             * @param value pointer to the destination string.
+             * @param name name of the attribute.
+             * 
+             * @return the IO state.
+             */
+            State ReadAttribute(std::string *value, const std::string &name);
+            /**
+             * Write (or overwrite) a string attribute of the root group.
+             * 
+             * @param value string to be written.
+             * @param name name of the attribute.
+             * 
+             * @return the IO state.
+             */
+            State WriteAttribute(const std::string &value, const std::string &name) const;
         private:
             /// Address of the file to open.
             std::string fname_;
             /// File opening mode.
             Mode mode_;
+            /// Lock of the HDF5 library.
+            std::unique_lock<std::recursive_mutex> lock_;
             /// HDF5 file.
             H5::H5File file_;
     };
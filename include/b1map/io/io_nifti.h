@@ -0,0 +1,162 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef IO_NIFTI_H_
+#define IO_NIFTI_H_
+
+#include <string>
+#include <vector>
+
+#include "b1map/image.h"
+#include "b1map/io/io_util.h"
+
+namespace b1map {
+
+namespace io {
+
+    /**
+     * Set the voxel size recorded in the NIfTI-1 files written from then on.
+     * 
+     * @param dd size of the voxels in each direction, in metres.
+     */
+    void SetVoxelSize(const std::vector<double> &dd);
+
+    /**
+     * Class for interacting with NIfTI-1 files.
+     * 
+     * Only single uncompressed files (.nii) are supported. The data of a
+     * file stored with the native type and byte order, and not scaled, are
+     * mapped (copy-on-write) instead of read when the mapping of the inputs
+     * is enabled (see SetInputMapping). The other files are converted to the
+     * requested type, applying the scaling `scl_slope' and `scl_inter' of
+     * the header to the real-valued data.
+     */
+    class IOnifti {
+        public:
+            /**
+             * Constructor.
+             * 
+             * @param fname address of the file.
+             */
+            explicit IOnifti(const std::string &fname);
+            /**
+             * Read the image of the file.
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param img pointer to the destination image (its buffer is
+             *     reused if it has the right size).
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State ReadDataset(Image<T> *img);
+            /**
+             * Get the number of voxels in each direction of the image.
+             * 
+             * The trailing singleton dimensions beyond the third are
+             * dropped, and the missing ones up to the third are added.
+             * 
+             * @param nn pointer to the destination of the sizes.
+             * 
+             * @return the IO state.
+             */
+            State GetDatasetSize(std::vector<Index> *nn);
+            /**
+             * Read a hyperslab of the image into a caller-supplied buffer.
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param buffer pointer to the destination, with room for the
+             *     voxels of the hyperslab (first index the fastest).
+             * @param offset first voxel of the hyperslab in each direction.
+             * @param count number of voxels of the hyperslab in each direction.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State ReadSlab(T *buffer, const std::vector<Index> &offset,
+                const std::vector<Index> &count);
+            /**
+             * Write an image into the file, overwriting it.
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param img source image.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State WriteDataset(const Image<T> &img) const;
+            /**
+             * Create the file with its header, sized for an image to be
+             * filled by WriteSlab.
+             * 
+             * An existing file is overwritten.
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param nn number of voxels in each direction of the image.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State CreateDataset(const std::vector<Index> &nn) const;
+            /**
+             * Write a hyperslab of the image of an existing file from a
+             * caller-supplied buffer.
+             * 
+             * Concurrent writes of disjoint hyperslabs are safe (see
+             * WriteRawSlab).
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param buffer pointer to the source, holding the voxels of the
+             *     hyperslab (first index the fastest).
+             * @param offset first voxel of the hyperslab in each direction.
+             * @param count number of voxels of the hyperslab in each direction.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State WriteSlab(const T *buffer, const std::vector<Index> &offset,
+                const std::vector<Index> &count) const;
+        private:
+            /// Address of the file.
+            std::string fname_;
+    };
+
+}  // namespace io
+
+}  // namespace b1map
+
+#endif  // IO_NIFTI_H_
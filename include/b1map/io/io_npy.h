@@ -0,0 +1,116 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef IO_NPY_H_
+#define IO_NPY_H_
+
+#include <string>
+#include <vector>
+
+#include "b1map/image.h"
+#include "b1map/io/io_util.h"
+
+namespace b1map {
+
+namespace io {
+
+    /**
+     * Class for writing images into .npy files.
+     * 
+     * The images are stored in C order with the shape reversed, i.e. the
+     * same layout as the datasets written by IOh5, so that `numpy.load' with
+     * `mmap_mode' gives the arrays read by h5py. The header is written when
+     * the file is created, with the file already of its final size, and the
+     * data are written in place through a memory mapping of the file.
+     */
+    class IOnpy {
+        public:
+            /**
+             * Constructor.
+             * 
+             * @param fname address of the .npy file.
+             */
+            explicit IOnpy(const std::string &fname);
+            /**
+             * Write an image into the file, overwriting it.
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param img source image.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State WriteDataset(const Image<T> &img) const;
+            /**
+             * Create the file with its header, sized for an image to be
+             * filled by WriteSlab.
+             * 
+             * An existing file is overwritten.
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param nn number of voxels in each direction of the image.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State CreateDataset(const std::vector<Index> &nn) const;
+            /**
+             * Write a hyperslab of the image of an existing file from a
+             * caller-supplied buffer.
+             * 
+             * Concurrent writes of disjoint hyperslabs are safe (see
+             * WriteRawSlab).
+             * 
+             * @tparam T scalar typename.
+             * 
+             * @param buffer pointer to the source, holding the voxels of the
+             *     hyperslab (first index the fastest).
+             * @param offset first voxel of the hyperslab in each direction.
+             * @param count number of voxels of the hyperslab in each direction.
+             * 
+             * @return the IO state.
+             */
+            template <typename T>
+            State WriteSlab(const T *buffer, const std::vector<Index> &offset,
+                const std::vector<Index> &count) const;
+        private:
+            /// Address of the file.
+            std::string fname_;
+    };
+
+}  // namespace io
+
+}  // namespace b1map
+
+#endif  // IO_NPY_H_
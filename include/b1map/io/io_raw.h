@@ -0,0 +1,117 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef IO_RAW_H_
+#define IO_RAW_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "b1map/util.h"
+
+namespace b1map {
+
+namespace io {
+
+    /**
+     * Check that a hyperslab lies within an array.
+     * 
+     * @param nn number of elements of the array in each direction.
+     * @param offset first element of the hyperslab in each direction.
+     * @param count number of elements of the hyperslab in each direction.
+     * 
+     * @return true if the hyperslab is inside the array.
+     */
+    bool IsSlabInside(const std::vector<Index> &nn, const std::vector<Index> &offset,
+        const std::vector<Index> &count);
+    /**
+     * Read a hyperslab of an array stored raw in a file (first index the
+     * fastest), handing its rows over to a callback.
+     * 
+     * The region spanned by the hyperslab is mapped in the memory, or read
+     * if it cannot be mapped.
+     * 
+     * @param fname address of the file.
+     * @param data_offset offset in bytes of the array in the file.
+     * @param elem_size size in bytes of an element of the array.
+     * @param nn number of elements of the array in each direction.
+     * @param offset first element of the hyperslab in each direction.
+     * @param count number of elements of the hyperslab in each direction.
+     * @param read_row callback receiving the index of a row of the
+     *     hyperslab (of count[0] elements) and a pointer to its raw data.
+     * 
+     * @return true on success, false if the file cannot be read.
+     */
+    bool ReadRawSlab(const std::string &fname, const Index data_offset,
+        const size_t elem_size, const std::vector<Index> &nn,
+        const std::vector<Index> &offset, const std::vector<Index> &count,
+        const std::function<void(const Index,const char*)> &read_row);
+    /**
+     * Write a hyperslab of an array stored raw in a file (first index the
+     * fastest), in place.
+     * 
+     * The region spanned by the hyperslab is mapped in the memory and
+     * written through the mapping, so that concurrent writes of disjoint
+     * hyperslabs are safe.
+     * 
+     * @param fname address of the file, already of its final size.
+     * @param data_offset offset in bytes of the array in the file.
+     * @param elem_size size in bytes of an element of the array.
+     * @param nn number of elements of the array in each direction.
+     * @param buffer pointer to the source, holding the elements of the
+     *     hyperslab (first index the fastest).
+     * @param offset first element of the hyperslab in each direction.
+     * @param count number of elements of the hyperslab in each direction.
+     * 
+     * @return true on success, false if the file cannot be written.
+     */
+    bool WriteRawSlab(const std::string &fname, const Index data_offset,
+        const size_t elem_size, const std::vector<Index> &nn, const void *buffer,
+        const std::vector<Index> &offset, const std::vector<Index> &count);
+    /**
+     * Create a file with a given header, extended to its final size without
+     * allocating the data.
+     * 
+     * @param fname address of the file, overwritten if existing.
+     * @param header header of the file.
+     * @param bytes total size of the file in bytes.
+     * 
+     * @return true on success, false if the file cannot be written.
+     */
+    bool CreateRawFile(const std::string &fname, const std::string &header, const Index bytes);
+
+}  // namespace io
+
+}  // namespace b1map
+
+#endif  // IO_RAW_H_
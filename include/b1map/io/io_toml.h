@@ -58,6 +58,13 @@ namespace io {
              * @param mode file opening mode.
              */
             IOtoml(const std::string &fname, const Mode mode);
+            /**
+             * Constructor from a stream with the TOML content (in input
+             * mode).
+             * 
+             * @param stream stream to be parsed.
+             */
+            IOtoml(std::istream &stream);
             /**
              * Destructor.
              */
@@ -88,6 +95,12 @@ namespace io {
              */
             template <typename T>
             IOError GetArrayOf(std::array<T,NDIM> &array, const std::string &uri) const;
+            /**
+             * Get a constant reference to the parsed content.
+             * 
+             * @return a constant reference to the TOML content.
+             */
+            const toml::Value& GetContent() const;
         private:
             /// Address of the file to open.
             std::string fname_;
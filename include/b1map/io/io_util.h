@@ -88,6 +88,16 @@ namespace io {
         HDF5DataspaceException,
         /// HDF5 datatype error.
         HDF5DatatypeException,
+        /// HDF5 attribute error.
+        HDF5AttributeException,
+        /// NPY file error.
+        NPYFileException,
+        /// NPY format error.
+        NPYFormatException,
+        /// NIfTI file error.
+        NIfTIFileException,
+        /// NIfTI format error.
+        NIfTIFormatException,
     };
     /**
      * Translates in a human-readable string the input IO state.
@@ -97,15 +107,51 @@ namespace io {
      */
     const std::string ToString(const State state);
 
+    /**
+     * File formats.
+     */
+    enum class Format {
+        /// .h5 file, holding many datasets.
+        HDF5 = 0,
+        /// .npy file, holding a single array.
+        NPY,
+        /// NIfTI-1 file (.nii), holding a single image.
+        NIfTI,
+    };
+
     /**
      * Deduce the filename and the uri from a given address.
      * 
+     * The format is selected by the address: `npy:path' is a .npy file, a
+     * path with the extension .nii (or .nii.gz) is a NIfTI-1 file, and any
+     * other address is an .h5 file. The .npy and NIfTI-1 files hold a
+     * single dataset, so the suffixes appended to their address (e.g. for
+     * the Monte Carlo samples) are moved before the extension, see
+     * SuffixedFilename.
+     * 
      * @param address complete address of filename and uri separated by the
      *      character ':'.
      * @param fname address of the file within the complete address.
-     * @param uri address of the element within the complete address.
+     * @param uri address of the element within the complete address (empty
+     *      for the single-dataset formats).
+     * 
+     * @return the format of the file.
+     */
+    Format GetAddress(const std::string &address, std::string &fname, std::string &uri);
+    /**
+     * Provide the address of a single-dataset file, moving the suffixes
+     * appended to its address before the extension.
+     * 
+     * The `/' of the suffixes are replaced by `-', so that `alpha.npy-MC3'
+     * gives `alpha-MC3.npy' and `imgs.nii1/real' gives `imgs1-real.nii'.
+     * The extension is added if missing.
+     * 
+     * @param path address of the file, possibly followed by a suffix.
+     * @param ext extension of the file, including the dot.
+     * 
+     * @return the address of the file.
      */
-    void GetAddress(const std::string &address, std::string &fname, std::string &uri);
+    std::string SuffixedFilename(const std::string &path, const std::string &ext);
     
     // ---------------------------------------------------------------------------
     // -------------------------  Implementation detail  -------------------------
@@ -140,18 +186,59 @@ namespace io {
                 return "IO Error: HDF5, dataspace exception";
             case State::HDF5DatatypeException:
                 return "IO Error: HDF5, datatype exception";
+            case State::HDF5AttributeException:
+                return "IO Error: HDF5, attribute exception";
+            case State::NPYFileException:
+                return "IO Error: NPY, file exception";
+            case State::NPYFormatException:
+                return "IO Error: NPY, format exception";
+            case State::NIfTIFileException:
+                return "IO Error: NIfTI, file exception";
+            case State::NIfTIFormatException:
+                return "IO Error: NIfTI, format exception";
         }
         return "";
     }
 
     // Read filename and uri from the address
-    inline void GetAddress(const std::string &address, std::string &fname, std::string &uri) {
+    inline Format GetAddress(const std::string &address, std::string &fname, std::string &uri) {
+        // .npy file
+        if (address.compare(0,4,"npy:")==0) {
+            fname = SuffixedFilename(address.substr(4),".npy");
+            uri = "";
+            return Format::NPY;
+        }
+        // NIfTI-1 file, possibly followed by a suffix without dots and colons
+        size_t ext = address.rfind(".nii");
+        if (ext!=std::string::npos) {
+            std::string nii = address.compare(ext+4,3,".gz")==0 ? ".nii.gz" : ".nii";
+            if (address.find_first_of(".:",ext+nii.size())==std::string::npos) {
+                fname = SuffixedFilename(address,nii);
+                uri = "";
+                return Format::NIfTI;
+            }
+        }
+        // .h5 file
         size_t snip = 0;
         size_t snap = address.find_first_of(":",0);
         fname = address.substr(snip,snap);
         snip = ++snap;
         uri = address.substr(snip);
-        return;
+        return Format::HDF5;
+    }
+    // Move the suffixes before the extension
+    inline std::string SuffixedFilename(const std::string &path, const std::string &ext) {
+        size_t pos = path.rfind(ext);
+        if (pos==std::string::npos) {
+            return path+ext;
+        }
+        std::string suffix = path.substr(pos+ext.size());
+        for (auto &c : suffix) {
+            if (c=='/') {
+                c = '-';
+            }
+        }
+        return path.substr(0,pos)+suffix+ext;
     }
 
 }  // io
@@ -0,0 +1,149 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef IO_WRITER_H_
+#define IO_WRITER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "b1map/image.h"
+#include "b1map/queue.h"
+#include "b1map/io/io_util.h"
+
+namespace b1map {
+
+namespace io {
+
+    /**
+     * Background writer of images into .h5, .npy or NIfTI-1 files.
+     * 
+     * The images are handed over to a dedicated thread through a bounded
+     * lock-free queue and, once written, their buffers are recycled back to
+     * the producer, so that the computation of the next image overlaps with
+     * the writing of the previous one.
+     * 
+     * @tparam T scalar typename of the images.
+     */
+    template <typename T>
+    class AsyncWriter {
+        public:
+            /**
+             * Constructor.
+             * 
+             * @param n_buffers number of image buffers in flight.
+             */
+            explicit AsyncWriter(const int n_buffers);
+            /**
+             * Destructor.
+             * 
+             * The pending images are written before returning.
+             */
+            ~AsyncWriter();
+            /**
+             * Get a free image buffer, waiting for one to be recycled if
+             * necessary.
+             * 
+             * @return a pointer to the buffer.
+             */
+            Image<T>* Acquire();
+            /**
+             * Queue an image for writing.
+             * 
+             * @param img pointer to an image obtained by Acquire.
+             * @param address complete address of the destination dataset.
+             * 
+             * @return the IO state of the previous writes.
+             */
+            State Push(Image<T> *img, const std::string &address);
+            /**
+             * Wait for the pending images to be written, keeping the writer
+             * thread running.
+             * 
+             * @return the IO state of the writes.
+             */
+            State Flush();
+            /**
+             * Write all the pending images and stop the writer thread.
+             * 
+             * @return the IO state of the writes.
+             */
+            State Finish();
+            /**
+             * Get the address of the first image that failed to be written.
+             * 
+             * @return the address of the dataset.
+             */
+            const std::string& GetFailedAddress() const;
+        private:
+            /**
+             * Writing job.
+             */
+            struct Job {
+                /// Image to be written.
+                Image<T> *img;
+                /// Address of the destination dataset.
+                std::string address;
+            };
+
+            /// Body of the writer thread.
+            void Loop();
+
+            /// Image buffers.
+            std::vector<Image<T> > buffers_;
+            /// Images waiting to be written.
+            SPSCQueue<Job> pending_;
+            /// Buffers ready to be reused.
+            SPSCQueue<Image<T>*> free_;
+            /// Flag for stopping the writer thread.
+            std::atomic<bool> done_;
+            /// Flag for failed writes.
+            std::atomic<bool> failed_;
+            /// Number of queued images (accessed by the producer only).
+            long pushed_;
+            /// Number of processed images.
+            std::atomic<long> processed_;
+            /// State of the first failed write.
+            State state_;
+            /// Address of the first failed write.
+            std::string failed_address_;
+            /// Writer thread.
+            std::thread thread_;
+    };
+
+}  // namespace io
+
+}  // namespace b1map
+
+#endif  // IO_WRITER_H_
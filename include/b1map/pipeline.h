@@ -0,0 +1,121 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef B1MAPSIM_PIPELINE_H_
+#define B1MAPSIM_PIPELINE_H_
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace b1map {
+
+/**
+ * Stage of a pipeline, running on its own thread and keeping track of the
+ * time spent working, so that the bottleneck of the pipeline can be found.
+ */
+class Stage {
+	public:
+		/**
+		 * Constructor.
+		 * 
+		 * @param name Name of the stage.
+		 */
+		explicit Stage(const std::string &name);
+		/**
+		 * Destructor, waiting for the thread to end.
+		 */
+		~Stage();
+		/**
+		 * Start the stage on a new thread.
+		 * 
+		 * An exception thrown by the body ends the stage and its message is
+		 * kept (a generic one if the exception has none, e.g. the HDF5
+		 * ones). The exit function is called anyway at the end, typically
+		 * to close the queues around the stage.
+		 * 
+		 * @param body Work of the stage.
+		 * @param on_exit Function called when the body ends.
+		 * @param n_threads Number of threads of the parallel loops of the
+		 *     stage.
+		 */
+		void Start(const std::function<void()> &body,
+			const std::function<void()> &on_exit, const int n_threads);
+		/**
+		 * Wait for the thread to end.
+		 */
+		void Join();
+		/**
+		 * Mark the beginning of a unit of work (to be called by the body).
+		 */
+		void BeginWork();
+		/**
+		 * Mark the end of a unit of work (to be called by the body).
+		 */
+		void EndWork();
+		/**
+		 * Get the name of the stage.
+		 * 
+		 * @return the name.
+		 */
+		const std::string& GetName() const;
+		/**
+		 * Get the fraction of the lifetime of the stage spent working.
+		 * 
+		 * @return the occupancy, between 0 and 1.
+		 */
+		double GetOccupancy() const;
+		/**
+		 * Get the message of the error that ended the stage.
+		 * 
+		 * @return the message, empty if no error occurred.
+		 */
+		const std::string& GetError() const;
+	private:
+		/// Name of the stage.
+		std::string name_;
+		/// Thread running the stage.
+		std::thread thread_;
+		/// Time spent working.
+		std::chrono::steady_clock::duration busy_;
+		/// Lifetime of the stage.
+		std::chrono::steady_clock::duration life_;
+		/// Beginning of the current unit of work.
+		std::chrono::steady_clock::time_point work_start_;
+		/// Message of the error that ended the stage.
+		std::string error_;
+};
+
+}  // namespace b1map
+
+#endif  // B1MAPSIM_PIPELINE_H_
@@ -0,0 +1,149 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef B1MAPSIM_QUEUE_H_
+#define B1MAPSIM_QUEUE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace b1map {
+
+/**
+ * Bounded lock-free queue for one producer thread and one consumer thread.
+ * 
+ * @tparam T typename of the elements.
+ */
+template <typename T>
+class SPSCQueue {
+	public:
+		/**
+		 * Constructor.
+		 * 
+		 * @param capacity Maximum number of elements in the queue.
+		 */
+		explicit SPSCQueue(const size_t capacity);
+		/**
+		 * Insert an element at the end of the queue (producer side).
+		 * 
+		 * @param value Element to be inserted.
+		 * 
+		 * @return false if the queue is full, true otherwise.
+		 */
+		bool Push(const T &value);
+		/**
+		 * Extract the element at the front of the queue (consumer side).
+		 * 
+		 * @param value Pointer to the extracted element.
+		 * 
+		 * @return false if the queue is empty, true otherwise.
+		 */
+		bool Pop(T *value);
+		/**
+		 * Check if the queue is empty.
+		 * 
+		 * @return true if the queue is empty, false otherwise.
+		 */
+		bool IsEmpty() const;
+	private:
+		/// Ring of the elements (one slot is always left empty).
+		std::vector<T> ring_;
+		/// Position of the next element to be extracted.
+		alignas(64) std::atomic<size_t> head_;
+		/// Position of the next element to be inserted.
+		alignas(64) std::atomic<size_t> tail_;
+};
+
+/**
+ * Bounded blocking queue, which can be closed to signal the consumers that no
+ * more elements will come.
+ * 
+ * @tparam T typename of the elements (only movable is enough).
+ */
+template <typename T>
+class BoundedQueue {
+	public:
+		/**
+		 * Constructor.
+		 * 
+		 * @param capacity Maximum number of elements in the queue.
+		 */
+		explicit BoundedQueue(const size_t capacity);
+		/**
+		 * Insert an element at the end of the queue, waiting while the queue
+		 * is full.
+		 * 
+		 * @param value Element to be moved into the queue.
+		 * 
+		 * @return false if the queue has been closed, true otherwise.
+		 */
+		bool Push(T &&value);
+		/**
+		 * Extract the element at the front of the queue, waiting while the
+		 * queue is empty.
+		 * 
+		 * @param value Pointer to the extracted element.
+		 * 
+		 * @return false if the queue has been closed and drained, true
+		 *     otherwise.
+		 */
+		bool Pop(T *value);
+		/**
+		 * Close the queue: the waiting threads are woken up, the following
+		 * insertions fail and the extractions fail as soon as the queue is
+		 * empty.
+		 */
+		void Close();
+	private:
+		/// Maximum number of elements.
+		size_t capacity_;
+		/// Elements in the queue.
+		std::deque<T> items_;
+		/// Is the queue closed?
+		bool closed_;
+		/// Mutex guarding the queue.
+		std::mutex mutex_;
+		/// Condition signalled when an element is extracted.
+		std::condition_variable not_full_;
+		/// Condition signalled when an element is inserted.
+		std::condition_variable not_empty_;
+};
+
+#include "queue.tcc"
+
+}  // namespace b1map
+
+#endif  // B1MAPSIM_QUEUE_H_
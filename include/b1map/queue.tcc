@@ -0,0 +1,121 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+// SPSCQueue constructor
+template <typename T>
+SPSCQueue<T>::
+SPSCQueue(const size_t capacity) :
+	ring_(capacity+1), head_(0), tail_(0) {
+	return;
+}
+
+// SPSCQueue push
+template <typename T>
+bool SPSCQueue<T>::
+Push(const T &value) {
+	size_t tail = tail_.load(std::memory_order_relaxed);
+	size_t next = (tail+1)%ring_.size();
+	if (next==head_.load(std::memory_order_acquire)) {
+		return false;
+	}
+	ring_[tail] = value;
+	tail_.store(next,std::memory_order_release);
+	return true;
+}
+
+// SPSCQueue pop
+template <typename T>
+bool SPSCQueue<T>::
+Pop(T *value) {
+	size_t head = head_.load(std::memory_order_relaxed);
+	if (head==tail_.load(std::memory_order_acquire)) {
+		return false;
+	}
+	*value = ring_[head];
+	head_.store((head+1)%ring_.size(),std::memory_order_release);
+	return true;
+}
+
+// SPSCQueue is empty?
+template <typename T>
+bool SPSCQueue<T>::
+IsEmpty() const {
+	return head_.load(std::memory_order_acquire)==tail_.load(std::memory_order_acquire);
+}
+
+// BoundedQueue constructor
+template <typename T>
+BoundedQueue<T>::
+BoundedQueue(const size_t capacity) :
+	capacity_(capacity), items_(), closed_(false) {
+	return;
+}
+
+// BoundedQueue push
+template <typename T>
+bool BoundedQueue<T>::
+Push(T &&value) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	not_full_.wait(lock,[this]{return closed_ || items_.size()<capacity_;});
+	if (closed_) {
+		return false;
+	}
+	items_.push_back(std::move(value));
+	not_empty_.notify_one();
+	return true;
+}
+
+// BoundedQueue pop
+template <typename T>
+bool BoundedQueue<T>::
+Pop(T *value) {
+	std::unique_lock<std::mutex> lock(mutex_);
+	not_empty_.wait(lock,[this]{return closed_ || !items_.empty();});
+	if (items_.empty()) {
+		return false;
+	}
+	*value = std::move(items_.front());
+	items_.pop_front();
+	not_full_.notify_one();
+	return true;
+}
+
+// BoundedQueue close
+template <typename T>
+void BoundedQueue<T>::
+Close() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	closed_ = true;
+	not_full_.notify_all();
+	not_empty_.notify_all();
+	return;
+}
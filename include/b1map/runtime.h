@@ -0,0 +1,196 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef B1MAPSIM_RUNTIME_H_
+#define B1MAPSIM_RUNTIME_H_
+
+#include <string>
+#include <vector>
+
+#include "b1map/util.h"
+
+namespace b1map {
+
+/**
+ * Policies for pinning the worker threads to the processors.
+ */
+enum class Affinity {
+	/// Leave the placement to the operating system.
+	None = 0,
+	/// Pin consecutive threads to consecutive processors.
+	Close,
+	/// Spread the threads evenly over the available processors.
+	Spread,
+};
+
+/**
+ * Translates a string into an affinity policy.
+ * 
+ * @param[out] affinity Pointer to the policy.
+ * @param[in] str Name of the policy ("none", "close" or "spread").
+ * 
+ * @return true if the name is a valid policy, false otherwise.
+ */
+bool ParseAffinity(Affinity *affinity, const std::string &str);
+
+/**
+ * Pin the worker threads to the processors available to the process.
+ * 
+ * The pinning holds for the following parallel regions, which reuse the same
+ * threads as long as their number does not change.
+ * 
+ * @param affinity Pinning policy.
+ * 
+ * @return true if the threads have been pinned, false otherwise.
+ */
+bool SetAffinity(const Affinity affinity);
+
+/**
+ * Number of threads used by the parallel loops.
+ * 
+ * @return the number of threads.
+ */
+int GetNumThreads();
+
+/**
+ * Set the number of threads used by the parallel loops started from the
+ * calling thread.
+ * 
+ * @param n_threads Number of threads.
+ */
+void SetNumThreads(const int n_threads);
+
+/**
+ * Initialise the distributed run (MPI builds only, no-op otherwise).
+ * 
+ * @param argc,argv Pointers to the command line arguments.
+ */
+void InitRanks(int *argc, char ***argv);
+
+/**
+ * Finalise the distributed run.
+ * 
+ * @param status Exit status of the calling rank: a failure aborts all the
+ *     other ranks, which would otherwise wait forever for it.
+ */
+void FinalizeRanks(const int status);
+
+/**
+ * Rank of the calling process.
+ * 
+ * @return the rank (0 if the run is not distributed).
+ */
+int GetRank();
+
+/**
+ * Number of processes of the run.
+ * 
+ * @return the number of ranks (1 if the run is not distributed).
+ */
+int GetNumRanks();
+
+/**
+ * Check if any thread of a rank can talk to the other ranks, one thread at a
+ * time, as the collective writes of parallel HDF5 from a pipeline stage need.
+ * 
+ * @return true if the MPI library provides at least the serialized thread
+ *     support, false otherwise (and if the run is not distributed).
+ */
+bool GetSerializedRanks();
+
+/**
+ * Wait for all the ranks.
+ */
+void BarrierRanks();
+
+/**
+ * Sum element-wise a vector over all the ranks.
+ * 
+ * @param v Pointer to the vector, replaced by the sum.
+ */
+void AllReduceSum(std::vector<double> *v);
+/**
+ * Sum element-wise a vector over all the ranks.
+ * 
+ * @param v Pointer to the vector, replaced by the sum.
+ */
+void AllReduceSum(std::vector<Index> *v);
+/**
+ * Concatenate a vector over all the ranks, in the order of the ranks.
+ * 
+ * @param v Pointer to the vector, replaced by the concatenation.
+ */
+void AllGather(std::vector<double> *v);
+/**
+ * Concatenate a vector over all the ranks, in the order of the ranks.
+ * 
+ * @param v Pointer to the vector, replaced by the concatenation.
+ */
+void AllGather(std::vector<Index> *v);
+
+/**
+ * Broadcast a seed from the first rank to all the others.
+ * 
+ * @param seed Pointer to the seed, replaced by the one of the first rank.
+ */
+void BroadcastSeed(std::uint64_t *seed);
+
+/**
+ * Exclusive lock on a file, held by one process at a time and released on
+ * destruction (POSIX systems only, no-op elsewhere).
+ */
+class FileLock {
+	public:
+		/**
+		 * Constructor, waiting for the lock.
+		 * 
+		 * Throws a runtime_error if the lock cannot be taken (e.g., on a
+		 * filesystem without fcntl locks), since writing without it would
+		 * corrupt the file.
+		 * 
+		 * @param fname Address of the file to lock.
+		 */
+		explicit FileLock(const std::string &fname);
+		/**
+		 * Destructor, releasing the lock.
+		 */
+		~FileLock();
+		FileLock(const FileLock&) = delete;
+		FileLock& operator=(const FileLock&) = delete;
+	private:
+		/// Descriptor of the locked file.
+		int fd_;
+};
+
+}  // namespace b1map
+
+#endif  // B1MAPSIM_RUNTIME_H_
@@ -33,6 +33,8 @@
 #ifndef B1MAPSIM_SEQUENCES_H_
 #define B1MAPSIM_SEQUENCES_H_
 
+#include <cstdint>
+
 #include "b1map/body.h"
 #include "b1map/image.h"
 #include "b1map/util.h"
@@ -52,11 +54,13 @@ namespace b1map {
  * @param spoiling Spoiling coefficient for transverse magnetization:
  *     1 is ideal spoiling; 0 is no spoiling.
  * @param body Physical description of the imaging body.
+ * @param b1p_avg Average magnitude of the B1+ over the whole body, when `b1p'
+ *     is only a slab of it: 0 (default) takes the average of `b1p'.
  */
 void GREImage(Image<std::complex<double> > *img, const double alpha_nom,
 	const double TR, const double TE, const Image<std::complex<double> > &b1p,
 	const Image<std::complex<double> > &b1m, const double spoiling,
-	const Body &body);
+	const Body &body, const double b1p_avg = 0.0);
 
 /**
  * Generate two complex-valued MRI images acquired by interleaved GRE sequences
@@ -72,11 +76,13 @@ void GREImage(Image<std::complex<double> > *img, const double alpha_nom,
  * @param spoiling Spoiling coefficient for transverse magnetization:
  *     1 is ideal spoiling; 0 is no spoiling.
  * @param body Physical description of the imaging body.
+ * @param b1p_avg Average magnitude of the B1+ over the whole body, when `b1p'
+ *     is only a slab of it: 0 (default) takes the average of `b1p'.
  */
 void AFIImage(Image<std::complex<double> > *img1, Image<std::complex<double> > *img2,
 	const double alpha_nom, const double TR1, const double TR2, const double TE,
 	const Image<std::complex<double> > &b1p, const Image<std::complex<double> > &b1m,
-	const double spoiling, const Body &body);
+	const double spoiling, const Body &body, const double b1p_avg = 0.0);
 
 /**
  * Generate a complex-valued MRI images acquired by a GRE sequence with the
@@ -95,12 +101,14 @@ void AFIImage(Image<std::complex<double> > *img1, Image<std::complex<double> > *
  * @param spoiling Spoiling coefficient for transverse magnetization:
  *     1 is ideal spoiling; 0 is no spoiling.
  * @param body Physical description of the imaging body.
+ * @param b1p_avg Average magnitude of the B1+ over the whole body, when `b1p'
+ *     is only a slab of it: 0 (default) takes the average of `b1p'.
  */
 void BSSImage(Image<std::complex<double> > *img, const double alpha_nom,
 	const double TR, const double TE, const double bss_offres,
 	const double bss_length, const Image<std::complex<double> > &b1p,
 	const Image<std::complex<double> > &b1m, const double spoiling,
-	const Body &body);
+	const Body &body, const double b1p_avg = 0.0);
 
 /**
  * Evaluate the actual flip-angle distribution.
@@ -108,9 +116,11 @@ void BSSImage(Image<std::complex<double> > *img, const double alpha_nom,
  * @param alpha Pointer to the destination.
  * @param b1p Complex-valued B1+ distribution.
  * @param alpha_nom Nominal flip-angle in radian.
+ * @param b1p_avg Average magnitude of the B1+ the nominal flip-angle refers
+ *     to: 0 (default) takes the average of `b1p'.
  */
 void EvalAlpha(Image<double> *alpha, const Image<std::complex<double> > &b1p,
-	const double alpha_nom);
+	const double alpha_nom, const double b1p_avg = 0.0);
 
 /**
  * Apply the rotation due to an RF pulse with given flip-angle.
@@ -124,29 +134,65 @@ void RFPulse(Image<double> *mx, Image<double> *my, Image<double> *mz,
 /**
  * Apply the spin relaxations.
  * 
+ * @tparam Mat layout of the material ids: Image<std::uint8_t>,
+ *     Image<std::uint16_t>, MaterialRuns or VoxelIds.
+ * 
  * @param mx,my,mz Pointers to the magnetization components.
- * @param e1 Longitudinal relaxation coefficients.
- * @param e2 Transverse relaxation coefficients.
- * @param mat Material codes.
+ * @param table Constants of the materials for the repetition.
+ * @param mat Material ids.
  */
+template <typename Mat>
 void Relax(Image<double> *mx, Image<double> *my, Image<double> *mz,
-	const Image<double> &e1, const Image<double> &e2, const Image<int> &mat);
+	const MaterialTable &table, const Mat &mat);
+
+/**
+ * Evaluate the mask of the voxels where the magnetization is well-defined.
+ * 
+ * @tparam Mat layout of the material ids: Image<std::uint8_t>,
+ *     Image<std::uint16_t>, MaterialRuns or VoxelIds.
+ * 
+ * @param valid Pointer to the mask destination (1 if valid, 0 otherwise).
+ * @param alpha Actual flip-angle distribution.
+ * @param table Constants of the materials for the repetition.
+ * @param mat Material ids.
+ */
+template <typename Mat>
+void EvalValidity(Image<std::uint8_t> *valid, const Image<double> &alpha,
+	const MaterialTable &table, const Mat &mat);
+/**
+ * Exclude from the mask the voxels where further relaxation coefficients are
+ * not well-defined.
+ * 
+ * @tparam Mat layout of the material ids: Image<std::uint8_t>,
+ *     Image<std::uint16_t>, MaterialRuns or VoxelIds.
+ * 
+ * @param valid Pointer to the mask to be restricted.
+ * @param table Constants of the materials for the further repetition.
+ * @param mat Material ids.
+ */
+template <typename Mat>
+void RestrictValidity(Image<std::uint8_t> *valid, const MaterialTable &table,
+	const Mat &mat);
 
 /**
  * Check if the steady-state is reached.
  * 
- * @param mx,my Pointers to new magnetization transverse components.
- * @param mx_old,my_old Pointers to old magnetization transverse components.
+ * @param mx,my New magnetization transverse components.
+ * @param mx_old,my_old Old magnetization transverse components.
+ * @param valid Mask of the voxels to be checked.
  */
 bool IsSteadyState(const Image<double> &mx, const Image<double> &my,
-	const Image<double> &mx_old, const Image<double> &my_old);
+	const Image<double> &mx_old, const Image<double> &my_old,
+	const Image<std::uint8_t> &valid);
 /**
  * Check if the steady-state is reached.
  * 
- * @param m Pointer to new magnetization transverse component.
- * @param m_old Pointer to old magnetization transverse component.
+ * @param m New magnetization transverse component.
+ * @param m_old Old magnetization transverse component.
+ * @param valid Mask of the voxels to be checked.
  */
-bool IsSteadyState(const Image<double> &m, const Image<double> &m_old);
+bool IsSteadyState(const Image<double> &m, const Image<double> &m_old,
+	const Image<std::uint8_t> &valid);
 
 }  // namespace b1map
 
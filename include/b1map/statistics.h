@@ -0,0 +1,109 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef B1MAPSIM_STATISTICS_H_
+#define B1MAPSIM_STATISTICS_H_
+
+#include "b1map/image.h"
+#include "b1map/util.h"
+
+namespace b1map {
+
+/**
+ * Running voxel-wise mean and variance of a set of images (Welford
+ * algorithm). The statistics of two sets can be merged (Chan et al.), so that
+ * a Monte Carlo study can be split among several processes.
+ */
+class RunningStats {
+	public:
+		/**
+		 * Default constructor (empty set).
+		 */
+		RunningStats();
+		/**
+		 * Constructor from previously computed statistics.
+		 * 
+		 * @param count Number of non-NaN samples of each voxel.
+		 * @param mean Mean of each voxel.
+		 * @param m2 Sum of the squared deviations from the mean of each voxel.
+		 */
+		RunningStats(const Image<Index> &count, const Image<double> &mean,
+			const Image<double> &m2);
+		/**
+		 * Add an image to the set (its NaN voxels are skipped).
+		 * 
+		 * @param x Image to be added.
+		 */
+		void Add(const Image<double> &x);
+		/**
+		 * Merge the statistics of another set.
+		 * 
+		 * @param other Statistics of the other set.
+		 */
+		void Merge(const RunningStats &other);
+		/**
+		 * Get the number of non-NaN samples of each voxel.
+		 * 
+		 * @return a constant reference to the counts.
+		 */
+		const Image<Index>& GetCount() const;
+		/**
+		 * Get the mean of each voxel.
+		 * 
+		 * @return a constant reference to the means.
+		 */
+		const Image<double>& GetMean() const;
+		/**
+		 * Get the sum of the squared deviations from the mean of each voxel.
+		 * 
+		 * @return a constant reference to the sums.
+		 */
+		const Image<double>& GetM2() const;
+		/**
+		 * Evaluate the sample standard deviation of each voxel.
+		 * 
+		 * @param std Pointer to the destination (NaN where less than two
+		 *     samples are available).
+		 */
+		void EvalStd(Image<double> *std) const;
+	private:
+		/// Number of non-NaN samples of each voxel.
+		Image<Index> count_;
+		/// Mean of each voxel.
+		Image<double> mean_;
+		/// Sum of the squared deviations from the mean of each voxel.
+		Image<double> m2_;
+};
+
+}  // namespace b1map
+
+#endif  // B1MAPSIM_STATISTICS_H_
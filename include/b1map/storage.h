@@ -0,0 +1,270 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#ifndef B1MAPSIM_STORAGE_H_
+#define B1MAPSIM_STORAGE_H_
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+#include "b1map/util.h"
+
+namespace b1map {
+
+/**
+ * Kinds of storage backing the image data.
+ */
+enum class Storage {
+	/// Memory allocated on the heap.
+	Heap = 0,
+	/// Memory mapped on an anonymous scratch file.
+	Mapped,
+	/// Copy-on-write memory mapped on a region of an input file.
+	FileMapped,
+};
+
+/**
+ * Set the size above which the image data are stored in a memory-mapped
+ * scratch file instead of the heap.
+ * 
+ * @param bytes Size threshold in bytes (0 disables the mapped storage).
+ */
+void SetMappedThreshold(const size_t bytes);
+/**
+ * Get the size above which the image data are memory-mapped.
+ * 
+ * @return the size threshold in bytes (0 if the mapped storage is disabled).
+ */
+size_t GetMappedThreshold();
+/**
+ * Set the directory where the scratch files are created.
+ * 
+ * @param dir Address of the scratch directory.
+ */
+void SetScratchDirectory(const std::string &dir);
+/**
+ * Get the directory where the scratch files are created.
+ * 
+ * @return the address of the scratch directory.
+ */
+const std::string& GetScratchDirectory();
+
+/**
+ * Allocate a block of raw memory.
+ * 
+ * The storage is selected according to the size threshold. Mapped blocks are
+ * backed by an unlinked scratch file and advised for sequential access, so
+ * that the page cache can evict the pages already swept. If the scratch file
+ * cannot be mapped, the block falls back to the heap with a warning (reported
+ * once).
+ * 
+ * @param[out] storage Kind of storage actually used.
+ * @param[in] bytes Size of the block in bytes.
+ * 
+ * @return a pointer to the block.
+ */
+void* Allocate(Storage *storage, const size_t bytes);
+/**
+ * Map a region of a file as a copy-on-write block of memory.
+ * 
+ * The pages are shared with the page cache (and with the other processes
+ * mapping the same file) until they are written. The file must not be
+ * modified while it is mapped.
+ * 
+ * @param fname Address of the file.
+ * @param offset Offset of the region in bytes.
+ * @param bytes Size of the region in bytes.
+ * 
+ * @return a pointer to the block, or nullptr if the mapping fails.
+ */
+void* MapFile(const std::string &fname, const size_t offset, const size_t bytes);
+/**
+ * Release a block of raw memory.
+ * 
+ * @param ptr Pointer to the block.
+ * @param storage Kind of storage of the block.
+ * @param bytes Size of the block in bytes.
+ */
+void Release(void *ptr, const Storage storage, const size_t bytes);
+
+/**
+ * Contiguous buffer of numerical data with selectable storage.
+ * 
+ * The interface is the subset of std::vector used by the algorithms. The
+ * elements are initialised in parallel, so that the pages of large buffers
+ * are first touched by the threads that process them.
+ * 
+ * @tparam T numerical typename of the data.
+ */
+template <typename T>
+class Buffer {
+	static_assert(std::is_trivially_destructible<T>::value,
+		"Buffer supports only trivially destructible types");
+	public:
+		/// Typename of the data.
+		typedef T value_type;
+		/// Typename of the iterators.
+		typedef T* iterator;
+		/// Typename of the constant iterators.
+		typedef const T* const_iterator;
+
+		/**
+		 * Default constructor.
+		 */
+		Buffer();
+		/**
+		 * Constructor of a value-initialised buffer.
+		 * 
+		 * The value-initialised elements must be all-zero bytes (as for the
+		 * arithmetic and complex types), since the mapped buffers are not
+		 * filled.
+		 * 
+		 * @param n Number of elements.
+		 */
+		explicit Buffer(const size_t n);
+		/**
+		 * Constructor of a buffer mapped on a region of a file.
+		 * 
+		 * The buffer is left empty if the file cannot be mapped.
+		 * 
+		 * @param fname Address of the file.
+		 * @param offset Offset of the first element in bytes.
+		 * @param n Number of elements.
+		 */
+		Buffer(const std::string &fname, const size_t offset, const size_t n);
+		/**
+		 * Copy constructor.
+		 * 
+		 * @param other Buffer to be copied.
+		 */
+		Buffer(const Buffer &other);
+		/**
+		 * Move constructor.
+		 * 
+		 * @param other Buffer to be moved.
+		 */
+		Buffer(Buffer &&other);
+		/**
+		 * Destructor.
+		 */
+		~Buffer();
+		/**
+		 * Copy assignment.
+		 * 
+		 * @param other Buffer to be copied.
+		 * 
+		 * @return a reference to this buffer.
+		 */
+		Buffer& operator=(const Buffer &other);
+		/**
+		 * Move assignment.
+		 * 
+		 * @param other Buffer to be moved.
+		 * 
+		 * @return a reference to this buffer.
+		 */
+		Buffer& operator=(Buffer &&other);
+
+		/**
+		 * Number of elements in the buffer.
+		 * 
+		 * @return the number of elements.
+		 */
+		size_t size() const;
+		/**
+		 * Get the kind of storage of the buffer.
+		 * 
+		 * @return the storage.
+		 */
+		Storage GetStorage() const;
+		/**
+		 * Get a pointer to the data.
+		 * 
+		 * @return a pointer to the first element.
+		 */
+		T* data();
+		/**
+		 * Get a constant pointer to the data.
+		 * 
+		 * @return a constant pointer to the first element.
+		 */
+		const T* data() const;
+		/**
+		 * Iterator to the first element.
+		 */
+		iterator begin();
+		/**
+		 * Constant iterator to the first element.
+		 */
+		const_iterator begin() const;
+		/**
+		 * Iterator past the last element.
+		 */
+		iterator end();
+		/**
+		 * Constant iterator past the last element.
+		 */
+		const_iterator end() const;
+		/**
+		 * Get a reference to the idx-th element.
+		 * 
+		 * @param idx index of the element.
+		 * 
+		 * @return a reference to the element.
+		 */
+		T& operator[](const size_t idx);
+		/**
+		 * Get a constant reference to the idx-th element.
+		 * 
+		 * @param idx index of the element.
+		 * 
+		 * @return a constant reference to the element.
+		 */
+		const T& operator[](const size_t idx) const;
+	private:
+		/// Release the owned memory.
+		void Clear();
+
+		/// Pointer to the data.
+		T *data_;
+		/// Number of elements.
+		size_t size_;
+		/// Kind of storage.
+		Storage storage_;
+};
+
+#include "storage.tcc"
+
+}  // namespace b1map
+
+#endif  // B1MAPSIM_STORAGE_H_
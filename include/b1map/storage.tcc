@@ -0,0 +1,189 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+// Buffer constructors
+template <typename T>
+Buffer<T>::
+Buffer() :
+	data_(nullptr), size_(0), storage_(Storage::Heap) {
+	return;
+}
+template <typename T>
+Buffer<T>::
+Buffer(const size_t n) :
+	data_(nullptr), size_(n), storage_(Storage::Heap) {
+	if (size_>0) {
+		data_ = static_cast<T*>(Allocate(&storage_,size_*sizeof(T)));
+		// a fresh scratch file already reads as zeros, filling it would
+		// only dirty all its pages
+		if (storage_!=Storage::Mapped) {
+			ParallelFill(data_,size_,T());
+		}
+	}
+	return;
+}
+template <typename T>
+Buffer<T>::
+Buffer(const std::string &fname, const size_t offset, const size_t n) :
+	data_(nullptr), size_(0), storage_(Storage::Heap) {
+	if (n>0 && offset%alignof(T)==0) {
+		data_ = static_cast<T*>(MapFile(fname,offset,n*sizeof(T)));
+		if (data_!=nullptr) {
+			size_ = n;
+			storage_ = Storage::FileMapped;
+		}
+	}
+	return;
+}
+template <typename T>
+Buffer<T>::
+Buffer(const Buffer &other) :
+	data_(nullptr), size_(other.size_), storage_(Storage::Heap) {
+	if (size_>0) {
+		data_ = static_cast<T*>(Allocate(&storage_,size_*sizeof(T)));
+		ParallelCopy(other.data_,size_,data_);
+	}
+	return;
+}
+template <typename T>
+Buffer<T>::
+Buffer(Buffer &&other) :
+	data_(other.data_), size_(other.size_), storage_(other.storage_) {
+	other.data_ = nullptr;
+	other.size_ = 0;
+	other.storage_ = Storage::Heap;
+	return;
+}
+
+// Buffer destructor
+template <typename T>
+Buffer<T>::
+~Buffer() {
+	Clear();
+	return;
+}
+
+// Buffer assignments
+template <typename T>
+Buffer<T>& Buffer<T>::
+operator=(const Buffer &other) {
+	if (this!=&other) {
+		if (size_!=other.size_) {
+			Clear();
+			size_ = other.size_;
+			if (size_>0) {
+				data_ = static_cast<T*>(Allocate(&storage_,size_*sizeof(T)));
+			}
+		}
+		ParallelCopy(other.data_,size_,data_);
+	}
+	return *this;
+}
+template <typename T>
+Buffer<T>& Buffer<T>::
+operator=(Buffer &&other) {
+	if (this!=&other) {
+		Clear();
+		data_ = other.data_;
+		size_ = other.size_;
+		storage_ = other.storage_;
+		other.data_ = nullptr;
+		other.size_ = 0;
+		other.storage_ = Storage::Heap;
+	}
+	return *this;
+}
+
+// Buffer getters
+template <typename T>
+size_t Buffer<T>::
+size() const {
+	return size_;
+}
+template <typename T>
+Storage Buffer<T>::
+GetStorage() const {
+	return storage_;
+}
+template <typename T>
+T* Buffer<T>::
+data() {
+	return data_;
+}
+template <typename T>
+const T* Buffer<T>::
+data() const {
+	return data_;
+}
+template <typename T>
+typename Buffer<T>::iterator Buffer<T>::
+begin() {
+	return data_;
+}
+template <typename T>
+typename Buffer<T>::const_iterator Buffer<T>::
+begin() const {
+	return data_;
+}
+template <typename T>
+typename Buffer<T>::iterator Buffer<T>::
+end() {
+	return data_+size_;
+}
+template <typename T>
+typename Buffer<T>::const_iterator Buffer<T>::
+end() const {
+	return data_+size_;
+}
+template <typename T>
+T& Buffer<T>::
+operator[](const size_t idx) {
+	return data_[idx];
+}
+template <typename T>
+const T& Buffer<T>::
+operator[](const size_t idx) const {
+	return data_[idx];
+}
+
+// Buffer release
+template <typename T>
+void Buffer<T>::
+Clear() {
+	if (data_!=nullptr) {
+		Release(data_,storage_,size_*sizeof(T));
+	}
+	data_ = nullptr;
+	size_ = 0;
+	storage_ = Storage::Heap;
+	return;
+}
@@ -33,10 +33,22 @@
 #ifndef B1MAPSIM_UTIL_H_
 #define B1MAPSIM_UTIL_H_
 
+#include <cassert>
+#include <cmath>
 #include <complex>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <numeric>
 #include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/// Signed 64-bit type of voxel indices and image sizes.
+typedef std::int64_t Index;
 
 /// Number of spatial dimensions.
 constexpr int NDIM = 3;
@@ -58,6 +70,38 @@ constexpr double GAMMA = 267522.18744;
  */
 const std::string LicenseBoilerplate();
 
+/**
+ * Mix the bits of a 64-bit integer (the finaliser of the SplitMix64
+ * generator), used as a counter-based pseudo-random number generator.
+ * 
+ * @param x integer to be mixed.
+ * 
+ * @return the mixed integer.
+ */
+inline std::uint64_t SplitMix64(std::uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x^(x>>30))*0xBF58476D1CE4E5B9ull;
+    x = (x^(x>>27))*0x94D049BB133111EBull;
+    return x^(x>>31);
+}
+
+/**
+ * Compute the 64-bit FNV-1a hash of a block of memory.
+ * 
+ * @param data pointer to the block.
+ * @param bytes size of the block in bytes.
+ * 
+ * @return the hash.
+ */
+inline std::uint64_t Fnv1a64(const void *data, const std::size_t bytes) {
+    const unsigned char *byte = static_cast<const unsigned char*>(data);
+    std::uint64_t hash = 0xCBF29CE484222325ull;
+    for (std::size_t b = 0; b<bytes; ++b) {
+        hash = (hash^byte[b])*0x100000001B3ull;
+    }
+    return hash;
+}
+
 /**
  * Compute the sum of all the elements in a container.
  * 
@@ -85,7 +129,7 @@ template <typename T>
 inline typename T::value_type Avg(const T &v) {
     using type = typename T::value_type;
     type result = 0;
-    int num = 0;
+    Index num = 0;
     for (auto it = v.begin(); it<v.end(); ++it) {
         if (*it == *it) {
             result += *it;
@@ -143,6 +187,58 @@ inline typename T::value_type DiffNorm2(const T &v, const T &u) {
     }
     return result;
 }
+/**
+ * Compute in a single sweep the squared norm of the difference of two
+ * containers and the squared norm of the second one, over the valid elements.
+ * 
+ * The invalid elements are excluded by a precomputed mask, together with the
+ * elements whose difference is not finite (e.g., NaN produced during the
+ * iterations). The sums are computed block-wise and the block sums are
+ * accumulated with Kahan compensation, so that the precision does not degrade
+ * with the size. The partial sums of the threads are combined in thread order,
+ * so that the result does not change from run to run.
+ * 
+ * @tparam T container typename (real-valued elements).
+ * @tparam M mask typename.
+ * 
+ * @param[in,out] res squared norm of `v-u', added to the input value.
+ * @param[in,out] ref squared norm of `u', added to the input value.
+ * @param[in] v,u containers of elements.
+ * @param[in] valid mask of the valid elements (non-zero if valid).
+ */
+template <typename T, typename M>
+void ResidualNorm2(typename T::value_type *res, typename T::value_type *ref,
+    const T &v, const T &u, const M &valid);
+
+/**
+ * Fill a range with a value.
+ * 
+ * The range is split among the threads with the static partition used by the
+ * voxel loops, so that each memory page is first touched by the thread that
+ * later works on it.
+ * 
+ * @tparam T typename of the elements.
+ * 
+ * @param first pointer to the first element of the range.
+ * @param n number of elements in the range.
+ * @param value value to be assigned.
+ */
+template <typename T>
+void ParallelFill(T *first, const Index n, const T &value);
+/**
+ * Copy a range into another one.
+ * 
+ * The range is split among the threads with the static partition used by the
+ * voxel loops.
+ * 
+ * @tparam T typename of the elements.
+ * 
+ * @param first pointer to the first element of the source range.
+ * @param n number of elements in the range.
+ * @param dest pointer to the first element of the destination range.
+ */
+template <typename T>
+void ParallelCopy(const T *first, const Index n, T *dest);
 
 /**
  * Translates from multi-index to index assuming the first index the fastest.
@@ -160,7 +256,7 @@ inline typename T::value_type DiffNorm2(const T &v, const T &u) {
  * @deprecated
  */
 template <typename T, typename U>
-int MultiIdxToIdx(const T &ii, const U &nn);
+Index MultiIdxToIdx(const T &ii, const U &nn);
 /**
  * Translates from index to multi-index assuming the first index the fastest.
  * 
@@ -176,7 +272,7 @@ int MultiIdxToIdx(const T &ii, const U &nn);
  * @decrecated
  */
 template <typename T, typename U>
-void IdxToMultiIdx(T &ii, int idx, const U &nn);
+void IdxToMultiIdx(T &ii, Index idx, const U &nn);
 
 // ---------------------------------------------------------------------------
 // -------------------------  Implementation detail  -------------------------
@@ -198,12 +294,91 @@ inline const std::string LicenseBoilerplate() {
     return boilerplate;
 }
 
+// Fused squared norms of the residual and of the reference
+template <typename T, typename M>
+void ResidualNorm2(typename T::value_type *res, typename T::value_type *ref,
+    const T &v, const T &u, const M &valid) {
+    using type = typename T::value_type;
+    const Index block = 256;
+    const Index n = static_cast<Index>(v.size());
+    const Index n_blocks = (n+block-1)/block;
+    const type *pv = v.data();
+    const type *pu = u.data();
+    const auto *pm = valid.data();
+    int n_threads = 1;
+    #ifdef _OPENMP
+    n_threads = omp_get_max_threads();
+    #endif
+    std::vector<type> res_part(static_cast<size_t>(n_threads),0.0);
+    std::vector<type> ref_part(static_cast<size_t>(n_threads),0.0);
+    #pragma omp parallel
+    {
+        int thread = 0;
+        #ifdef _OPENMP
+        thread = omp_get_thread_num();
+        #endif
+        // Kahan accumulators of the block sums
+        type res_acc = 0.0, res_c = 0.0;
+        type ref_acc = 0.0, ref_c = 0.0;
+        #pragma omp for schedule(static)
+        for (Index b = 0; b<n_blocks; ++b) {
+            const Index first = b*block;
+            const Index last = first+block<n ? first+block : n;
+            type res_blk = 0.0;
+            type ref_blk = 0.0;
+            #pragma omp simd reduction(+:res_blk,ref_blk)
+            for (Index idx = first; idx<last; ++idx) {
+                type delta = pv[idx]-pu[idx];
+                bool keep = pm[idx] && std::isfinite(delta);
+                type diff = keep ? delta : 0.0;
+                type orig = keep ? pu[idx] : 0.0;
+                res_blk += diff*diff;
+                ref_blk += orig*orig;
+            }
+            type y = res_blk-res_c;
+            type t = res_acc+y;
+            res_c = (t-res_acc)-y;
+            res_acc = t;
+            y = ref_blk-ref_c;
+            t = ref_acc+y;
+            ref_c = (t-ref_acc)-y;
+            ref_acc = t;
+        }
+        res_part[thread] = res_acc;
+        ref_part[thread] = ref_acc;
+    }
+    for (int thread = 0; thread<n_threads; ++thread) {
+        *res += res_part[thread];
+        *ref += ref_part[thread];
+    }
+    return;
+}
+
+// Parallel fill
+template <typename T>
+void ParallelFill(T *first, const Index n, const T &value) {
+    #pragma omp parallel for schedule(static)
+    for (Index idx = 0; idx<n; ++idx) {
+        first[idx] = value;
+    }
+    return;
+}
+// Parallel copy
+template <typename T>
+void ParallelCopy(const T *first, const Index n, T *dest) {
+    #pragma omp parallel for schedule(static)
+    for (Index idx = 0; idx<n; ++idx) {
+        dest[idx] = first[idx];
+    }
+    return;
+}
+
 // Multi-index to index
 template <typename T, typename U>
-int MultiIdxToIdx(const T &ii, const U &nn) {
+Index MultiIdxToIdx(const T &ii, const U &nn) {
     assert(ii.size()==nn.size());
     auto n_dim = ii.size();
-    int idx = 0;
+    Index idx = 0;
     for (decltype(n_dim) d = n_dim; d>0; --d) {
         idx = ii[d-1] + idx*nn[d-1];
     }
@@ -211,7 +386,7 @@ int MultiIdxToIdx(const T &ii, const U &nn) {
 }
 // Index to multi-index
 template <typename T, typename U>
-void IdxToMultiIdx(T &ii, int idx, const U &nn) {
+void IdxToMultiIdx(T &ii, Index idx, const U &nn) {
     assert(ii.size()==nn.size());
     auto n_dim = ii.size();
     for (decltype(n_dim) d = 0; d<n_dim; ++d) {
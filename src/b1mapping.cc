@@ -33,15 +33,54 @@
 #include "b1map/b1mapping.h"
 
 #include <iostream>
-#include <random>
+#include <utility>
+#include <vector>
 
+#include "b1map/cache.h"
 #include "b1map/sequences.h"
 
 namespace b1map {
 
+namespace {
+
+	/**
+	 * Key of the inputs shared by the images of a method.
+	 * 
+	 * The inputs are hashed only when the cache is enabled.
+	 * 
+	 * @param b1p Complex-valued B1+ distribution in tesla.
+	 * @param b1m Complex-valued B1- distribution.
+	 * @param spoiling Spoiling coefficient for transverse magnetization.
+	 * @param body Physical description of the imaging body.
+	 * @param b1p_avg Average magnitude of the B1+ over the whole body.
+	 * 
+	 * @return the key of the inputs.
+	 */
+	CacheKey InputsKey(const Image<std::complex<double> > &b1p,
+		const Image<std::complex<double> > &b1m, const double spoiling,
+		const Body &body, const double b1p_avg) {
+		CacheKey key;
+		if (GetCacheDirectory().empty()) {
+			return key;
+		}
+		key.Add(b1p).Add(b1m).Add(spoiling).Add(b1p_avg);
+		if (body.IsPerVoxel()) {
+			key.Add(std::string("per-voxel"));
+		} else if (body.GetMaterialBytes()==1) {
+			key.Add(body.GetMaterials<std::uint8_t>());
+		} else {
+			key.Add(body.GetMaterials<std::uint16_t>());
+		}
+		key.Add(body.GetRho()).Add(body.GetT1()).Add(body.GetT2Star());
+		return key;
+	}
+
+}  //
+
 // B1Mapping constructor
 B1Mapping::
-B1Mapping() {
+B1Mapping() :
+	noise_seed(0), noise_offset(0) {
 	return;
 }
 // B1Mapping destructor
@@ -54,15 +93,42 @@ Image<std::complex<double> >& B1Mapping::
 GetImg(const int d) {
 	return imgs[d];
 }
+// B1Mapping GetImgs
+const std::array<Image<std::complex<double> >,2>& B1Mapping::
+GetImgs() const {
+	return imgs;
+}
+// B1Mapping SetNoise
+void B1Mapping::
+SetNoise(const std::uint64_t seed, const Index offset) {
+	noise_seed = seed;
+	noise_offset = offset;
+	return;
+}
 
 // DoubleAngle constructor
 DoubleAngle::
 DoubleAngle(const double alpha_nom, const double TR, const double TE,
 	const Image<std::complex<double> > &b1p,
 	const Image<std::complex<double> > &b1m, const double spoiling,
-	const Body &body) {
-	GREImage(&imgs[0],alpha_nom,TR,TE,b1p,b1m,spoiling,body);
-	GREImage(&imgs[1],2.0*alpha_nom,TR,TE,b1p,b1m,spoiling,body);
+	const Body &body, const double b1p_avg) {
+	CacheKey inputs = InputsKey(b1p,b1m,spoiling,body,b1p_avg);
+	CacheKey key0 = CacheKey(inputs).Add("GRE").Add(alpha_nom).Add(TR).Add(TE);
+	if (!LoadCachedImage(&imgs[0],key0)) {
+		GREImage(&imgs[0],alpha_nom,TR,TE,b1p,b1m,spoiling,body,b1p_avg);
+		StoreCachedImage(imgs[0],key0);
+	}
+	CacheKey key1 = CacheKey(inputs).Add("GRE").Add(2.0*alpha_nom).Add(TR).Add(TE);
+	if (!LoadCachedImage(&imgs[1],key1)) {
+		GREImage(&imgs[1],2.0*alpha_nom,TR,TE,b1p,b1m,spoiling,body,b1p_avg);
+		StoreCachedImage(imgs[1],key1);
+	}
+	return;
+}
+// DoubleAngle constructor from the images
+DoubleAngle::
+DoubleAngle(std::array<Image<std::complex<double> >,2> &&imgs) {
+	this->imgs = std::move(imgs);
 	return;
 }
 // DoubleAngle destructor
@@ -72,16 +138,19 @@ DoubleAngle::
 }
 // DoubleAngle Run
 void DoubleAngle::
-Run(Image<double> *alpha_est, const double sigma) {
-	*alpha_est = Image<double>(imgs[0].GetSize(0),imgs[0].GetSize(1),imgs[0].GetSize(2));
+Run(Image<double> *alpha_est, const double sigma, const std::uint64_t sample) {
+	if (alpha_est->GetSize()!=imgs[0].GetSize()) {
+		*alpha_est = Image<double>(imgs[0].GetSize(0),imgs[0].GetSize(1),imgs[0].GetSize(2));
+	}
 	std::array<Image<std::complex<double> >,2>* imgs_noise;
 	if (sigma > 0.0) {
 		imgs_noise = new std::array<Image<std::complex<double> >,2>();
-		AddNoise(imgs_noise,imgs,sigma);
+		AddNoise(imgs_noise,imgs,sigma,noise_seed,sample,noise_offset);
 	} else {
 		imgs_noise = &imgs;
 	}
-	for (int idx = 0; idx<imgs[0].GetNVox(); ++idx) {
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<imgs[0].GetNVox(); ++idx) {
 		(*alpha_est)[idx] = std::acos(std::abs((*imgs_noise)[1][idx])/2.0/std::abs((*imgs_noise)[0][idx]));
 	}
 	if (sigma>0.0) {
@@ -95,8 +164,23 @@ ActualFlipAngle::
 ActualFlipAngle(const double alpha_nom, const double TR1, const double TR2,
 	const double TE, const Image<std::complex<double> > &b1p,
 	const Image<std::complex<double> > &b1m, const double spoiling,
-	const Body &body) {
-	AFIImage(&imgs[0],&imgs[1],alpha_nom,TR1,TR2,TE,b1p,b1m,spoiling,body);
+	const Body &body, const double b1p_avg) {
+	CacheKey key = InputsKey(b1p,b1m,spoiling,body,b1p_avg).Add("AFI").Add(alpha_nom).Add(TR1).Add(TR2).Add(TE);
+	CacheKey key0 = CacheKey(key).Add("1");
+	CacheKey key1 = CacheKey(key).Add("2");
+	if (!LoadCachedImage(&imgs[0],key0) || !LoadCachedImage(&imgs[1],key1)) {
+		AFIImage(&imgs[0],&imgs[1],alpha_nom,TR1,TR2,TE,b1p,b1m,spoiling,body,b1p_avg);
+		StoreCachedImage(imgs[0],key0);
+		StoreCachedImage(imgs[1],key1);
+	}
+	TRratio = TR2/TR1;
+	return;
+}
+// ActualFlipAngle constructor from the images
+ActualFlipAngle::
+ActualFlipAngle(const double TR1, const double TR2,
+	std::array<Image<std::complex<double> >,2> &&imgs) {
+	this->imgs = std::move(imgs);
 	TRratio = TR2/TR1;
 	return;
 }
@@ -107,16 +191,19 @@ ActualFlipAngle::
 }
 // ActualFlipAngle Run
 void ActualFlipAngle::
-Run(Image<double> *alpha_est, const double sigma) {
-	*alpha_est = Image<double> (imgs[0].GetSize(0),imgs[0].GetSize(1),imgs[0].GetSize(2));
+Run(Image<double> *alpha_est, const double sigma, const std::uint64_t sample) {
+	if (alpha_est->GetSize()!=imgs[0].GetSize()) {
+		*alpha_est = Image<double>(imgs[0].GetSize(0),imgs[0].GetSize(1),imgs[0].GetSize(2));
+	}
 	std::array<Image<std::complex<double> >,2>* imgs_noise;
 	if (sigma > 0.0) {
 		imgs_noise = new std::array<Image<std::complex<double> >,2>();
-		AddNoise(imgs_noise,imgs,sigma);
+		AddNoise(imgs_noise,imgs,sigma,noise_seed,sample,noise_offset);
 	} else {
 		imgs_noise = &imgs;
 	}
-	for (int idx = 0; idx<imgs[0].GetNVox(); ++idx) {
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<imgs[0].GetNVox(); ++idx) {
 		double tmp = std::abs((*imgs_noise)[1][idx])/std::abs((*imgs_noise)[0][idx]);
 		(*alpha_est)[idx] = std::acos((TRratio*tmp-1.0)/(TRratio-tmp));
 	}
@@ -132,9 +219,26 @@ BlochSiegertShift(const double alpha_nom, const double TR, const double TE,
 	const double bss_offres, const double bss_length,
 	const Image<std::complex<double> > &b1p,
 	const Image<std::complex<double> > &b1m, const double spoiling,
-	const Body &body) {
-	BSSImage(&imgs[0],alpha_nom,TR,TE,+bss_offres,bss_length,b1p,b1m,spoiling,body);
-	BSSImage(&imgs[1],alpha_nom,TR,TE,-bss_offres,bss_length,b1p,b1m,spoiling,body);
+	const Body &body, const double b1p_avg) {
+	CacheKey inputs = InputsKey(b1p,b1m,spoiling,body,b1p_avg);
+	CacheKey key0 = CacheKey(inputs).Add("BSS").Add(alpha_nom).Add(TR).Add(TE).Add(+bss_offres).Add(bss_length);
+	if (!LoadCachedImage(&imgs[0],key0)) {
+		BSSImage(&imgs[0],alpha_nom,TR,TE,+bss_offres,bss_length,b1p,b1m,spoiling,body,b1p_avg);
+		StoreCachedImage(imgs[0],key0);
+	}
+	CacheKey key1 = CacheKey(inputs).Add("BSS").Add(alpha_nom).Add(TR).Add(TE).Add(-bss_offres).Add(bss_length);
+	if (!LoadCachedImage(&imgs[1],key1)) {
+		BSSImage(&imgs[1],alpha_nom,TR,TE,-bss_offres,bss_length,b1p,b1m,spoiling,body,b1p_avg);
+		StoreCachedImage(imgs[1],key1);
+	}
+	Kbs = GAMMA*GAMMA*bss_length/2.0/bss_offres;
+	return;
+}
+// BlochSiegertShift constructor from the images
+BlochSiegertShift::
+BlochSiegertShift(const double bss_offres, const double bss_length,
+	std::array<Image<std::complex<double> >,2> &&imgs) {
+	this->imgs = std::move(imgs);
 	Kbs = GAMMA*GAMMA*bss_length/2.0/bss_offres;
 	return;
 }
@@ -145,16 +249,19 @@ BlochSiegertShift::
 }
 // BlochSiegertShift run
 void BlochSiegertShift::
-Run(Image<double> *alpha_est, const double sigma) {
-	*alpha_est = Image<double>(imgs[0].GetSize(0),imgs[0].GetSize(1),imgs[0].GetSize(2));
+Run(Image<double> *alpha_est, const double sigma, const std::uint64_t sample) {
+	if (alpha_est->GetSize()!=imgs[0].GetSize()) {
+		*alpha_est = Image<double>(imgs[0].GetSize(0),imgs[0].GetSize(1),imgs[0].GetSize(2));
+	}
 	std::array<Image<std::complex<double> >,2>* imgs_noise;
 	if (sigma > 0.0) {
 		imgs_noise = new std::array<Image<std::complex<double> >,2>();
-		AddNoise(imgs_noise,imgs,sigma);
+		AddNoise(imgs_noise,imgs,sigma,noise_seed,sample,noise_offset);
 	} else {
 		imgs_noise = &imgs;
 	}
-	for (int idx = 0; idx<imgs[0].GetNVox(); ++idx) {
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<imgs[0].GetNVox(); ++idx) {
 		(*alpha_est)[idx] = std::sqrt(std::arg((*imgs_noise)[0][idx]/(*imgs_noise)[1][idx])/2.0/Kbs);
 	}
 	if (sigma>0.0) {
@@ -168,11 +275,21 @@ TRxPhaseGRE::
 TRxPhaseGRE(const double alpha_nom, const double TR, const double TE,
 	const Image<std::complex<double> > &b1p,
 	const Image<std::complex<double> > &b1m, const double spoiling,
-	const Body &body) {
-	GREImage(&imgs[0],alpha_nom,TR,TE,b1p,b1m,spoiling,body);
+	const Body &body, const double b1p_avg) {
+	CacheKey key = InputsKey(b1p,b1m,spoiling,body,b1p_avg).Add("GRE").Add(alpha_nom).Add(TR).Add(TE);
+	if (!LoadCachedImage(&imgs[0],key)) {
+		GREImage(&imgs[0],alpha_nom,TR,TE,b1p,b1m,spoiling,body,b1p_avg);
+		StoreCachedImage(imgs[0],key);
+	}
 	imgs[1] = Image<std::complex<double> >(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
 	return;
 }
+// TRxPhaseGRE constructor from the images
+TRxPhaseGRE::
+TRxPhaseGRE(std::array<Image<std::complex<double> >,2> &&imgs) {
+	this->imgs = std::move(imgs);
+	return;
+}
 // TRxPhaseGRE destructor
 TRxPhaseGRE::
 ~TRxPhaseGRE() {
@@ -180,16 +297,19 @@ TRxPhaseGRE::
 }
 // TRxPhaseGRE Run
 void TRxPhaseGRE::
-Run(Image<double> *alpha_est, const double sigma) {
-	*alpha_est = Image<double>(imgs[0].GetSize(0),imgs[0].GetSize(1),imgs[0].GetSize(2));
+Run(Image<double> *alpha_est, const double sigma, const std::uint64_t sample) {
+	if (alpha_est->GetSize()!=imgs[0].GetSize()) {
+		*alpha_est = Image<double>(imgs[0].GetSize(0),imgs[0].GetSize(1),imgs[0].GetSize(2));
+	}
 	Image<std::complex<double> >* img_noise;
 	if (sigma > 0.0) {
 		img_noise = new Image<std::complex<double> >;
-		AddNoise(img_noise,imgs[0],sigma);
+		AddNoise(img_noise,imgs[0],sigma,noise_seed,2*sample,noise_offset);
 	} else {
 		img_noise = &(imgs[0]);
 	}
-	for (int idx = 0; idx<imgs[0].GetNVox(); ++idx) {
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<imgs[0].GetNVox(); ++idx) {
 		(*alpha_est)[idx] = std::arg((*img_noise)[idx]);
 	}
 	if (sigma>0.0) {
@@ -201,39 +321,46 @@ Run(Image<double> *alpha_est, const double sigma) {
 // Noise utils
 double ComputeSigma(const std::array<Image<std::complex<double> >,2> &imgs,
 	const double noise) {
-	std::array<double,2> sigma{0.0,0.0};
+	std::array<double,2> avg{0.0,0.0};
 	for (int d = 0; d<2; ++d) {
-		Image<double> tmp(imgs[0].GetSize(0),imgs[0].GetSize(1),imgs[0].GetSize(2));
-		for (int idx = 0; idx<imgs[d].GetNVox(); ++idx) {
-			tmp[idx] = std::abs(imgs[d][idx]);
-		}
-		sigma[d] = Avg(tmp.GetData())*noise;
+		std::vector<double> sum(imgs[d].GetSize(2),0.0);
+		std::vector<Index> num(imgs[d].GetSize(2),0);
+		AccumulatePlanes(&sum,&num,imgs[d]);
+		avg[d] = PlaneAvg(sum,num);
 	}
-	return (sigma[0]+sigma[1])/2.0;
+	return ComputeSigma(avg,noise);
+}
+double ComputeSigma(const std::array<double,2> &avg, const double noise) {
+	return (avg[0]*noise+avg[1]*noise)/2.0;
 }
 void AddNoise(std::array<Image<std::complex<double> >,2> *imgs_noise,
 	const std::array<Image<std::complex<double> >,2> &imgs,
-	const double sigma) {
-	std::random_device generator;
-	std::normal_distribution<double> distribution(0.0,sigma);
+	const double sigma, const std::uint64_t seed, const std::uint64_t sample,
+	const Index offset) {
 	for (int d = 0; d<2; ++d) {
-		(*imgs_noise)[d] = Image<std::complex<double> >(imgs[d].GetSize(0),imgs[d].GetSize(1),imgs[d].GetSize(2));
-		for (int idx = 0; idx<imgs[d].GetNVox(); ++idx) {
-			std::complex<double> tmp(distribution(generator),distribution(generator));
-			(*imgs_noise)[d][idx] = imgs[d][idx]+tmp;
-		}
+		AddNoise(&(*imgs_noise)[d],imgs[d],sigma,seed,2*sample+d,offset);
 	}
 	return;
 }
 void AddNoise(Image<std::complex<double> > *img_noise,
 	const Image<std::complex<double> > &img,
-	const double sigma) {
-	std::random_device generator;
-	std::normal_distribution<double> distribution(0.0,sigma);
-	(*img_noise) = Image<std::complex<double> >(img.GetSize(0),img.GetSize(1),img.GetSize(2));
-	for (int idx = 0; idx<img.GetNVox(); ++idx) {
-		std::complex<double> tmp(distribution(generator),distribution(generator));
-		(*img_noise)[idx] = img[idx]+tmp;
+	const double sigma, const std::uint64_t seed, const std::uint64_t stream,
+	const Index offset) {
+	if (img_noise->GetSize()!=img.GetSize()) {
+		*img_noise = Image<std::complex<double> >(img.GetSize());
+	}
+	std::uint64_t key = SplitMix64(seed^SplitMix64(stream));
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<img.GetNVox(); ++idx) {
+		// Box-Muller transform of two uniform numbers drawn from the counter
+		// the counter is hashed on its own, so that keys differing in a few
+		// bits do not give the same numbers at shifted voxels
+		std::uint64_t x = SplitMix64(key+SplitMix64(static_cast<std::uint64_t>(offset+idx)));
+		std::uint64_t y = SplitMix64(x);
+		double u1 = (static_cast<double>(x>>11)+1.0)/9007199254740992.0;
+		double u2 = static_cast<double>(y>>11)/9007199254740992.0;
+		double r = sigma*std::sqrt(-2.0*std::log(u1));
+		(*img_noise)[idx] = img[idx]+std::polar(r,2.0*PI*u2);
 	}
 	return;
 }
@@ -32,51 +32,664 @@
 
 #include "b1map/body.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
 #include "b1map/io/io_hdf5.h"
+#include "b1map/io/io_nifti.h"
 #include "b1map/io/io_toml.h"
+#include "b1map/runtime.h"
 
 namespace b1map {
 
 void ReadConfig(const io::IOtoml &file, std::pair<std::string,std::string> *arg);
-template <typename T> void LoadMap(Image<T> *map, const std::string &address);
+
+constexpr Index MaterialRuns::BLOCK;
+
+namespace {
+
+	/// Encoding of the material ids as runs.
+	bool material_runs = false;
+
+	/**
+	 * Encode the material ids as runs, split at the block boundaries.
+	 * 
+	 * @param runs Pointer to the runs destination.
+	 * @param ids Material ids.
+	 */
+	template <typename Id>
+	void EncodeRuns(MaterialRuns *runs, const Image<Id> &ids) {
+		Index n_vox = ids.GetNVox();
+		Index n_blocks = (n_vox+MaterialRuns::BLOCK-1)/MaterialRuns::BLOCK;
+		// count the runs of each block, then place them
+		std::vector<Index> block_first(static_cast<size_t>(n_blocks)+1,0);
+		#pragma omp parallel for schedule(static)
+		for (Index block = 0; block<n_blocks; ++block) {
+			Index end = std::min(n_vox,(block+1)*MaterialRuns::BLOCK);
+			Index n_runs = 1;
+			for (Index idx = block*MaterialRuns::BLOCK+1; idx<end; ++idx) {
+				n_runs += ids[idx]!=ids[idx-1];
+			}
+			block_first[block+1] = n_runs;
+		}
+		for (Index block = 0; block<n_blocks; ++block) {
+			block_first[block+1] += block_first[block];
+		}
+		runs->begin.assign(static_cast<size_t>(block_first[n_blocks])+1,n_vox);
+		runs->id.assign(static_cast<size_t>(block_first[n_blocks]),0);
+		#pragma omp parallel for schedule(static)
+		for (Index block = 0; block<n_blocks; ++block) {
+			Index end = std::min(n_vox,(block+1)*MaterialRuns::BLOCK);
+			Index run = block_first[block];
+			runs->begin[run] = block*MaterialRuns::BLOCK;
+			runs->id[run] = ids[block*MaterialRuns::BLOCK];
+			for (Index idx = block*MaterialRuns::BLOCK+1; idx<end; ++idx) {
+				if (ids[idx]!=ids[idx-1]) {
+					++run;
+					runs->begin[run] = idx;
+					runs->id[run] = ids[idx];
+				}
+			}
+		}
+		runs->block_first = std::move(block_first);
+		return;
+	}
+
+	/**
+	 * Read the clustering tolerance of the property maps.
+	 * 
+	 * @param config Content of the .toml file.
+	 * @param tolerance Pointer to the tolerance.
+	 * 
+	 * @return true if the properties are maps with a clustering tolerance,
+	 *     false otherwise.
+	 */
+	bool ReadClustering(const io::IOtoml &config, double *tolerance) {
+		std::string mat_addr;
+		io::IOError error = config.GetValue<std::string>(mat_addr,"body.materials");
+		if (error!=io::IOError::Success && error!=io::IOError::MissingData) {
+			throw std::runtime_error(io::ToString(error)+" 'body.materials'");
+		}
+		if (error==io::IOError::Success) {
+			return false;
+		}
+		error = config.GetValue<double>(*tolerance,"body.clustering-tolerance");
+		if ((error!=io::IOError::Success && error!=io::IOError::MissingData) || *tolerance<0.0) {
+			throw std::runtime_error(io::ToString(error==io::IOError::Success ?
+				io::IOError::OutOfRange : error)+" 'body.clustering-tolerance'");
+		}
+		return error==io::IOError::Success;
+	}
+
+	/**
+	 * Map of the body, resolved to the file holding it.
+	 */
+	struct BodyMap {
+		/// Address of the map in the configuration.
+		std::string address;
+		/// Format of the file.
+		io::Format format;
+		/// Address of the file.
+		std::string fname;
+		/// Address of the dataset in the file.
+		std::string uri;
+		/// Size of the map.
+		std::vector<Index> nn;
+	};
+
+	/**
+	 * Handle of a file holding some maps of the body.
+	 */
+	class BodyFile {
+		public:
+			/**
+			 * Constructor.
+			 * 
+			 * @param map Any map of the file.
+			 */
+			explicit BodyFile(const BodyMap &map) {
+				if (map.format==io::Format::NIfTI) {
+					nifti_.reset(new io::IOnifti(map.fname));
+				} else {
+					h5_.reset(new io::IOh5(map.fname,io::Mode::In));
+				}
+				return;
+			}
+			/**
+			 * Get the size of a map of the file.
+			 * 
+			 * @param map Pointer to the map, whose size is set.
+			 * 
+			 * @return the IO state.
+			 */
+			io::State GetSize(BodyMap *map) {
+				return nifti_ ? nifti_->GetDatasetSize(&map->nn) :
+					h5_->GetDatasetSize(&map->nn,"/",map->uri);
+			}
+			/**
+			 * Read a map of the file, or some planes of it.
+			 * 
+			 * @param img Pointer to the destination image.
+			 * @param map Map to be read, with its size.
+			 * @param z0 First plane of the slab.
+			 * @param nz Number of planes of the slab (negative for the whole
+			 *     map).
+			 * 
+			 * @return the IO state.
+			 */
+			template <typename T>
+			io::State Read(Image<T> *img, const BodyMap &map, const Index z0, const Index nz) {
+				if (nz<0) {
+					return nifti_ ? nifti_->ReadDataset(img) : h5_->ReadDataset(img,"/",map.uri);
+				}
+				const std::vector<Index> &nn = map.nn;
+				if (img->GetSize()!=std::vector<Index>{nn[0],nn[1],nz}) {
+					*img = Image<T>(nn[0],nn[1],nz);
+				}
+				std::vector<Index> offset{0,0,z0};
+				std::vector<Index> count{nn[0],nn[1],nz};
+				return nifti_ ? nifti_->ReadSlab(img->GetData().data(),offset,count) :
+					h5_->ReadSlab(img->GetData().data(),offset,count,"/",map.uri);
+			}
+		private:
+			/// Handle of a .h5 file.
+			std::unique_ptr<io::IOh5> h5_;
+			/// Handle of a NIfTI-1 file.
+			std::unique_ptr<io::IOnifti> nifti_;
+	};
+
+}  //
+
+// Encoding of the material ids as runs
+void SetMaterialRuns(const bool enable) {
+	material_runs = enable;
+	return;
+}
+bool GetMaterialRuns() {
+	return material_runs;
+}
+
+// BodyClusters constructors
+BodyClusters::
+BodyClusters() :
+	enabled_(false), tolerance_(0.0), width_(0.0), finished_(false), overflow_(false),
+	plane_keys_(), plane_counts_(), plane_sums_(), codes_(), lists_() {
+	return;
+}
+BodyClusters::
+BodyClusters(const double tolerance) :
+	BodyClusters() {
+	enabled_ = true;
+	tolerance_ = tolerance;
+	width_ = std::log1p(tolerance);
+	return;
+}
+BodyClusters::
+BodyClusters(const io::IOtoml &config) :
+	BodyClusters() {
+	double tolerance = 0.0;
+	if (ReadClustering(config,&tolerance)) {
+		*this = BodyClusters(tolerance);
+	}
+	return;
+}
+
+// BodyClusters hash of a key
+size_t BodyClusters::KeyHash::
+operator()(const Key &key) const {
+	std::uint64_t h = 0x9e3779b97f4a7c15ull;
+	for (std::int64_t k : key) {
+		h ^= static_cast<std::uint64_t>(k)+0x9e3779b97f4a7c15ull+(h<<6)+(h>>2);
+	}
+	return static_cast<size_t>(h);
+}
+
+// BodyClusters check if enabled
+bool BodyClusters::
+IsEnabled() const {
+	return enabled_;
+}
+
+// BodyClusters check if finished
+bool BodyClusters::
+IsFinished() const {
+	return finished_;
+}
+
+// BodyClusters add a slab
+void BodyClusters::
+AddSlab(const io::IOtoml &config, const Index z0, const Index nz,
+	const std::vector<Index> &nn) {
+	if (!enabled_ || overflow_) {
+		return;
+	}
+	Body slab(config,z0,nz,nn,*this);
+	Add(std::array<const Image<double>*,3>{&slab.GetRho(),&slab.GetT1(),&slab.GetT2Star()});
+	return;
+}
+
+// BodyClusters gather the planes of all the ranks
+void BodyClusters::
+Finish() {
+	if (!enabled_) {
+		finished_ = true;
+		return;
+	}
+	std::vector<Index> overflow{overflow_ ? 1 : 0};
+	AllReduceSum(&overflow);
+	overflow_ = overflow[0]>0;
+	if (!overflow_) {
+		// the ranks hold consecutive planes, so that their concatenation
+		// keeps the order of the planes
+		AllGather(&plane_keys_);
+		AllGather(&plane_counts_);
+		AllGather(&plane_sums_);
+	}
+	Combine();
+	return;
+}
+
+// BodyClusters key of a voxel
+BodyClusters::Key BodyClusters::
+GetKey(const std::array<double,3> &values) const {
+	// the positive finite values are binned on a logarithmic scale, the
+	// others (and all of them without tolerance) are kept exact
+	Key key;
+	for (size_t i = 0; i<values.size(); ++i) {
+		double value = values[i];
+		if (tolerance_>0.0 && value>0.0 && std::isfinite(value)) {
+			key[2*i] = 1;
+			key[2*i+1] = std::llround(std::log(value)/width_);
+		} else {
+			key[2*i] = 0;
+			std::memcpy(&key[2*i+1],&value,sizeof(double));
+		}
+	}
+	return key;
+}
+
+// BodyClusters add some planes
+void BodyClusters::
+Add(const std::array<const Image<double>*,3> &props) {
+	if (overflow_) {
+		return;
+	}
+	const std::vector<Index> &nn = props[0]->GetSize();
+	Index n_plane = nn.size()==3 ? nn[0]*nn[1] : props[0]->GetNVox();
+	Index n_vox = props[0]->GetNVox();
+	for (Index idx0 = 0; idx0<n_vox; idx0 += n_plane) {
+		// the properties of a cluster are summed within the plane, then
+		// over the planes
+		std::unordered_map<Key,Index,KeyHash> entries;
+		for (Index idx = idx0; idx<idx0+n_plane; ++idx) {
+			std::array<double,3> values{(*props[0])[idx],(*props[1])[idx],(*props[2])[idx]};
+			Key key = GetKey(values);
+			auto found = entries.find(key);
+			Index entry;
+			if (found==entries.end()) {
+				if (codes_.emplace(key,0).second && codes_.size()>65536) {
+					overflow_ = true;
+					plane_keys_ = std::vector<Index>();
+					plane_counts_ = std::vector<Index>();
+					plane_sums_ = std::vector<double>();
+					codes_.clear();
+					return;
+				}
+				entry = static_cast<Index>(plane_counts_.size());
+				entries.emplace(key,entry);
+				plane_keys_.insert(plane_keys_.end(),key.begin(),key.end());
+				plane_counts_.push_back(0);
+				plane_sums_.insert(plane_sums_.end(),3,0.0);
+			} else {
+				entry = found->second;
+			}
+			for (size_t i = 0; i<values.size(); ++i) {
+				plane_sums_[3*entry+i] += values[i];
+			}
+			++plane_counts_[entry];
+		}
+	}
+	return;
+}
+
+// BodyClusters compute the properties of the clusters
+void BodyClusters::
+Combine() {
+	finished_ = true;
+	codes_.clear();
+	std::vector<Key> keys;
+	std::vector<std::array<double,3> > sum;
+	std::vector<Index> count;
+	for (size_t entry = 0; entry<plane_counts_.size() && !overflow_; ++entry) {
+		Key key;
+		std::copy(plane_keys_.begin()+6*entry,plane_keys_.begin()+6*(entry+1),key.begin());
+		auto found = codes_.find(key);
+		int code;
+		if (found==codes_.end()) {
+			if (keys.size()>=65536) {
+				overflow_ = true;
+				break;
+			}
+			code = static_cast<int>(keys.size());
+			codes_.emplace(key,code);
+			keys.push_back(key);
+			sum.push_back(std::array<double,3>{0.0,0.0,0.0});
+			count.push_back(0);
+		} else {
+			code = found->second;
+		}
+		for (size_t i = 0; i<3; ++i) {
+			sum[code][i] += plane_sums_[3*entry+i];
+		}
+		count[code] += plane_counts_[entry];
+	}
+	plane_keys_ = std::vector<Index>();
+	plane_counts_ = std::vector<Index>();
+	plane_sums_ = std::vector<double>();
+	if (overflow_) {
+		codes_.clear();
+		return;
+	}
+	// the properties of a cluster are the means of the binned values and
+	// the exact values of the others
+	Index n_clusters = static_cast<Index>(keys.size());
+	for (size_t i = 0; i<lists_.size(); ++i) {
+		lists_[i] = Image<double>(std::max<Index>(n_clusters,1));
+		for (Index code = 0; code<n_clusters; ++code) {
+			if (keys[code][2*i]) {
+				lists_[i][code] = sum[code][i]/static_cast<double>(count[code]);
+			} else {
+				std::memcpy(&lists_[i][code],&keys[code][2*i+1],sizeof(double));
+			}
+		}
+	}
+	return;
+}
 
 // Body constructors
 Body::
 Body() :
-	materials_(), t1_(), t2star_() {
+	per_voxel_(false), material_bytes_(1), materials8_(), materials16_(), runs_(), rho_(),
+	t1_(), t2star_(), tables_() {
+	return;
+}
+Body::
+Body(const std::string &fname) :
+	Body(io::IOtoml(fname,io::Mode::In)) {
+	return;
+}
+Body::
+Body(const std::string &fname, const Index z0, const Index nz) :
+	Body(io::IOtoml(fname,io::Mode::In),z0,nz) {
+	return;
+}
+Body::
+Body(const io::IOtoml &config, const std::vector<Index> &nn) :
+	Body() {
+	Load(config,0,-1,nn,nullptr);
+	return;
+}
+Body::
+Body(const io::IOtoml &config, const Index z0, const Index nz,
+	const std::vector<Index> &nn) :
+	Body() {
+	Load(config,z0,nz,nn,nullptr);
 	return;
 }
 Body::
-Body(const std::string &fname) {
-	std::pair<std::string,std::string> mat_addr; mat_addr.second = "body.materials";
-	std::pair<std::string,std::string> rho_addr; rho_addr.second = "body.proton-density";
-	std::pair<std::string,std::string> t1_addr; t1_addr.second = "body.longitudinal-relaxation";
-	std::pair<std::string,std::string> t2star_addr; t2star_addr.second = "body.transverse-relaxation";
-	// read the configuration file
-	io::IOtoml io_toml(fname,io::Mode::In);
-	ReadConfig(io_toml,&mat_addr);
-	ReadConfig(io_toml,&rho_addr);
-	ReadConfig(io_toml,&t1_addr);
-	ReadConfig(io_toml,&t2star_addr);
-	// load the maps
-	LoadMap(&materials_,mat_addr.first);
-	LoadMap(&rho_,rho_addr.first);
-	LoadMap(&t1_,t1_addr.first);
-	LoadMap(&t2star_,t2star_addr.first);
+Body(const io::IOtoml &config, const Index z0, const Index nz,
+	const std::vector<Index> &nn, const BodyClusters &clusters) :
+	Body() {
+	Load(config,z0,nz,nn,&clusters);
+	return;
+}
+
+// Body load the maps
+void Body::
+Load(const io::IOtoml &config, const Index z0, const Index nz,
+	const std::vector<Index> &nn, const BodyClusters *clusters) {
+	tables_.clear();
+	const std::array<std::string,4> keys{"body.materials","body.proton-density",
+		"body.longitudinal-relaxation","body.transverse-relaxation"};
+	// read the configuration, without materials the properties are maps
+	std::array<BodyMap,4> maps;
+	std::string mat_addr;
+	io::IOError error = config.GetValue<std::string>(mat_addr,keys[0]);
+	if (error!=io::IOError::Success && error!=io::IOError::MissingData) {
+		throw std::runtime_error(io::ToString(error)+" '"+keys[0]+"'");
+	}
+	bool continuous = error==io::IOError::MissingData;
+	double tolerance = 0.0;
+	bool clustering = continuous && ReadClustering(config,&tolerance);
+	size_t first_map = continuous ? 1 : 0;
+	for (size_t i = first_map; i<maps.size(); ++i) {
+		std::pair<std::string,std::string> addr; addr.second = keys[i];
+		ReadConfig(config,&addr);
+		maps[i].address = addr.first;
+		maps[i].format = io::GetAddress(addr.first,maps[i].fname,maps[i].uri);
+	}
+	// group the maps by file
+	std::map<std::string,std::vector<size_t> > groups;
+	for (size_t i = first_map; i<maps.size(); ++i) {
+		groups[maps[i].fname].push_back(i);
+	}
+	// check the sizes before any map is read
+	for (const auto &group : groups) {
+		const BodyMap &first = maps[group.second.front()];
+		std::unique_ptr<BodyFile> file;
+		try {
+			file.reset(new BodyFile(first));
+		} catch (const H5::Exception&) {
+			throw std::runtime_error(io::ToString(io::State::HDF5FileException)+" '"+first.address+"'");
+		}
+		for (size_t i : group.second) {
+			io::State state = file->GetSize(&maps[i]);
+			if (state!=io::State::Success) {
+				throw std::runtime_error(io::ToString(state)+" '"+maps[i].address+"'");
+			}
+		}
+	}
+	const std::vector<Index> &mat_nn = maps[first_map].nn;
+	if (mat_nn.size()!=3 || (!nn.empty() && mat_nn!=nn) || (nz>=0 && (z0<0 || z0+nz>mat_nn[2]))) {
+		throw std::runtime_error("Wrong size '"+maps[first_map].address+"'");
+	}
+	for (size_t i = 2; i<maps.size(); ++i) {
+		if (continuous ? maps[i].nn!=mat_nn : Prod(maps[i].nn)!=Prod(maps[1].nn)) {
+			throw std::runtime_error("Wrong size '"+maps[i].address+"'");
+		}
+	}
+	// read the files concurrently, the maps of each file through its handle
+	Image<int> codes;
+	std::array<Image<double>*,4> tables{nullptr,&rho_,&t1_,&t2star_};
+	std::array<io::State,4> states;
+	states.fill(io::State::Success);
+	auto read_group = [&](const std::vector<size_t> &group) {
+		try {
+			BodyFile file(maps[group.front()]);
+			for (size_t i : group) {
+				if (i==0) {
+					states[i] = file.Read(&codes,maps[i],z0,nz);
+				} else if (continuous) {
+					states[i] = file.Read(tables[i],maps[i],z0,nz);
+				} else {
+					states[i] = file.Read(tables[i],maps[i],0,-1);
+				}
+			}
+		} catch (const H5::Exception&) {
+			for (size_t i : group) {
+				states[i] = io::State::HDF5FileException;
+			}
+		}
+	};
+	if (groups.size()==1) {
+		read_group(groups.begin()->second);
+	} else {
+		std::vector<std::thread> readers;
+		for (const auto &group : groups) {
+			readers.emplace_back(read_group,std::cref(group.second));
+		}
+		for (std::thread &reader : readers) {
+			reader.join();
+		}
+	}
+	for (size_t i = first_map; i<maps.size(); ++i) {
+		if (states[i]!=io::State::Success) {
+			throw std::runtime_error(io::ToString(states[i])+" '"+maps[i].address+"'");
+		}
+	}
+	if (continuous) {
+		// without clustering the maps are kept voxel by voxel, and so they
+		// are while the clusters of the whole body are collected; without
+		// them, the maps read are clustered on their own
+		BodyClusters own;
+		if (clustering && clusters==nullptr) {
+			own = BodyClusters(tolerance);
+			own.Add(std::array<const Image<double>*,3>{&rho_,&t1_,&t2star_});
+			own.Combine();
+			clusters = &own;
+		}
+		per_voxel_ = !clustering || !clusters->IsFinished() || !Cluster(&codes,*clusters);
+		if (!per_voxel_) {
+			Remap(codes,maps[1].address);
+		}
+	} else {
+		Remap(codes,maps[0].address);
+	}
+	return;
+}
+
+// Body cluster the property maps
+bool Body::
+Cluster(Image<int> *codes, const BodyClusters &clusters) {
+	if (clusters.overflow_) {
+		return false;
+	}
+	std::array<Image<double>*,3> props{&rho_,&t1_,&t2star_};
+	*codes = Image<int>(rho_.GetSize());
+	for (Index idx = 0; idx<codes->GetNVox(); ++idx) {
+		auto found = clusters.codes_.find(clusters.GetKey(std::array<double,3>{rho_[idx],t1_[idx],t2star_[idx]}));
+		if (found==clusters.codes_.end()) {
+			throw std::runtime_error("Voxel out of the clusters of the body");
+		}
+		(*codes)[idx] = found->second;
+	}
+	for (size_t i = 0; i<props.size(); ++i) {
+		*props[i] = clusters.lists_[i];
+	}
+	return true;
+}
+
+// Body remap the material codes
+void Body::
+Remap(const Image<int> &codes, const std::string &address) {
+	Index n_codes = rho_.GetNVox();
+	// mark the codes in use, counting those out of the property lists
+	std::vector<std::uint8_t> used(static_cast<size_t>(n_codes),0);
+	Index n_wrong = 0;
+	#pragma omp parallel reduction(+:n_wrong)
+	{
+		std::vector<std::uint8_t> used_local(static_cast<size_t>(n_codes),0);
+		#pragma omp for schedule(static)
+		for (Index idx = 0; idx<codes.GetNVox(); ++idx) {
+			int code = codes[idx];
+			if (code<0 || code>=n_codes) {
+				++n_wrong;
+			} else {
+				used_local[code] = 1;
+			}
+		}
+		#pragma omp critical
+		for (Index code = 0; code<n_codes; ++code) {
+			used[code] |= used_local[code];
+		}
+	}
+	if (n_wrong>0) {
+		throw std::runtime_error("Material codes out of the property lists ("+std::to_string(n_wrong)+" voxels) '"+address+"'");
+	}
+	// dense ids of the codes in use
+	std::vector<Index> ids(static_cast<size_t>(n_codes),0);
+	Index n_mat = 0;
+	for (Index code = 0; code<n_codes; ++code) {
+		if (used[code]) {
+			ids[code] = n_mat++;
+		}
+	}
+	if (n_mat>65536) {
+		throw std::runtime_error("Too many materials ("+std::to_string(n_mat)+") '"+address+"'");
+	}
+	// compact the property lists
+	std::array<Image<double>*,3> lists{&rho_,&t1_,&t2star_};
+	for (Image<double> *list : lists) {
+		Image<double> compact(std::max<Index>(n_mat,1));
+		for (Index code = 0; code<n_codes; ++code) {
+			if (used[code]) {
+				compact[ids[code]] = (*list)[code];
+			}
+		}
+		*list = std::move(compact);
+	}
+	// store the ids with the narrowest type
+	material_bytes_ = n_mat<=256 ? 1 : 2;
+	if (material_bytes_==1) {
+		materials8_ = Image<std::uint8_t>(codes.GetSize());
+		#pragma omp parallel for schedule(static)
+		for (Index idx = 0; idx<codes.GetNVox(); ++idx) {
+			materials8_[idx] = static_cast<std::uint8_t>(ids[codes[idx]]);
+		}
+	} else {
+		materials16_ = Image<std::uint16_t>(codes.GetSize());
+		#pragma omp parallel for schedule(static)
+		for (Index idx = 0; idx<codes.GetNVox(); ++idx) {
+			materials16_[idx] = static_cast<std::uint16_t>(ids[codes[idx]]);
+		}
+	}
+	if (material_runs) {
+		if (material_bytes_==1) {
+			EncodeRuns(&runs_,materials8_);
+		} else {
+			EncodeRuns(&runs_,materials16_);
+		}
+	}
 	return;
 }
 
 // Getters
-Image<int>& Body::
-GetMaterials() {
-	return materials_;
+bool Body::
+IsPerVoxel() const {
+	return per_voxel_;
+}
+size_t Body::
+GetMaterialBytes() const {
+	return material_bytes_;
+}
+template <>
+const Image<std::uint8_t>& Body::
+GetMaterials<std::uint8_t>() const {
+	return materials8_;
+}
+template <>
+const Image<std::uint16_t>& Body::
+GetMaterials<std::uint16_t>() const {
+	return materials16_;
 }
-const Image<int>& Body::
-GetMaterials() const {
-	return materials_;
+bool Body::
+HasRuns() const {
+	return !runs_.block_first.empty();
+}
+const MaterialRuns& Body::
+GetRuns() const {
+	return runs_;
 }
 Image<double>& Body::
 GetRho() {
+	tables_.clear();
 	return rho_;
 }
 const Image<double>& Body::
@@ -85,6 +698,7 @@ GetRho() const {
 }
 Image<double>& Body::
 GetT1() {
+	tables_.clear();
 	return t1_;
 }
 const Image<double>& Body::
@@ -93,6 +707,7 @@ GetT1() const {
 }
 Image<double>& Body::
 GetT2Star() {
+	tables_.clear();
 	return t2star_;
 }
 const Image<double>& Body::
@@ -100,6 +715,30 @@ GetT2Star() const {
 	return t2star_;
 }
 
+// Body material table
+const MaterialTable& Body::
+GetTable(const double TR, const double TE, const double spoiling) const {
+	std::array<double,3> key{TR,TE,spoiling};
+	auto found = tables_.find(key);
+	if (found!=tables_.end()) {
+		return found->second;
+	}
+	Index n_mat = t1_.GetNVox();
+	MaterialTable table;
+	table.scale = Image<double>(n_mat);
+	table.e1 = Image<double>(n_mat);
+	table.e2 = Image<double>(n_mat);
+	table.valid = Image<std::uint8_t>(n_mat);
+	#pragma omp parallel for schedule(static)
+	for (Index id_mat = 0; id_mat<n_mat; ++id_mat) {
+		table.scale[id_mat] = rho_[id_mat]*std::exp(-TE/t2star_[id_mat]);
+		table.e1[id_mat] = std::exp(-TR/t1_[id_mat]);
+		table.e2[id_mat] = std::exp(-TR/t2star_[id_mat])*(1.0-spoiling);
+		table.valid[id_mat] = std::isfinite(table.e1[id_mat]) && std::isfinite(table.e2[id_mat]);
+	}
+	return tables_.emplace(key,std::move(table)).first->second;
+}
+
 // Read an argumento from the configuration file
 void ReadConfig(const io::IOtoml &file, std::pair<std::string,std::string> *arg) {
 	io::IOError error = file.GetValue<std::string>(arg->first,arg->second);
@@ -109,18 +748,4 @@ void ReadConfig(const io::IOtoml &file, std::pair<std::string,std::string> *arg)
 	return;
 }
 
-// Load a map from the h5 file
-template <typename T>
-void LoadMap(Image<T> *map, const std::string &address) {
-	std::string fname;
-	std::string uri;
-	io::GetAddress(address,fname,uri);
-	io::IOh5 io_h5(fname,io::Mode::In);
-	io::State state = io_h5.ReadDataset(map,"/",uri);
-	if (state!=io::State::Success) {
-		throw std::runtime_error(io::ToString(state)+" '"+address+"'");
-	}
-	return;
-}
-
 }  // namespace b1map
@@ -0,0 +1,278 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "b1map/io/io_nifti.h"
+#include "b1map/version.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define B1MAPSIM_HAS_DIRENT
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace b1map {
+
+namespace {
+
+	/// Size of the blocks hashed in parallel.
+	constexpr size_t HASH_BLOCK = 1<<20;
+	/// Prefix of the names of the cached images.
+	const std::string CACHE_PREFIX = "b1map-";
+	/// Extension of the names of the cached images.
+	const std::string CACHE_EXTENSION = ".nii";
+
+	/// Directory of the cache (empty means disabled).
+	std::string cache_directory = "";
+	/// Maximum size of the cache in bytes (0 means no limit).
+	size_t cache_size = 0;
+	/// Serialisation of the evictions of the threads.
+	std::mutex cache_mutex;
+	/// Counter of the temporary files of this process.
+	std::atomic<unsigned> cache_tmp_count(0);
+
+	/**
+	 * Hash a block of memory, 8 bytes at a time.
+	 * 
+	 * @param seed Seed of the hash.
+	 * @param data Pointer to the block.
+	 * @param bytes Size of the block in bytes.
+	 * 
+	 * @return the hash.
+	 */
+	std::uint64_t HashBlock(std::uint64_t seed, const unsigned char *data, const size_t bytes) {
+		std::uint64_t hash = SplitMix64(seed^bytes);
+		size_t b = 0;
+		for (; b+8<=bytes; b += 8) {
+			std::uint64_t word;
+			std::memcpy(&word,data+b,8);
+			hash = SplitMix64(hash^word);
+		}
+		if (b<bytes) {
+			std::uint64_t word = 0;
+			std::memcpy(&word,data+b,bytes-b);
+			hash = SplitMix64(hash^word);
+		}
+		return hash;
+	}
+
+	/**
+	 * Get the address of a cached image.
+	 * 
+	 * @param key Key of the image.
+	 * 
+	 * @return the address of the image.
+	 */
+	std::string CachedFilename(const CacheKey &key) {
+		return cache_directory+"/"+CACHE_PREFIX+key.ToString()+CACHE_EXTENSION;
+	}
+
+	/**
+	 * Evict the least recently used images in excess of the maximum size.
+	 */
+	void Evict() {
+		#ifdef B1MAPSIM_HAS_DIRENT
+		if (cache_size==0) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		DIR *dir = opendir(cache_directory.c_str());
+		if (dir==nullptr) {
+			return;
+		}
+		struct Entry {
+			std::string fname;
+			size_t bytes;
+			time_t mtime;
+		};
+		std::vector<Entry> entries;
+		size_t total = 0;
+		while (struct dirent *item = readdir(dir)) {
+			std::string name(item->d_name);
+			if (name.size()<=CACHE_PREFIX.size()+CACHE_EXTENSION.size()
+				|| name.compare(0,CACHE_PREFIX.size(),CACHE_PREFIX)!=0
+				|| name.compare(name.size()-CACHE_EXTENSION.size(),CACHE_EXTENSION.size(),CACHE_EXTENSION)!=0) {
+				continue;
+			}
+			std::string fname = cache_directory+"/"+name;
+			struct stat info;
+			if (stat(fname.c_str(),&info)!=0) {
+				continue;
+			}
+			entries.push_back({fname,static_cast<size_t>(info.st_size),info.st_mtime});
+			total += static_cast<size_t>(info.st_size);
+		}
+		closedir(dir);
+		std::sort(entries.begin(),entries.end(),[](const Entry &a, const Entry &b) {
+			return a.mtime<b.mtime;
+		});
+		for (const Entry &entry : entries) {
+			if (total<=cache_size) {
+				break;
+			}
+			// an image already evicted by a concurrent run is skipped
+			if (std::remove(entry.fname.c_str())==0) {
+				total -= entry.bytes;
+			}
+		}
+		#endif
+		return;
+	}
+
+}  //
+
+// CacheKey constructor
+CacheKey::
+CacheKey() :
+	hash_(0) {
+	Add(project::str());
+	Add(build::str());
+	return;
+}
+
+// CacheKey add a scalar
+CacheKey& CacheKey::
+Add(const double value) {
+	AddBytes(&value,sizeof(double));
+	return *this;
+}
+// CacheKey add a tag
+CacheKey& CacheKey::
+Add(const std::string &tag) {
+	AddBytes(tag.data(),tag.size());
+	return *this;
+}
+// CacheKey add an image
+template <typename T>
+CacheKey& CacheKey::
+Add(const Image<T> &img) {
+	const std::vector<Index> &nn = img.GetSize();
+	AddBytes(nn.data(),nn.size()*sizeof(Index));
+	const unsigned char *data = reinterpret_cast<const unsigned char*>(img.GetData().data());
+	size_t bytes = static_cast<size_t>(img.GetNVox())*sizeof(T);
+	Index n_blocks = static_cast<Index>((bytes+HASH_BLOCK-1)/HASH_BLOCK);
+	std::vector<std::uint64_t> block_hash(static_cast<size_t>(n_blocks));
+	#pragma omp parallel for schedule(static)
+	for (Index block = 0; block<n_blocks; ++block) {
+		size_t offset = static_cast<size_t>(block)*HASH_BLOCK;
+		block_hash[block] = HashBlock(static_cast<std::uint64_t>(block),data+offset,std::min(HASH_BLOCK,bytes-offset));
+	}
+	AddBytes(block_hash.data(),block_hash.size()*sizeof(std::uint64_t));
+	return *this;
+}
+// CacheKey add a block of memory
+void CacheKey::
+AddBytes(const void *data, const size_t bytes) {
+	hash_ = HashBlock(hash_,static_cast<const unsigned char*>(data),bytes);
+	return;
+}
+
+// CacheKey to string
+std::string CacheKey::
+ToString() const {
+	std::ostringstream hex;
+	hex<<std::hex<<std::setw(16)<<std::setfill('0')<<hash_;
+	return hex.str();
+}
+
+// Cache directory
+void SetCacheDirectory(const std::string &dir) {
+	cache_directory = dir;
+	return;
+}
+const std::string& GetCacheDirectory() {
+	return cache_directory;
+}
+
+// Cache size
+void SetCacheSize(const size_t bytes) {
+	cache_size = bytes;
+	return;
+}
+size_t GetCacheSize() {
+	return cache_size;
+}
+
+// Load a cached image
+bool LoadCachedImage(Image<std::complex<double> > *img, const CacheKey &key) {
+	if (cache_directory.empty()) {
+		return false;
+	}
+	std::string fname = CachedFilename(key);
+	if (io::IOnifti(fname).ReadDataset(img)!=io::State::Success) {
+		return false;
+	}
+	#ifdef B1MAPSIM_HAS_DIRENT
+	// the modification time marks the most recently used images
+	utime(fname.c_str(),nullptr);
+	#endif
+	return true;
+}
+
+// Store a cached image
+void StoreCachedImage(const Image<std::complex<double> > &img, const CacheKey &key) {
+	if (cache_directory.empty()) {
+		return;
+	}
+	std::string fname = CachedFilename(key);
+	std::string tmp_fname = fname+".tmp";
+	#ifdef B1MAPSIM_HAS_DIRENT
+	tmp_fname += std::to_string(getpid());
+	#endif
+	tmp_fname += "-"+std::to_string(cache_tmp_count++);
+	if (io::IOnifti(tmp_fname).WriteDataset(img)!=io::State::Success
+		|| std::rename(tmp_fname.c_str(),fname.c_str())!=0) {
+		std::remove(tmp_fname.c_str());
+		return;
+	}
+	Evict();
+	return;
+}
+
+template CacheKey& CacheKey::Add<std::uint8_t>(const Image<std::uint8_t> &img);
+template CacheKey& CacheKey::Add<std::uint16_t>(const Image<std::uint16_t> &img);
+template CacheKey& CacheKey::Add<double>(const Image<double> &img);
+template CacheKey& CacheKey::Add<std::complex<double> >(const Image<std::complex<double> > &img);
+
+}  // namespace b1map
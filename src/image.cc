@@ -31,3 +31,18 @@
 *****************************************************************************/
 
 #include "b1map/image.h"
+
+namespace b1map {
+
+// Average of the planes
+double PlaneAvg(const std::vector<double> &sum, const std::vector<Index> &num) {
+	double total_sum = 0.0;
+	Index total_num = 0;
+	for (size_t k = 0; k<sum.size(); ++k) {
+		total_sum += sum[k];
+		total_num += num[k];
+	}
+	return total_sum/total_num;
+}
+
+}  // namespace b1map
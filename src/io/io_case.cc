@@ -0,0 +1,71 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/io/io_case.h"
+
+#include "b1map/io/io_hdf5.h"
+
+using namespace b1map;
+using namespace b1map::io;
+
+// Check the .h5 signature
+bool io::
+IsCaseFile(const std::string &fname) {
+    std::lock_guard<std::recursive_mutex> lock(HDF5Mutex());
+    H5::Exception::dontPrint();
+    try {
+        return H5::H5File::isHdf5(fname);
+    } catch (const H5::Exception&) {
+        return false;
+    }
+}
+
+// Read the packed configuration
+State io::
+ReadCase(std::string *config, const std::string &fname) {
+    State state;
+    try {
+        IOh5 ifile(fname,Mode::In);
+        state = ifile.ReadAttribute(config,CASE_ATTRIBUTE);
+    } catch (const H5::Exception&) {
+        return State::HDF5FileException;
+    }
+    if (state!=State::Success) {
+        return state;
+    }
+    size_t idx = 0;
+    while ((idx = config->find(CASE_PLACEHOLDER,idx))!=std::string::npos) {
+        config->replace(idx,CASE_PLACEHOLDER.size(),fname);
+        idx += fname.size();
+    }
+    return State::Success;
+}
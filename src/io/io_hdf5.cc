@@ -33,6 +33,10 @@
 #include "b1map/io/io_hdf5.h"
 
 #include <algorithm>
+#include <complex>
+#include <cstdlib>
+#include <map>
+#include <mutex>
 
 using namespace b1map;
 using namespace b1map::io;
@@ -85,6 +89,151 @@ namespace {
         return group;
     }
 
+    /// Chunk shape of the new datasets.
+    std::vector<Index> chunk_shape;
+    /// Deflate level of the new datasets.
+    int compression_level = 0;
+    /// Mapping of the contiguous datasets read from the input files.
+    bool input_mapping = true;
+    /// Alignment of the objects written in the files.
+    Index alignment = 0;
+    /// Collective writes of the ranks through MPI-IO.
+    bool parallel_writes = false;
+
+    /// Largest size of a chunk in bytes (HDF5 allows less than 4 GiB).
+    const hsize_t max_chunk_bytes = (hsize_t(1)<<32)-1;
+
+    /**
+     * Provide the creation properties of a new dataset.
+     * 
+     * The chunks are halved along the slowest directions until they fit in
+     * the largest size allowed by HDF5.
+     * 
+     * @param nn number of voxels in each direction of the dataset.
+     * @param type_size size in bytes of an element of the dataset.
+     * 
+     * @return hdf5 dataset creation property list
+     */
+    H5::DSetCreatPropList CreationProperties(const std::vector<Index> &nn,
+        const size_t type_size) {
+        H5::DSetCreatPropList plist;
+        bool compress = compression_level>0 && H5Zfilter_avail(H5Z_FILTER_DEFLATE)>0;
+        if (!compress && chunk_shape.empty()) {
+            return plist;
+        }
+        // chunk shape in hdf5 order (slowest index first)
+        int n_dim = static_cast<int>(nn.size());
+        std::vector<hsize_t> chunk(n_dim);
+        for (int d = 0; d<n_dim; ++d) {
+            Index c = nn[d];
+            if (!chunk_shape.empty()) {
+                if (d<static_cast<int>(chunk_shape.size()) && chunk_shape[d]>0) {
+                    c = std::min(chunk_shape[d],nn[d]);
+                }
+            } else if (d==n_dim-1) {
+                c = 1;
+            }
+            chunk[n_dim-1-d] = static_cast<hsize_t>(std::max(c,Index(1)));
+        }
+        hsize_t chunk_bytes = static_cast<hsize_t>(type_size);
+        for (hsize_t c : chunk) {
+            chunk_bytes *= c;
+        }
+        for (int d = 0; d<n_dim && chunk_bytes>max_chunk_bytes; ++d) {
+            while (chunk[d]>1 && chunk_bytes>max_chunk_bytes) {
+                chunk_bytes = chunk_bytes/chunk[d]*((chunk[d]+1)/2);
+                chunk[d] = (chunk[d]+1)/2;
+            }
+        }
+        plist.setChunk(n_dim,chunk.data());
+        if (compress) {
+            plist.setShuffle();
+            plist.setDeflate(compression_level);
+        }
+        return plist;
+    }
+
+    /**
+     * Entry of the file-handle cache.
+     */
+    struct CachedFile {
+        /// HDF5 file.
+        H5::H5File file;
+        /// File opening mode.
+        Mode mode;
+    };
+
+    /**
+     * Access the file-handle cache, keyed by the file address.
+     * 
+     * @return a reference to the cache.
+     */
+    inline std::map<std::string,CachedFile>& FileCache() {
+        // never destroyed, since it is still used by the handler at exit
+        static std::map<std::string,CachedFile> *cache = new std::map<std::string,CachedFile>();
+        return *cache;
+    }
+    /**
+     * Open an hdf5 file through the file-handle cache.
+     * 
+     * A file open in input is reused by the following inputs, a file open in
+     * append or output mode is reused by the following inputs and appends.
+     * Any other request closes the cached handle and reopens the file, so
+     * an output truncates the file even if it is cached for append.
+     * 
+     * @param fname address of the file.
+     * @param mode file opening mode.
+     * 
+     * @return hdf5 file
+     */
+    H5::H5File OpenCached(const std::string &fname, const Mode mode) {
+        std::lock_guard<std::recursive_mutex> lock(HDF5Mutex());
+        static bool registered = false;
+        if (!registered) {
+            std::atexit(CloseFiles);
+            registered = true;
+        }
+        std::map<std::string,CachedFile> &cache = FileCache();
+        auto it = cache.find(fname);
+        if (it!=cache.end()) {
+            if (mode==Mode::In || (mode==Mode::Append && it->second.mode!=Mode::In)) {
+                return it->second.file;
+            }
+            // the cached handle is not compatible with the requested mode
+            it->second.file.close();
+            cache.erase(it);
+        }
+        CachedFile entry;
+        entry.mode = mode;
+        H5::FileAccPropList fapl;
+        if (alignment>0) {
+            fapl.setAlignment(static_cast<hsize_t>(alignment),static_cast<hsize_t>(alignment));
+        }
+        #ifdef H5_HAVE_PARALLEL
+        // the outputs are open by all the ranks together
+        if (parallel_writes && mode!=Mode::In) {
+            H5Pset_fapl_mpio(fapl.getId(),MPI_COMM_WORLD,MPI_INFO_NULL);
+        }
+        #endif
+        switch (mode) {
+            case Mode::In:
+                entry.file = H5::H5File(fname, H5F_ACC_RDONLY);
+                break;
+            case Mode::Out:
+                entry.file = H5::H5File(fname, H5F_ACC_TRUNC, H5::FileCreatPropList::DEFAULT, fapl);
+                break;
+            case Mode::Append:
+                try {
+                    entry.file = H5::H5File(fname, H5F_ACC_RDWR, H5::FileCreatPropList::DEFAULT, fapl);
+                } catch (const H5::FileIException&) {
+                    entry.file = H5::H5File(fname, H5F_ACC_TRUNC, H5::FileCreatPropList::DEFAULT, fapl);
+                }
+                break;
+        }
+        cache[fname] = entry;
+        return entry.file;
+    }
+
     // HDF5 types traits
     template <typename T>
     struct HDF5Types;
@@ -119,29 +268,333 @@ namespace {
             return H5::PredType::NATIVE_LONG;
         }
     };
+    // complex numbers as compound (r,i) types, as h5py does
+    template <typename T>
+    struct HDF5Types<std::complex<T> > {
+        static const H5::DataType Type() {
+            H5::CompType type(sizeof(std::complex<T>));
+            type.insertMember("r",0,HDF5Types<T>::Type());
+            type.insertMember("i",sizeof(T),HDF5Types<T>::Type());
+            return type;
+        }
+    };
+
+    /**
+     * Collect the uri of a dataset, visiting the links of a file.
+     * 
+     * @param group identifier of the visited group.
+     * @param name path of the link.
+     * @param info link details.
+     * @param data pointer to the vector of the uris.
+     * 
+     * @return 0 to continue the visit.
+     */
+    herr_t CollectDataset(hid_t group, const char *name, const H5L_info_t *info, void *data) {
+        if (info->type!=H5L_TYPE_HARD) {
+            return 0;
+        }
+        hid_t obj = H5Oopen(group,name,H5P_DEFAULT);
+        if (obj<0) {
+            return -1;
+        }
+        if (H5Iget_type(obj)==H5I_DATASET) {
+            static_cast<std::vector<std::string>*>(data)->push_back("/"+std::string(name));
+        }
+        H5Oclose(obj);
+        return 0;
+    }
+
+    /**
+     * Open a dataset, or create it if it does not exist.
+     * 
+     * An existing dataset must have the requested size and type, otherwise
+     * a dataspace or datatype exception is thrown.
+     * 
+     * @param file hdf5 file
+     * @param nn number of voxels in each direction of the dataset.
+     * @param url url of the dataset.
+     * @param urn urn of the dataset.
+     * 
+     * @return hdf5 dataset
+     */
+    template <typename T>
+    H5::DataSet OpenOrCreateDataset(const H5::H5File &file,
+        const std::vector<Index> &nn, const std::string &url,
+        const std::string &urn) {
+        // open or create the group
+        H5::Group group;
+        try {
+            group = file.openGroup(url);
+        } catch (const H5::Exception&) {
+            group = CreateGroup(file,url);
+        }
+        // create the dataset
+        int n_dim = static_cast<int>(nn.size());
+        std::vector<hsize_t> dims(n_dim);
+        std::reverse_copy(nn.begin(),nn.end(),dims.begin());
+        H5::DataSpace dspace(n_dim,dims.data());
+        H5::DataSet dset;
+        try {
+            dset = group.createDataSet(urn,::HDF5Types<T>::Type(),dspace,CreationProperties(nn,sizeof(T)));
+        } catch (const H5::Exception&) {
+            dset = group.openDataSet(urn);
+            H5::DataSpace fspace = dset.getSpace();
+            std::vector<hsize_t> fdims(static_cast<size_t>(fspace.getSimpleExtentNdims()));
+            fspace.getSimpleExtentDims(fdims.data());
+            if (fdims!=dims) {
+                throw H5::DataSpaceIException("OpenOrCreateDataset","'"+urn+"' exists with a different size");
+            }
+            if (!(dset.getDataType()==::HDF5Types<T>::Type())) {
+                throw H5::DataTypeIException("OpenOrCreateDataset","'"+urn+"' exists with a different type");
+            }
+        }
+        return dset;
+    }
+
+    /**
+     * Select a hyperslab of a dataset.
+     * 
+     * @param[out] fspace dataspace of the dataset with the hyperslab selected.
+     * @param[out] mspace dataspace of the buffer.
+     * @param[in] dset hdf5 dataset.
+     * @param[in] offset first voxel of the hyperslab in each direction.
+     * @param[in] count number of voxels of the hyperslab in each direction.
+     */
+    void SelectSlab(H5::DataSpace *fspace, H5::DataSpace *mspace,
+        const H5::DataSet &dset, const std::vector<Index> &offset,
+        const std::vector<Index> &count) {
+        *fspace = dset.getSpace();
+        int n_dim = fspace->getSimpleExtentNdims();
+        if (static_cast<int>(offset.size())!=n_dim || static_cast<int>(count.size())!=n_dim) {
+            throw H5::DataSpaceIException("SelectSlab","Wrong hyperslab rank");
+        }
+        std::vector<hsize_t> start(n_dim);
+        std::vector<hsize_t> block(n_dim);
+        std::reverse_copy(offset.begin(),offset.end(),start.begin());
+        std::reverse_copy(count.begin(),count.end(),block.begin());
+        // an empty hyperslab selects nothing in a buffer of one voxel
+        if (std::find(block.begin(),block.end(),0)!=block.end()) {
+            fspace->selectNone();
+            std::fill(block.begin(),block.end(),1);
+            *mspace = H5::DataSpace(n_dim,block.data());
+            mspace->selectNone();
+            return;
+        }
+        fspace->selectHyperslab(H5S_SELECT_SET,block.data(),start.data());
+        *mspace = H5::DataSpace(n_dim,block.data());
+        return;
+    }
+
+    /**
+     * Map a dataset into an image, if it is contiguous and stored with the
+     * native type in a file opened in input mode.
+     * 
+     * @param img pointer to the destination image.
+     * @param file hdf5 file.
+     * @param dset hdf5 dataset.
+     * @param nn number of voxels in each direction of the dataset.
+     * 
+     * @return true if the dataset is mapped, false if it must be read.
+     */
+    template <typename T>
+    bool Map(Image<T> *img, const H5::H5File &file, const H5::DataSet &dset,
+        const std::vector<Index> &nn) {
+        unsigned intent = H5F_ACC_RDWR;
+        if (!input_mapping || H5Fget_intent(file.getId(),&intent)<0 || (intent&H5F_ACC_RDWR)!=0) {
+            return false;
+        }
+        if (dset.getCreatePlist().getLayout()!=H5D_CONTIGUOUS || !(dset.getDataType()==::HDF5Types<T>::Type())) {
+            return false;
+        }
+        size_t n_vox = 1;
+        for (Index n : nn) {
+            n_vox *= static_cast<size_t>(n);
+        }
+        haddr_t offset = H5Dget_offset(dset.getId());
+        if (offset==HADDR_UNDEF || n_vox==0 || dset.getStorageSize()!=n_vox*sizeof(T)) {
+            return false;
+        }
+        Buffer<T> data(file.getFileName(),static_cast<size_t>(offset),n_vox);
+        if (data.size()!=n_vox) {
+            return false;
+        }
+        *img = Image<T>();
+        img->GetSize() = nn;
+        img->GetData() = std::move(data);
+        return true;
+    }
+    /**
+     * Read a dataset into an image.
+     * 
+     * @param img pointer to the destination image.
+     * @param file hdf5 file.
+     * @param uri uri of the dataset.
+     */
+    template <typename T>
+    void Read(Image<T> *img, const H5::H5File &file, const std::string &uri) {
+        // locate the dataset
+        H5::DataSet dset = file.openDataSet(uri);
+        H5::DataSpace dspace = dset.getSpace();
+        // read the data
+        std::vector<hsize_t> dims(dspace.getSimpleExtentNdims());
+        dspace.getSimpleExtentDims(dims.data(),NULL);
+        std::vector<Index> nn(dims.size());
+        std::reverse_copy(dims.begin(),dims.end(),nn.begin());
+        if (Map(img,file,dset,nn)) {
+            return;
+        }
+        if (img->GetSize()!=nn || img->GetData().GetStorage()==Storage::FileMapped) {
+            *img = Image<T>(nn);
+        }
+        dset.read(img->GetData().data(),::HDF5Types<T>::Type());
+        return;
+    }
+    /**
+     * Read a complex-valued image stored as a group of two datasets with the
+     * real and the imaginary parts.
+     * 
+     * Only complex-valued images can be stored in this layout.
+     * 
+     * @param img pointer to the destination image.
+     * @param file hdf5 file.
+     * @param uri uri of the group.
+     */
+    template <typename T>
+    void ReadSplit(Image<T>*, const H5::H5File&, const std::string &uri) {
+        throw H5::DataSetIException("ReadDataset","'"+uri+"' is not a dataset");
+    }
+    template <typename T>
+    void ReadSplit(Image<std::complex<T> > *img, const H5::H5File &file, const std::string &uri) {
+        Image<T> real;
+        Image<T> imag;
+        Read(&real,file,uri+"/real");
+        Read(&imag,file,uri+"/imag");
+        if (real.GetSize()!=imag.GetSize()) {
+            throw H5::DataSpaceIException("ReadDataset","'"+uri+"' parts of different size");
+        }
+        *img = Image<std::complex<T> >(real.GetSize());
+        #pragma omp parallel for schedule(static)
+        for (Index idx = 0; idx<img->GetNVox(); ++idx) {
+            (*img)[idx] = std::complex<T>(real[idx],imag[idx]);
+        }
+        return;
+    }
 
 }  //
 
+// Lock of the HDF5 library
+std::recursive_mutex& io::
+HDF5Mutex() {
+    // never destroyed, since it is still used by the handler at exit
+    static std::recursive_mutex *mutex = new std::recursive_mutex();
+    return *mutex;
+}
+
+// Chunk shape of the new datasets
+void io::
+SetChunkShape(const std::vector<Index> &chunk) {
+    chunk_shape = chunk;
+    return;
+}
+// Compression of the new datasets
+void io::
+SetCompressionLevel(const int level) {
+    compression_level = level;
+    return;
+}
+
+// Mapping of the input datasets
+void io::
+SetInputMapping(const bool enable) {
+    input_mapping = enable;
+    return;
+}
+
+// Get the mapping of the input datasets
+bool io::
+GetInputMapping() {
+    return input_mapping;
+}
+
+// Collective writes of the ranks
+void io::
+SetParallelWrites(const bool enable) {
+    #ifdef H5_HAVE_PARALLEL
+    parallel_writes = enable;
+    #else
+    (void)enable;
+    #endif
+    return;
+}
+
+// Get the collective writes of the ranks
+bool io::
+GetParallelWrites() {
+    return parallel_writes;
+}
+
+// Alignment of the written objects
+void io::
+SetAlignment(const Index bytes) {
+    alignment = bytes;
+    return;
+}
+
+// Flush the cached files
+void io::
+FlushFiles() {
+    std::lock_guard<std::recursive_mutex> lock(HDF5Mutex());
+    for (auto &entry : FileCache()) {
+        try {
+            if (entry.second.mode!=Mode::In) {
+                entry.second.file.flush(H5F_SCOPE_GLOBAL);
+            }
+        } catch (const H5::Exception&) {
+        }
+    }
+    return;
+}
+// Close the cached files
+void io::
+CloseFiles() {
+    std::lock_guard<std::recursive_mutex> lock(HDF5Mutex());
+    for (auto &entry : FileCache()) {
+        try {
+            if (entry.second.mode!=Mode::In) {
+                entry.second.file.flush(H5F_SCOPE_GLOBAL);
+            }
+            entry.second.file.close();
+        } catch (const H5::Exception&) {
+        }
+    }
+    FileCache().clear();
+    return;
+}
+// Close a cached file
+void io::
+CloseFile(const std::string &fname) {
+    std::lock_guard<std::recursive_mutex> lock(HDF5Mutex());
+    auto it = FileCache().find(fname);
+    if (it==FileCache().end()) {
+        return;
+    }
+    try {
+        if (it->second.mode!=Mode::In) {
+            it->second.file.flush(H5F_SCOPE_GLOBAL);
+        }
+        it->second.file.close();
+    } catch (const H5::Exception&) {
+    }
+    FileCache().erase(it);
+    return;
+}
+
 // IOh5 constructor
 IOh5::
 IOh5(const std::string &fname, const Mode mode) :
-    fname_(fname), mode_(mode) {
+    fname_(fname), mode_(mode), lock_(HDF5Mutex()) {
     H5::Exception::dontPrint();
-    switch (mode_) {
-        case Mode::In:
-            file_ = H5::H5File(fname_, H5F_ACC_RDONLY);
-            break;
-        case Mode::Out:
-            file_ = H5::H5File(fname_, H5F_ACC_TRUNC);
-            break;
-        case Mode::Append:
-            try {
-                file_ = H5::H5File(fname_, H5F_ACC_RDWR);
-            } catch (const H5::FileIException&) {
-                file_ = H5::H5File(fname_, H5F_ACC_TRUNC);
-            }
-            break;
-    }
+    file_ = OpenCached(fname_, mode_);
     return;
 }
 
@@ -158,16 +611,12 @@ State IOh5::
 ReadDataset(Image<T> *img, const std::string &url, const std::string &urn) {
     H5::Exception::dontPrint();
     try {
-        // locate the dataset
-        H5::DataSet dset = file_.openDataSet(URI(url,urn));
-        H5::DataSpace dspace = dset.getSpace();
-        // read the data
-        std::vector<hsize_t> dims(dspace.getSimpleExtentNdims());
-        size_t ndim = dspace.getSimpleExtentDims(dims.data(),NULL);
-        std::vector<int> nn(dims.size());
-        std::reverse_copy(dims.begin(),dims.end(),nn.begin());
-        *img = Image<T>(nn);
-        dset.read(img->GetData().data(),::HDF5Types<T>::Type());
+        std::string uri = URI(url,urn);
+        if (file_.childObjType(uri)==H5O_TYPE_GROUP) {
+            ReadSplit(img,file_,uri);
+        } else {
+            Read(img,file_,uri);
+        }
     } catch (const H5::FileIException&) {
         return State::HDF5FileException;
     } catch (const H5::DataSetIException&) {
@@ -186,27 +635,122 @@ State IOh5::
 WriteDataset(const Image<T> &img, const std::string &url, const std::string &urn) const {
     H5::Exception::dontPrint();
     try {
-        // open or create the group
-        H5::Group group;
-        try {
-            group = file_.openGroup(url);
-        } catch (const H5::Exception&) {
-            group = CreateGroup(file_,url);
-        }
-        // create the dataset
+        H5::DataSet dset = OpenOrCreateDataset<T>(file_,img.GetSize(),url,urn);
+        // write the data in the dataset
         int n_dim = img.GetNDim();
         std::vector<hsize_t> dims(n_dim);
         std::reverse_copy(img.GetSize().begin(),img.GetSize().end(),dims.begin());
-        H5::DataSpace dspace(n_dim,dims.data());
-        H5::DataType dtype(::HDF5Types<T>::Type());
-        H5::DataSet dset;
-        try {
-            dset = group.createDataSet(urn,dtype,dspace);
-        } catch (const H5::Exception&) {
-            dset = group.openDataSet(urn);
+        H5::DataSpace mspace(n_dim,dims.data());
+        dset.write(img.GetData().data(),::HDF5Types<T>::Type(),mspace);
+    } catch (const H5::FileIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::GroupIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::DataSetIException&) {
+        return State::HDF5DatasetException;
+    } catch (const H5::DataSpaceIException&) {
+        return State::HDF5DataspaceException;
+    } catch (const H5::DataTypeIException&) {
+        return State::HDF5DatatypeException;
+    }
+    return State::Success;
+}
+
+// IOh5 get dataset size
+State IOh5::
+GetDatasetSize(std::vector<Index> *nn, const std::string &url, const std::string &urn) {
+    H5::Exception::dontPrint();
+    try {
+        H5::DataSet dset = file_.openDataSet(URI(url,urn));
+        H5::DataSpace dspace = dset.getSpace();
+        std::vector<hsize_t> dims(dspace.getSimpleExtentNdims());
+        dspace.getSimpleExtentDims(dims.data(),NULL);
+        nn->resize(dims.size());
+        std::reverse_copy(dims.begin(),dims.end(),nn->begin());
+    } catch (const H5::FileIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::GroupIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::DataSetIException&) {
+        return State::HDF5DatasetException;
+    } catch (const H5::DataSpaceIException&) {
+        return State::HDF5DataspaceException;
+    } catch (const H5::DataTypeIException&) {
+        return State::HDF5DatatypeException;
+    }
+    return State::Success;
+}
+
+// IOh5 read slab
+template <typename T>
+State IOh5::
+ReadSlab(T *buffer, const std::vector<Index> &offset,
+    const std::vector<Index> &count, const std::string &url,
+    const std::string &urn) {
+    H5::Exception::dontPrint();
+    try {
+        H5::DataSet dset = file_.openDataSet(URI(url,urn));
+        H5::DataSpace fspace;
+        H5::DataSpace mspace;
+        SelectSlab(&fspace,&mspace,dset,offset,count);
+        dset.read(buffer,::HDF5Types<T>::Type(),mspace,fspace);
+    } catch (const H5::FileIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::GroupIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::DataSetIException&) {
+        return State::HDF5DatasetException;
+    } catch (const H5::DataSpaceIException&) {
+        return State::HDF5DataspaceException;
+    } catch (const H5::DataTypeIException&) {
+        return State::HDF5DatatypeException;
+    }
+    return State::Success;
+}
+
+// IOh5 create dataset
+template <typename T>
+State IOh5::
+CreateDataset(const std::vector<Index> &nn, const std::string &url,
+    const std::string &urn) const {
+    H5::Exception::dontPrint();
+    try {
+        OpenOrCreateDataset<T>(file_,nn,url,urn);
+    } catch (const H5::FileIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::GroupIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::DataSetIException&) {
+        return State::HDF5DatasetException;
+    } catch (const H5::DataSpaceIException&) {
+        return State::HDF5DataspaceException;
+    } catch (const H5::DataTypeIException&) {
+        return State::HDF5DatatypeException;
+    }
+    return State::Success;
+}
+
+// IOh5 write slab
+template <typename T>
+State IOh5::
+WriteSlab(const T *buffer, const std::vector<Index> &offset,
+    const std::vector<Index> &count, const std::string &url,
+    const std::string &urn) const {
+    H5::Exception::dontPrint();
+    try {
+        H5::DataSet dset = file_.openDataSet(URI(url,urn));
+        H5::DataSpace fspace;
+        H5::DataSpace mspace;
+        SelectSlab(&fspace,&mspace,dset,offset,count);
+        // an empty slab has no buffer, but HDF5 wants one all the same
+        T empty = T();
+        H5::DSetMemXferPropList xfer;
+        #ifdef H5_HAVE_PARALLEL
+        if (parallel_writes) {
+            H5Pset_dxpl_mpio(xfer.getId(),H5FD_MPIO_COLLECTIVE);
         }
-        // write the data in the dataset
-        dset.write(img.GetData().data(),dtype,dspace);
+        #endif
+        dset.write(buffer!=nullptr ? buffer : &empty,::HDF5Types<T>::Type(),mspace,fspace,xfer);
     } catch (const H5::FileIException&) {
         return State::HDF5FileException;
     } catch (const H5::GroupIException&) {
@@ -221,6 +765,94 @@ WriteDataset(const Image<T> &img, const std::string &url, const std::string &urn
     return State::Success;
 }
 
+// IOh5 list datasets
+State IOh5::
+ListDatasets(std::vector<std::string> *uris) const {
+    uris->clear();
+    if (H5Lvisit(file_.getId(),H5_INDEX_NAME,H5_ITER_INC,CollectDataset,uris)<0) {
+        return State::HDF5FileException;
+    }
+    return State::Success;
+}
+
+// IOh5 copy dataset
+State IOh5::
+CopyDataset(const IOh5 &source, const std::string &uri) const {
+    hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+    H5Pset_create_intermediate_group(lcpl,1);
+    herr_t status = H5Ocopy(source.file_.getId(),uri.c_str(),file_.getId(),uri.c_str(),H5P_DEFAULT,lcpl);
+    H5Pclose(lcpl);
+    if (status<0) {
+        return State::HDF5DatasetException;
+    }
+    return State::Success;
+}
+
+// IOh5 get dataset offset
+State IOh5::
+GetDatasetOffset(Index *offset, const std::string &url, const std::string &urn) {
+    H5::Exception::dontPrint();
+    try {
+        H5::DataSet dset = file_.openDataSet(URI(url,urn));
+        haddr_t addr = H5Dget_offset(dset.getId());
+        *offset = addr==HADDR_UNDEF ? -1 : static_cast<Index>(addr);
+    } catch (const H5::FileIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::GroupIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::DataSetIException&) {
+        return State::HDF5DatasetException;
+    }
+    return State::Success;
+}
+
+// IOh5 read attribute
+State IOh5::
+ReadAttribute(std::string *value, const std::string &name) {
+    H5::Exception::dontPrint();
+    try {
+        H5::Group root = file_.openGroup("/");
+        if (!root.attrExists(name)) {
+            return State::HDF5AttributeException;
+        }
+        H5::Attribute attr = root.openAttribute(name);
+        attr.read(attr.getStrType(),*value);
+    } catch (const H5::FileIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::GroupIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::AttributeIException&) {
+        return State::HDF5AttributeException;
+    } catch (const H5::DataTypeIException&) {
+        return State::HDF5DatatypeException;
+    }
+    return State::Success;
+}
+
+// IOh5 write attribute
+State IOh5::
+WriteAttribute(const std::string &value, const std::string &name) const {
+    H5::Exception::dontPrint();
+    try {
+        H5::Group root = file_.openGroup("/");
+        if (root.attrExists(name)) {
+            root.removeAttr(name);
+        }
+        H5::StrType type(H5::PredType::C_S1,H5T_VARIABLE);
+        H5::Attribute attr = root.createAttribute(name,type,H5::DataSpace(H5S_SCALAR));
+        attr.write(type,value);
+    } catch (const H5::FileIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::GroupIException&) {
+        return State::HDF5FileException;
+    } catch (const H5::AttributeIException&) {
+        return State::HDF5AttributeException;
+    } catch (const H5::DataTypeIException&) {
+        return State::HDF5DatatypeException;
+    }
+    return State::Success;
+}
+
 // Template specialisations
 // ReadDataset
 template State IOh5::ReadDataset<size_t>(Image<size_t> *img, const std::string &url, const std::string &urn);
@@ -228,9 +860,37 @@ template State IOh5::ReadDataset<float>(Image<float> *img, const std::string &ur
 template State IOh5::ReadDataset<double>(Image<double> *img, const std::string &url, const std::string &urn);
 template State IOh5::ReadDataset<int>(Image<int> *img, const std::string &url, const std::string &urn);
 template State IOh5::ReadDataset<long>(Image<long> *img, const std::string &url, const std::string &urn);
+template State IOh5::ReadDataset<std::complex<float> >(Image<std::complex<float> > *img, const std::string &url, const std::string &urn);
+template State IOh5::ReadDataset<std::complex<double> >(Image<std::complex<double> > *img, const std::string &url, const std::string &urn);
 // WriteDataset
 template State IOh5::WriteDataset<size_t>(const Image<size_t> &img, const std::string &url, const std::string &urn) const;
 template State IOh5::WriteDataset<float>(const Image<float> &img, const std::string &url, const std::string &urn) const;
 template State IOh5::WriteDataset<double>(const Image<double> &img, const std::string &url, const std::string &urn) const;
 template State IOh5::WriteDataset<int>(const Image<int> &img, const std::string &url, const std::string &urn) const;
 template State IOh5::WriteDataset<long>(const Image<long> &img, const std::string &url, const std::string &urn) const;
+template State IOh5::WriteDataset<std::complex<float> >(const Image<std::complex<float> > &img, const std::string &url, const std::string &urn) const;
+template State IOh5::WriteDataset<std::complex<double> >(const Image<std::complex<double> > &img, const std::string &url, const std::string &urn) const;
+// ReadSlab
+template State IOh5::ReadSlab<size_t>(size_t *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn);
+template State IOh5::ReadSlab<float>(float *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn);
+template State IOh5::ReadSlab<double>(double *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn);
+template State IOh5::ReadSlab<int>(int *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn);
+template State IOh5::ReadSlab<long>(long *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn);
+template State IOh5::ReadSlab<std::complex<float> >(std::complex<float> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn);
+template State IOh5::ReadSlab<std::complex<double> >(std::complex<double> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn);
+// CreateDataset
+template State IOh5::CreateDataset<size_t>(const std::vector<Index> &nn, const std::string &url, const std::string &urn) const;
+template State IOh5::CreateDataset<float>(const std::vector<Index> &nn, const std::string &url, const std::string &urn) const;
+template State IOh5::CreateDataset<double>(const std::vector<Index> &nn, const std::string &url, const std::string &urn) const;
+template State IOh5::CreateDataset<int>(const std::vector<Index> &nn, const std::string &url, const std::string &urn) const;
+template State IOh5::CreateDataset<long>(const std::vector<Index> &nn, const std::string &url, const std::string &urn) const;
+template State IOh5::CreateDataset<std::complex<float> >(const std::vector<Index> &nn, const std::string &url, const std::string &urn) const;
+template State IOh5::CreateDataset<std::complex<double> >(const std::vector<Index> &nn, const std::string &url, const std::string &urn) const;
+// WriteSlab
+template State IOh5::WriteSlab<size_t>(const size_t *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn) const;
+template State IOh5::WriteSlab<float>(const float *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn) const;
+template State IOh5::WriteSlab<double>(const double *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn) const;
+template State IOh5::WriteSlab<int>(const int *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn) const;
+template State IOh5::WriteSlab<long>(const long *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn) const;
+template State IOh5::WriteSlab<std::complex<float> >(const std::complex<float> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn) const;
+template State IOh5::WriteSlab<std::complex<double> >(const std::complex<double> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count, const std::string &url, const std::string &urn) const;
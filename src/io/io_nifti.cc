@@ -0,0 +1,572 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/io/io_nifti.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include "b1map/io/io_hdf5.h"
+#include "b1map/io/io_raw.h"
+
+using namespace b1map;
+using namespace b1map::io;
+
+namespace {
+
+    /// Size of the NIfTI-1 header.
+    const std::int32_t NIFTI_HEADER_SIZE = 348;
+    /// Offset of the data in the written files (header and no extensions).
+    const Index NIFTI_VOX_OFFSET = 352;
+    /// Voxel size of the written files (empty if unknown).
+    std::vector<double> voxel_size;
+
+    /**
+     * NIfTI-1 data type codes.
+     */
+    enum DataTypeCode : std::int16_t {
+        DT_UINT8 = 2,
+        DT_INT16 = 4,
+        DT_INT32 = 8,
+        DT_FLOAT32 = 16,
+        DT_COMPLEX64 = 32,
+        DT_FLOAT64 = 64,
+        DT_INT8 = 256,
+        DT_UINT16 = 512,
+        DT_UINT32 = 768,
+        DT_INT64 = 1024,
+        DT_UINT64 = 1280,
+        DT_COMPLEX128 = 1792,
+    };
+
+    /**
+     * NIfTI-1 data type code of a scalar typename.
+     * 
+     * @tparam T scalar typename.
+     */
+    template <typename T>
+    struct DataType {
+        static std::int16_t Code() {
+            if (std::is_floating_point<T>::value) {
+                return sizeof(T)==4 ? DT_FLOAT32 : DT_FLOAT64;
+            }
+            switch (sizeof(T)) {
+                case 1:
+                    return std::is_signed<T>::value ? DT_INT8 : DT_UINT8;
+                case 2:
+                    return std::is_signed<T>::value ? DT_INT16 : DT_UINT16;
+                case 4:
+                    return std::is_signed<T>::value ? DT_INT32 : DT_UINT32;
+                default:
+                    return std::is_signed<T>::value ? DT_INT64 : DT_UINT64;
+            }
+        }
+        static const bool complex = false;
+    };
+    template <typename T>
+    struct DataType<std::complex<T> > {
+        static std::int16_t Code() {
+            return sizeof(T)==4 ? DT_COMPLEX64 : DT_COMPLEX128;
+        }
+        static const bool complex = true;
+    };
+
+    /**
+     * Relevant fields of a NIfTI-1 header.
+     */
+    struct Header {
+        /// Number of voxels in each direction.
+        std::vector<Index> nn;
+        /// Data type code.
+        std::int16_t datatype;
+        /// Offset of the data in bytes.
+        Index vox_offset;
+        /// Flag for the data stored with the opposite byte order.
+        bool swap;
+        /// Flag for the scaled data.
+        bool scaled;
+        /// Scaling slope.
+        double slope;
+        /// Scaling intercept.
+        double inter;
+    };
+
+    /**
+     * Reverse the bytes of each component of a value.
+     * 
+     * @tparam S typename of the value.
+     * 
+     * @param value pointer to the value.
+     */
+    template <typename S>
+    inline void SwapBytes(S *value) {
+        unsigned char *bytes = reinterpret_cast<unsigned char*>(value);
+        std::reverse(bytes,bytes+sizeof(S));
+        return;
+    }
+    template <typename S>
+    inline void SwapBytes(std::complex<S> *value) {
+        unsigned char *bytes = reinterpret_cast<unsigned char*>(value);
+        std::reverse(bytes,bytes+sizeof(S));
+        std::reverse(bytes+sizeof(S),bytes+2*sizeof(S));
+        return;
+    }
+
+    /**
+     * Load a value from the raw data.
+     * 
+     * @tparam S typename of the value.
+     * 
+     * @param raw pointer to the raw data.
+     * @param swap flag for the opposite byte order.
+     * 
+     * @return the value.
+     */
+    template <typename S>
+    inline S Load(const char *raw, const bool swap) {
+        S value;
+        std::memcpy(&value,raw,sizeof(S));
+        if (swap) {
+            SwapBytes(&value);
+        }
+        return value;
+    }
+    /**
+     * Store a value into the raw data.
+     * 
+     * @tparam S typename of the value.
+     * 
+     * @param raw pointer to the raw data.
+     * @param value value to be stored.
+     */
+    template <typename S>
+    inline void Store(char *raw, const S value) {
+        std::memcpy(raw,&value,sizeof(S));
+        return;
+    }
+
+    /**
+     * Assign a stored value to a voxel, applying the scaling to the
+     * real-valued data.
+     * 
+     * @param dst pointer to the voxel.
+     * @param value stored value.
+     * @param header header of the file.
+     */
+    template <typename T, typename S>
+    inline void Assign(T *dst, const S value, const Header &header) {
+        if (header.scaled) {
+            double scaled = header.slope*static_cast<double>(value)+header.inter;
+            *dst = std::is_integral<T>::value ? static_cast<T>(std::llround(scaled)) : static_cast<T>(scaled);
+        } else {
+            *dst = static_cast<T>(value);
+        }
+        return;
+    }
+    template <typename T, typename S>
+    inline void Assign(std::complex<T> *dst, const S value, const Header &header) {
+        T re;
+        Assign(&re,value,header);
+        *dst = std::complex<T>(re,T(0));
+        return;
+    }
+    template <typename T, typename S>
+    inline void Assign(std::complex<T> *dst, const std::complex<S> value, const Header&) {
+        *dst = std::complex<T>(static_cast<T>(value.real()),static_cast<T>(value.imag()));
+        return;
+    }
+    template <typename T, typename S>
+    inline void Assign(T*, const std::complex<S>, const Header&) {
+        // complex-valued data are never converted to real values
+        return;
+    }
+
+    /**
+     * Convert a row of stored values of a given type.
+     * 
+     * @tparam S typename of the stored values.
+     * @tparam T typename of the destination.
+     * 
+     * @param dst pointer to the destination.
+     * @param raw pointer to the raw data.
+     * @param n number of values.
+     * @param header header of the file.
+     */
+    template <typename S, typename T>
+    void ConvertRowFrom(T *dst, const char *raw, const Index n, const Header &header) {
+        for (Index i = 0; i<n; ++i) {
+            Assign(dst+i,Load<S>(raw+i*sizeof(S),header.swap),header);
+        }
+        return;
+    }
+    /**
+     * Convert a row of stored values of the type of the file.
+     * 
+     * @tparam T typename of the destination.
+     * 
+     * @param dst pointer to the destination.
+     * @param raw pointer to the raw data.
+     * @param n number of values.
+     * @param header header of the file.
+     */
+    template <typename T>
+    void ConvertRow(T *dst, const char *raw, const Index n, const Header &header) {
+        switch (header.datatype) {
+            case DT_UINT8:
+                ConvertRowFrom<std::uint8_t>(dst,raw,n,header);
+                break;
+            case DT_INT16:
+                ConvertRowFrom<std::int16_t>(dst,raw,n,header);
+                break;
+            case DT_INT32:
+                ConvertRowFrom<std::int32_t>(dst,raw,n,header);
+                break;
+            case DT_FLOAT32:
+                ConvertRowFrom<float>(dst,raw,n,header);
+                break;
+            case DT_COMPLEX64:
+                ConvertRowFrom<std::complex<float> >(dst,raw,n,header);
+                break;
+            case DT_FLOAT64:
+                ConvertRowFrom<double>(dst,raw,n,header);
+                break;
+            case DT_INT8:
+                ConvertRowFrom<std::int8_t>(dst,raw,n,header);
+                break;
+            case DT_UINT16:
+                ConvertRowFrom<std::uint16_t>(dst,raw,n,header);
+                break;
+            case DT_UINT32:
+                ConvertRowFrom<std::uint32_t>(dst,raw,n,header);
+                break;
+            case DT_INT64:
+                ConvertRowFrom<std::int64_t>(dst,raw,n,header);
+                break;
+            case DT_UINT64:
+                ConvertRowFrom<std::uint64_t>(dst,raw,n,header);
+                break;
+            case DT_COMPLEX128:
+                ConvertRowFrom<std::complex<double> >(dst,raw,n,header);
+                break;
+        }
+        return;
+    }
+
+    /**
+     * Provide the size of a stored value.
+     * 
+     * @param datatype data type code.
+     * 
+     * @return the size in bytes, or 0 if the data type is not supported.
+     */
+    size_t ElementSize(const std::int16_t datatype) {
+        switch (datatype) {
+            case DT_UINT8:
+            case DT_INT8:
+                return 1;
+            case DT_INT16:
+            case DT_UINT16:
+                return 2;
+            case DT_INT32:
+            case DT_UINT32:
+            case DT_FLOAT32:
+                return 4;
+            case DT_INT64:
+            case DT_UINT64:
+            case DT_FLOAT64:
+            case DT_COMPLEX64:
+                return 8;
+            case DT_COMPLEX128:
+                return 16;
+        }
+        return 0;
+    }
+
+    /**
+     * Read the header of a NIfTI-1 file.
+     * 
+     * @param header pointer to the destination header.
+     * @param fname address of the file.
+     * 
+     * @return the IO state.
+     */
+    State ReadHeader(Header *header, const std::string &fname) {
+        // compressed files cannot be mapped nor read in place
+        if (fname.size()>=3 && fname.compare(fname.size()-3,3,".gz")==0) {
+            return State::NIfTIFormatException;
+        }
+        std::ifstream file(fname,std::ios::binary);
+        if (!file.is_open()) {
+            return State::NIfTIFileException;
+        }
+        char raw[NIFTI_HEADER_SIZE];
+        if (!file.read(raw,NIFTI_HEADER_SIZE)) {
+            return State::NIfTIFormatException;
+        }
+        // the byte order is deduced from the size of the header
+        header->swap = Load<std::int32_t>(raw,false)!=NIFTI_HEADER_SIZE;
+        if (Load<std::int32_t>(raw,header->swap)!=NIFTI_HEADER_SIZE || std::memcmp(raw+344,"n+1\0",4)!=0) {
+            return State::NIfTIFormatException;
+        }
+        std::int16_t n_dim = Load<std::int16_t>(raw+40,header->swap);
+        if (n_dim<1 || n_dim>7) {
+            return State::NIfTIFormatException;
+        }
+        header->nn.resize(static_cast<size_t>(n_dim));
+        for (int d = 0; d<n_dim; ++d) {
+            header->nn[d] = Load<std::int16_t>(raw+42+2*d,header->swap);
+            if (header->nn[d]<1) {
+                return State::NIfTIFormatException;
+            }
+        }
+        while (header->nn.size()>3 && header->nn.back()==1) {
+            header->nn.pop_back();
+        }
+        header->nn.resize(std::max<size_t>(header->nn.size(),3),1);
+        header->datatype = Load<std::int16_t>(raw+70,header->swap);
+        header->vox_offset = static_cast<Index>(Load<float>(raw+108,header->swap));
+        if (ElementSize(header->datatype)==0 || header->vox_offset<NIFTI_HEADER_SIZE) {
+            return State::NIfTIFormatException;
+        }
+        // a zero slope means no scaling
+        header->slope = Load<float>(raw+112,header->swap);
+        header->inter = Load<float>(raw+116,header->swap);
+        header->scaled = std::isfinite(header->slope) && std::isfinite(header->inter) && header->slope!=0.0 && (header->slope!=1.0 || header->inter!=0.0);
+        return State::Success;
+    }
+
+    /**
+     * Provide the header of a new NIfTI-1 file, followed by the empty
+     * extension flags.
+     * 
+     * @param datatype data type code.
+     * @param bitpix number of bits per voxel.
+     * @param nn number of voxels in each direction.
+     * 
+     * @return the raw header.
+     */
+    std::string MakeHeader(const std::int16_t datatype, const std::int16_t bitpix, const std::vector<Index> &nn) {
+        std::string raw(static_cast<size_t>(NIFTI_VOX_OFFSET),'\0');
+        Store<std::int32_t>(&raw[0],NIFTI_HEADER_SIZE);
+        Store<std::int16_t>(&raw[40],static_cast<std::int16_t>(nn.size()));
+        for (size_t d = 0; d<nn.size(); ++d) {
+            Store<std::int16_t>(&raw[42+2*d],static_cast<std::int16_t>(nn[d]));
+        }
+        Store<std::int16_t>(&raw[70],datatype);
+        Store<std::int16_t>(&raw[72],bitpix);
+        Store<float>(&raw[76],1.0f);
+        for (size_t d = 0; d<nn.size(); ++d) {
+            Store<float>(&raw[80+4*d],d<voxel_size.size() ? static_cast<float>(voxel_size[d]) : 1.0f);
+        }
+        Store<float>(&raw[108],static_cast<float>(NIFTI_VOX_OFFSET));
+        Store<float>(&raw[112],1.0f);
+        // spatial units in metres
+        raw[123] = voxel_size.empty() ? 0 : 1;
+        std::strcpy(&raw[148],"b1map-sim");
+        std::memcpy(&raw[344],"n+1\0",4);
+        return raw;
+    }
+
+}  //
+
+// Set the voxel size
+void io::
+SetVoxelSize(const std::vector<double> &dd) {
+    voxel_size = dd;
+    return;
+}
+
+// IOnifti constructor
+IOnifti::
+IOnifti(const std::string &fname) :
+    fname_(fname) {
+    return;
+}
+
+// IOnifti read the image
+template <typename T>
+State IOnifti::
+ReadDataset(Image<T> *img) {
+    Header header;
+    State state = ReadHeader(&header,fname_);
+    if (state!=State::Success) {
+        return state;
+    }
+    size_t n_vox = 1;
+    for (Index n : header.nn) {
+        n_vox *= static_cast<size_t>(n);
+    }
+    // the data stored as they are in the memory are mapped
+    if (GetInputMapping() && header.datatype==DataType<T>::Code() && !header.swap && !header.scaled) {
+        Buffer<T> data(fname_,static_cast<size_t>(header.vox_offset),n_vox);
+        if (data.size()==n_vox) {
+            *img = Image<T>();
+            img->GetSize() = header.nn;
+            img->GetData() = std::move(data);
+            return State::Success;
+        }
+    }
+    if (img->GetSize()!=header.nn || img->GetData().GetStorage()==Storage::FileMapped) {
+        *img = Image<T>(header.nn);
+    }
+    return ReadSlab(img->GetData().data(),std::vector<Index>(header.nn.size(),0),header.nn);
+}
+
+// IOnifti size of the image
+State IOnifti::
+GetDatasetSize(std::vector<Index> *nn) {
+    Header header;
+    State state = ReadHeader(&header,fname_);
+    if (state==State::Success) {
+        *nn = header.nn;
+    }
+    return state;
+}
+
+// IOnifti read a hyperslab
+template <typename T>
+State IOnifti::
+ReadSlab(T *buffer, const std::vector<Index> &offset,
+    const std::vector<Index> &count) {
+    Header header;
+    State state = ReadHeader(&header,fname_);
+    if (state!=State::Success) {
+        return state;
+    }
+    bool complex = header.datatype==DT_COMPLEX64 || header.datatype==DT_COMPLEX128;
+    if ((complex && !DataType<T>::complex) || !IsSlabInside(header.nn,offset,count)) {
+        return State::NIfTIFormatException;
+    }
+    bool success = ReadRawSlab(fname_,header.vox_offset,ElementSize(header.datatype),
+        header.nn,offset,count,[&](const Index row, const char *raw) {
+        ConvertRow(buffer+row*count[0],raw,count[0],header);
+    });
+    return success ? State::Success : State::NIfTIFileException;
+}
+
+// IOnifti write an image
+template <typename T>
+State IOnifti::
+WriteDataset(const Image<T> &img) const {
+    State state = CreateDataset<T>(img.GetSize());
+    if (state!=State::Success) {
+        return state;
+    }
+    return WriteSlab(img.GetData().data(),std::vector<Index>(img.GetSize().size(),0),img.GetSize());
+}
+
+// IOnifti create the file
+template <typename T>
+State IOnifti::
+CreateDataset(const std::vector<Index> &nn) const {
+    Index n_vox = 1;
+    for (Index n : nn) {
+        if (n<1 || n>32767) {
+            return State::NIfTIFormatException;
+        }
+        n_vox *= n;
+    }
+    if (nn.empty() || nn.size()>7) {
+        return State::NIfTIFormatException;
+    }
+    std::string header = MakeHeader(DataType<T>::Code(),static_cast<std::int16_t>(8*sizeof(T)),nn);
+    if (!CreateRawFile(fname_,header,NIFTI_VOX_OFFSET+n_vox*static_cast<Index>(sizeof(T)))) {
+        return State::NIfTIFileException;
+    }
+    return State::Success;
+}
+
+// IOnifti write a hyperslab
+template <typename T>
+State IOnifti::
+WriteSlab(const T *buffer, const std::vector<Index> &offset,
+    const std::vector<Index> &count) const {
+    Header header;
+    State state = ReadHeader(&header,fname_);
+    if (state!=State::Success) {
+        return state;
+    }
+    if (header.datatype!=DataType<T>::Code() || header.swap || header.scaled || !IsSlabInside(header.nn,offset,count)) {
+        return State::NIfTIFormatException;
+    }
+    if (!WriteRawSlab(fname_,header.vox_offset,sizeof(T),header.nn,buffer,offset,count)) {
+        return State::NIfTIFileException;
+    }
+    return State::Success;
+}
+
+// Template specialisations
+// ReadDataset
+template State IOnifti::ReadDataset<size_t>(Image<size_t> *img);
+template State IOnifti::ReadDataset<float>(Image<float> *img);
+template State IOnifti::ReadDataset<double>(Image<double> *img);
+template State IOnifti::ReadDataset<int>(Image<int> *img);
+template State IOnifti::ReadDataset<long>(Image<long> *img);
+template State IOnifti::ReadDataset<std::complex<float> >(Image<std::complex<float> > *img);
+template State IOnifti::ReadDataset<std::complex<double> >(Image<std::complex<double> > *img);
+// ReadSlab
+template State IOnifti::ReadSlab<size_t>(size_t *buffer, const std::vector<Index> &offset, const std::vector<Index> &count);
+template State IOnifti::ReadSlab<float>(float *buffer, const std::vector<Index> &offset, const std::vector<Index> &count);
+template State IOnifti::ReadSlab<double>(double *buffer, const std::vector<Index> &offset, const std::vector<Index> &count);
+template State IOnifti::ReadSlab<int>(int *buffer, const std::vector<Index> &offset, const std::vector<Index> &count);
+template State IOnifti::ReadSlab<long>(long *buffer, const std::vector<Index> &offset, const std::vector<Index> &count);
+template State IOnifti::ReadSlab<std::complex<float> >(std::complex<float> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count);
+template State IOnifti::ReadSlab<std::complex<double> >(std::complex<double> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count);
+// WriteDataset
+template State IOnifti::WriteDataset<size_t>(const Image<size_t> &img) const;
+template State IOnifti::WriteDataset<float>(const Image<float> &img) const;
+template State IOnifti::WriteDataset<double>(const Image<double> &img) const;
+template State IOnifti::WriteDataset<int>(const Image<int> &img) const;
+template State IOnifti::WriteDataset<long>(const Image<long> &img) const;
+template State IOnifti::WriteDataset<std::complex<float> >(const Image<std::complex<float> > &img) const;
+template State IOnifti::WriteDataset<std::complex<double> >(const Image<std::complex<double> > &img) const;
+// CreateDataset
+template State IOnifti::CreateDataset<size_t>(const std::vector<Index> &nn) const;
+template State IOnifti::CreateDataset<float>(const std::vector<Index> &nn) const;
+template State IOnifti::CreateDataset<double>(const std::vector<Index> &nn) const;
+template State IOnifti::CreateDataset<int>(const std::vector<Index> &nn) const;
+template State IOnifti::CreateDataset<long>(const std::vector<Index> &nn) const;
+template State IOnifti::CreateDataset<std::complex<float> >(const std::vector<Index> &nn) const;
+template State IOnifti::CreateDataset<std::complex<double> >(const std::vector<Index> &nn) const;
+// WriteSlab
+template State IOnifti::WriteSlab<size_t>(const size_t *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnifti::WriteSlab<float>(const float *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnifti::WriteSlab<double>(const double *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnifti::WriteSlab<int>(const int *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnifti::WriteSlab<long>(const long *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnifti::WriteSlab<std::complex<float> >(const std::complex<float> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnifti::WriteSlab<std::complex<double> >(const std::complex<double> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
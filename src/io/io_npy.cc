@@ -0,0 +1,243 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/io/io_npy.h"
+
+#include <complex>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <type_traits>
+
+#include "b1map/io/io_raw.h"
+
+using namespace b1map;
+using namespace b1map::io;
+
+namespace {
+
+    /// Magic string of the .npy files, followed by the version 1.0.
+    const std::string NPY_MAGIC("\x93NUMPY\x01\x00",8);
+    /// Alignment of the data in the .npy files.
+    const size_t NPY_ALIGNMENT = 64;
+
+    /**
+     * Provide the byte order character of the host.
+     * 
+     * @return `<' for little-endian hosts, `>' for big-endian ones.
+     */
+    inline std::string ByteOrder() {
+        const std::uint16_t one = 1;
+        return *reinterpret_cast<const unsigned char*>(&one) ? "<" : ">";
+    }
+
+    /**
+     * Data type description of a scalar typename, in the numpy notation.
+     * 
+     * @tparam T scalar typename.
+     */
+    template <typename T>
+    struct Descr {
+        static std::string Get() {
+            std::string kind = std::is_floating_point<T>::value ? "f" : (std::is_signed<T>::value ? "i" : "u");
+            return ByteOrder()+kind+std::to_string(sizeof(T));
+        }
+    };
+    template <typename T>
+    struct Descr<std::complex<T> > {
+        static std::string Get() {
+            return ByteOrder()+"c"+std::to_string(sizeof(std::complex<T>));
+        }
+    };
+
+    /**
+     * Provide the header of a .npy file.
+     * 
+     * @param descr data type description.
+     * @param nn number of voxels in each direction (first index the fastest).
+     * 
+     * @return the header, padded to a multiple of NPY_ALIGNMENT.
+     */
+    std::string Header(const std::string &descr, const std::vector<Index> &nn) {
+        std::string dict = "{'descr': '"+descr+"', 'fortran_order': False, 'shape': (";
+        for (auto it = nn.rbegin(); it!=nn.rend(); ++it) {
+            dict += std::to_string(*it)+(nn.size()==1 ? "," : (it+1!=nn.rend() ? ", " : ""));
+        }
+        dict += "), }";
+        size_t total = NPY_MAGIC.size()+2+dict.size()+1;
+        dict.append((total+NPY_ALIGNMENT-1)/NPY_ALIGNMENT*NPY_ALIGNMENT-total,' ');
+        dict += '\n';
+        std::string header = NPY_MAGIC;
+        header += static_cast<char>(dict.size()&0xff);
+        header += static_cast<char>((dict.size()>>8)&0xff);
+        return header+dict;
+    }
+
+    /**
+     * Read the header of a .npy file.
+     * 
+     * @param descr pointer to the data type description.
+     * @param nn pointer to the number of voxels in each direction.
+     * @param data_offset pointer to the offset in bytes of the data.
+     * @param fname address of the file.
+     * 
+     * @return the IO state.
+     */
+    State ReadHeader(std::string *descr, std::vector<Index> *nn, Index *data_offset, const std::string &fname) {
+        std::ifstream file(fname,std::ios::binary);
+        if (!file.is_open()) {
+            return State::NPYFileException;
+        }
+        char preamble[10];
+        if (!file.read(preamble,10) || std::string(preamble,6)!=NPY_MAGIC.substr(0,6) || preamble[6]!=1) {
+            return State::NPYFormatException;
+        }
+        size_t length = static_cast<unsigned char>(preamble[8])+(static_cast<size_t>(static_cast<unsigned char>(preamble[9]))<<8);
+        std::string dict(length,'\0');
+        if (!file.read(&dict[0],static_cast<std::streamsize>(length))) {
+            return State::NPYFormatException;
+        }
+        *data_offset = static_cast<Index>(10+length);
+        // data type
+        size_t pos = dict.find("'descr': '");
+        if (pos==std::string::npos) {
+            return State::NPYFormatException;
+        }
+        pos += 10;
+        *descr = dict.substr(pos,dict.find('\'',pos)-pos);
+        // only the C order is written
+        if (dict.find("'fortran_order': False")==std::string::npos) {
+            return State::NPYFormatException;
+        }
+        // shape
+        pos = dict.find("'shape': (");
+        if (pos==std::string::npos) {
+            return State::NPYFormatException;
+        }
+        const char *cursor = dict.c_str()+pos+10;
+        nn->clear();
+        while (*cursor!=')' && *cursor!='\0') {
+            char *end;
+            long long n = std::strtoll(cursor,&end,10);
+            if (end==cursor) {
+                return State::NPYFormatException;
+            }
+            nn->insert(nn->begin(),static_cast<Index>(n));
+            cursor = end;
+            while (*cursor==',' || *cursor==' ') {
+                ++cursor;
+            }
+        }
+        return State::Success;
+    }
+
+}  //
+
+// IOnpy constructor
+IOnpy::
+IOnpy(const std::string &fname) :
+    fname_(fname) {
+    return;
+}
+
+// IOnpy write an image
+template <typename T>
+State IOnpy::
+WriteDataset(const Image<T> &img) const {
+    State state = CreateDataset<T>(img.GetSize());
+    if (state!=State::Success) {
+        return state;
+    }
+    return WriteSlab(img.GetData().data(),std::vector<Index>(img.GetSize().size(),0),img.GetSize());
+}
+
+// IOnpy create the file
+template <typename T>
+State IOnpy::
+CreateDataset(const std::vector<Index> &nn) const {
+    std::string header = Header(Descr<T>::Get(),nn);
+    Index n_vox = 1;
+    for (auto n : nn) {
+        n_vox *= n;
+    }
+    if (!CreateRawFile(fname_,header,static_cast<Index>(header.size())+n_vox*static_cast<Index>(sizeof(T)))) {
+        return State::NPYFileException;
+    }
+    return State::Success;
+}
+
+// IOnpy write a hyperslab
+template <typename T>
+State IOnpy::
+WriteSlab(const T *buffer, const std::vector<Index> &offset,
+    const std::vector<Index> &count) const {
+    std::string descr;
+    std::vector<Index> nn;
+    Index data_offset;
+    State state = ReadHeader(&descr,&nn,&data_offset,fname_);
+    if (state!=State::Success) {
+        return state;
+    }
+    if (descr!=Descr<T>::Get() || !IsSlabInside(nn,offset,count)) {
+        return State::NPYFormatException;
+    }
+    if (!WriteRawSlab(fname_,data_offset,sizeof(T),nn,buffer,offset,count)) {
+        return State::NPYFileException;
+    }
+    return State::Success;
+}
+
+// Template specialisations
+// WriteDataset
+template State IOnpy::WriteDataset<size_t>(const Image<size_t> &img) const;
+template State IOnpy::WriteDataset<float>(const Image<float> &img) const;
+template State IOnpy::WriteDataset<double>(const Image<double> &img) const;
+template State IOnpy::WriteDataset<int>(const Image<int> &img) const;
+template State IOnpy::WriteDataset<long>(const Image<long> &img) const;
+template State IOnpy::WriteDataset<std::complex<float> >(const Image<std::complex<float> > &img) const;
+template State IOnpy::WriteDataset<std::complex<double> >(const Image<std::complex<double> > &img) const;
+// CreateDataset
+template State IOnpy::CreateDataset<size_t>(const std::vector<Index> &nn) const;
+template State IOnpy::CreateDataset<float>(const std::vector<Index> &nn) const;
+template State IOnpy::CreateDataset<double>(const std::vector<Index> &nn) const;
+template State IOnpy::CreateDataset<int>(const std::vector<Index> &nn) const;
+template State IOnpy::CreateDataset<long>(const std::vector<Index> &nn) const;
+template State IOnpy::CreateDataset<std::complex<float> >(const std::vector<Index> &nn) const;
+template State IOnpy::CreateDataset<std::complex<double> >(const std::vector<Index> &nn) const;
+// WriteSlab
+template State IOnpy::WriteSlab<size_t>(const size_t *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnpy::WriteSlab<float>(const float *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnpy::WriteSlab<double>(const double *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnpy::WriteSlab<int>(const int *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnpy::WriteSlab<long>(const long *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnpy::WriteSlab<std::complex<float> >(const std::complex<float> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
+template State IOnpy::WriteSlab<std::complex<double> >(const std::complex<double> *buffer, const std::vector<Index> &offset, const std::vector<Index> &count) const;
@@ -0,0 +1,217 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/io/io_raw.h"
+
+#include <cstring>
+#include <fstream>
+
+#include "b1map/storage.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define B1MAPSIM_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace b1map;
+using namespace b1map::io;
+
+namespace {
+
+    /**
+     * Raw layout of a hyperslab.
+     */
+    struct SlabLayout {
+        /// Number of rows of the hyperslab.
+        Index n_rows;
+        /// Index of the first element of the hyperslab.
+        Index first;
+        /// Index past the last element of the hyperslab.
+        Index last;
+    };
+
+    /**
+     * Provide the index of the first element of a row of a hyperslab.
+     * 
+     * @param nn number of elements of the array in each direction.
+     * @param offset first element of the hyperslab in each direction.
+     * @param count number of elements of the hyperslab in each direction.
+     * @param row index of the row.
+     * 
+     * @return the index of the element in the array.
+     */
+    inline Index RowStart(const std::vector<Index> &nn, const std::vector<Index> &offset,
+        const std::vector<Index> &count, Index row) {
+        Index idx = offset[0];
+        Index stride = 1;
+        for (size_t d = 1; d<nn.size(); ++d) {
+            stride *= nn[d-1];
+            idx += (offset[d]+row%count[d])*stride;
+            row /= count[d];
+        }
+        return idx;
+    }
+
+    /**
+     * Provide the layout of a hyperslab.
+     * 
+     * @param nn number of elements of the array in each direction.
+     * @param offset first element of the hyperslab in each direction.
+     * @param count number of elements of the hyperslab in each direction.
+     * 
+     * @return the layout, with no rows if the hyperslab is empty.
+     */
+    SlabLayout Layout(const std::vector<Index> &nn, const std::vector<Index> &offset,
+        const std::vector<Index> &count) {
+        SlabLayout layout{1,0,0};
+        for (size_t d = 0; d<count.size(); ++d) {
+            layout.n_rows *= d ? count[d] : (count[d]>0 ? 1 : 0);
+        }
+        if (count.empty() || layout.n_rows==0) {
+            layout.n_rows = 0;
+            return layout;
+        }
+        layout.first = RowStart(nn,offset,count,0);
+        layout.last = RowStart(nn,offset,count,layout.n_rows-1)+count[0];
+        return layout;
+    }
+
+}  //
+
+// Check the hyperslab
+bool io::
+IsSlabInside(const std::vector<Index> &nn, const std::vector<Index> &offset,
+    const std::vector<Index> &count) {
+    if (nn.size()!=offset.size() || nn.size()!=count.size()) {
+        return false;
+    }
+    for (size_t d = 0; d<nn.size(); ++d) {
+        if (offset[d]<0 || count[d]<0 || offset[d]+count[d]>nn[d]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read a hyperslab
+bool io::
+ReadRawSlab(const std::string &fname, const Index data_offset,
+    const size_t elem_size, const std::vector<Index> &nn,
+    const std::vector<Index> &offset, const std::vector<Index> &count,
+    const std::function<void(const Index,const char*)> &read_row) {
+    SlabLayout layout = Layout(nn,offset,count);
+    if (layout.n_rows==0) {
+        return true;
+    }
+    size_t begin = static_cast<size_t>(data_offset)+static_cast<size_t>(layout.first)*elem_size;
+    size_t bytes = static_cast<size_t>(layout.last-layout.first)*elem_size;
+    // the region spanned by the hyperslab is mapped, or read as a fallback
+    std::vector<char> region;
+    char *data = static_cast<char*>(MapFile(fname,begin,bytes));
+    if (data==nullptr) {
+        std::ifstream file(fname,std::ios::binary);
+        region.resize(bytes);
+        if (!file.seekg(static_cast<std::streamoff>(begin)) || !file.read(region.data(),static_cast<std::streamsize>(bytes))) {
+            return false;
+        }
+    }
+    const char *src = data!=nullptr ? data : region.data();
+    for (Index row = 0; row<layout.n_rows; ++row) {
+        read_row(row,src+static_cast<size_t>(RowStart(nn,offset,count,row)-layout.first)*elem_size);
+    }
+    if (data!=nullptr) {
+        Release(data,Storage::FileMapped,bytes);
+    }
+    return true;
+}
+
+// Write a hyperslab
+bool io::
+WriteRawSlab(const std::string &fname, const Index data_offset,
+    const size_t elem_size, const std::vector<Index> &nn, const void *buffer,
+    const std::vector<Index> &offset, const std::vector<Index> &count) {
+    SlabLayout layout = Layout(nn,offset,count);
+    if (layout.n_rows==0) {
+        return true;
+    }
+    const char *src = static_cast<const char*>(buffer);
+    size_t row_bytes = static_cast<size_t>(count[0])*elem_size;
+    #ifdef B1MAPSIM_HAS_MMAP
+    // the region spanned by the hyperslab is mapped and written in place
+    int fd = open(fname.c_str(),O_RDWR);
+    if (fd<0) {
+        return false;
+    }
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = static_cast<size_t>(data_offset)+static_cast<size_t>(layout.first)*elem_size;
+    size_t shift = begin%page;
+    size_t bytes = shift+static_cast<size_t>(layout.last-layout.first)*elem_size;
+    void *ptr = mmap(nullptr,bytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,static_cast<off_t>(begin-shift));
+    close(fd);
+    if (ptr==MAP_FAILED) {
+        return false;
+    }
+    char *dst = static_cast<char*>(ptr)+shift;
+    for (Index row = 0; row<layout.n_rows; ++row) {
+        std::memcpy(dst+static_cast<size_t>(RowStart(nn,offset,count,row)-layout.first)*elem_size,src+row*row_bytes,row_bytes);
+    }
+    return munmap(ptr,bytes)==0;
+    #else
+    std::fstream file(fname,std::ios::binary|std::ios::in|std::ios::out);
+    if (!file.is_open()) {
+        return false;
+    }
+    for (Index row = 0; row<layout.n_rows; ++row) {
+        file.seekp(static_cast<std::streamoff>(data_offset+RowStart(nn,offset,count,row)*static_cast<Index>(elem_size)));
+        file.write(src+row*row_bytes,static_cast<std::streamsize>(row_bytes));
+    }
+    return file.good();
+    #endif
+}
+
+// Create a file
+bool io::
+CreateRawFile(const std::string &fname, const std::string &header, const Index bytes) {
+    std::ofstream file(fname,std::ios::binary|std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.write(header.data(),static_cast<std::streamsize>(header.size()));
+    // the file takes its final size, leaving the data unallocated
+    if (bytes>static_cast<Index>(header.size())) {
+        file.seekp(static_cast<std::streamoff>(bytes-1));
+        file.put('\0');
+    }
+    return file.good();
+}
@@ -64,6 +64,17 @@ IOtoml(const std::string &fname, const Mode mode) :
     return;
 }
 
+IOtoml::
+IOtoml(std::istream &stream) :
+    fname_(""), mode_(Mode::In) {
+    toml::ParseResult parsed(toml::parse(stream));
+    if (!parsed.valid()) {
+        throw std::ios_base::failure(parsed.errorReason);
+    }
+    content_ = parsed.value;
+    return;
+}
+
 // IOtoml destructor
 IOtoml::
 ~IOtoml() {
@@ -71,6 +82,12 @@ IOtoml::
     return;
 }
 
+// IOtoml get content
+const toml::Value& IOtoml::
+GetContent() const {
+    return content_;
+}
+
 // IOtoml GetValue specialisation
 template <>
 IOError IOtoml::
@@ -0,0 +1,204 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/io/io_writer.h"
+
+#include <chrono>
+#include <complex>
+
+#include "b1map/io/io_hdf5.h"
+#include "b1map/io/io_nifti.h"
+#include "b1map/io/io_npy.h"
+
+using namespace b1map;
+using namespace b1map::io;
+
+namespace {
+
+    /**
+     * Wait a little, yielding first and then sleeping.
+     * 
+     * @param spins number of consecutive waits.
+     */
+    inline void Backoff(int *spins) {
+        if (++(*spins)<64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        return;
+    }
+
+    /**
+     * Write an image at the given address, into a .h5, a .npy or a NIfTI-1
+     * file according to its format.
+     * 
+     * @param img source image.
+     * @param address complete address of the destination dataset.
+     * 
+     * @return the IO state.
+     */
+    template <typename T>
+    State Write(const Image<T> &img, const std::string &address) {
+        std::string fname;
+        std::string uri;
+        Format format = GetAddress(address,fname,uri);
+        auto const pos = uri.find_last_of("/");
+        std::string url = uri.substr(0,pos+1);
+        std::string urn = uri.substr(pos+1);
+        if (format==Format::NPY) {
+            return IOnpy(fname).WriteDataset(img);
+        }
+        if (format==Format::NIfTI) {
+            return IOnifti(fname).WriteDataset(img);
+        }
+        try {
+            IOh5 ofile(fname,Mode::Append);
+            return ofile.WriteDataset(img,url,urn);
+        } catch (const H5::Exception&) {
+            return State::HDF5FileException;
+        }
+    }
+
+}  //
+
+// AsyncWriter constructor
+template <typename T>
+AsyncWriter<T>::
+AsyncWriter(const int n_buffers) :
+    buffers_(n_buffers), pending_(n_buffers), free_(n_buffers),
+    done_(false), failed_(false), pushed_(0), processed_(0), state_(State::Success) {
+    for (auto &buffer : buffers_) {
+        free_.Push(&buffer);
+    }
+    thread_ = std::thread(&AsyncWriter<T>::Loop,this);
+    return;
+}
+
+// AsyncWriter destructor
+template <typename T>
+AsyncWriter<T>::
+~AsyncWriter() {
+    Finish();
+    return;
+}
+
+// AsyncWriter acquire a buffer
+template <typename T>
+Image<T>* AsyncWriter<T>::
+Acquire() {
+    Image<T> *img;
+    int spins = 0;
+    while (!free_.Pop(&img)) {
+        Backoff(&spins);
+    }
+    return img;
+}
+
+// AsyncWriter push an image
+template <typename T>
+State AsyncWriter<T>::
+Push(Image<T> *img, const std::string &address) {
+    Job job{img,address};
+    int spins = 0;
+    while (!pending_.Push(job)) {
+        Backoff(&spins);
+    }
+    ++pushed_;
+    return failed_.load(std::memory_order_acquire) ? state_ : State::Success;
+}
+
+// AsyncWriter flush
+template <typename T>
+State AsyncWriter<T>::
+Flush() {
+    int spins = 0;
+    while (thread_.joinable() && processed_.load(std::memory_order_acquire)<pushed_) {
+        Backoff(&spins);
+    }
+    return failed_.load(std::memory_order_acquire) ? state_ : State::Success;
+}
+
+// AsyncWriter finish
+template <typename T>
+State AsyncWriter<T>::
+Finish() {
+    if (thread_.joinable()) {
+        done_.store(true,std::memory_order_release);
+        thread_.join();
+    }
+    return failed_.load(std::memory_order_acquire) ? state_ : State::Success;
+}
+
+// AsyncWriter failed address
+template <typename T>
+const std::string& AsyncWriter<T>::
+GetFailedAddress() const {
+    return failed_address_;
+}
+
+// AsyncWriter writer thread
+template <typename T>
+void AsyncWriter<T>::
+Loop() {
+    Job job;
+    int spins = 0;
+    while (true) {
+        if (!pending_.Pop(&job)) {
+            if (done_.load(std::memory_order_acquire)) {
+                if (!pending_.Pop(&job)) {
+                    break;
+                }
+            } else {
+                Backoff(&spins);
+                continue;
+            }
+        }
+        spins = 0;
+        // after a failure, the buffers are only recycled
+        if (!failed_.load(std::memory_order_relaxed)) {
+            State state = Write(*job.img,job.address);
+            if (state!=State::Success) {
+                state_ = state;
+                failed_address_ = job.address;
+                failed_.store(true,std::memory_order_release);
+            }
+        }
+        free_.Push(job.img);
+        processed_.fetch_add(1,std::memory_order_release);
+    }
+    return;
+}
+
+// Template specialisations
+template class io::AsyncWriter<double>;
+template class io::AsyncWriter<std::complex<double> >;
@@ -30,20 +30,38 @@
 *
 *****************************************************************************/
 
+#include <algorithm>
 #include <chrono>
 #include <exception>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <random>
 #include <regex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include "b1map/io/io_case.h"
 #include "b1map/io/io_hdf5.h"
+#include "b1map/io/io_nifti.h"
+#include "b1map/io/io_npy.h"
 #include "b1map/io/io_toml.h"
+#include "b1map/io/io_writer.h"
 
 #include "b1map/b1mapping.h"
 #include "b1map/body.h"
+#include "b1map/cache.h"
+#include "b1map/pipeline.h"
+#include "b1map/queue.h"
+#include "b1map/runtime.h"
 #include "b1map/sequences.h"
+#include "b1map/statistics.h"
+#include "b1map/storage.h"
 #include "b1map/version.h"
 
 #include "main.h"
@@ -70,9 +88,13 @@
 #define LOADMAP(map,addr) { \
     string MACRO_fname; \
     string MACRO_uri; \
-    io::GetAddress(addr,MACRO_fname,MACRO_uri); \
-    io::IOh5 MACRO_ifile(MACRO_fname,io::Mode::In); \
-    io::State MACRO_iostate = MACRO_ifile.ReadDataset(&map,"/",MACRO_uri); \
+    io::State MACRO_iostate; \
+    if (io::GetAddress(addr,MACRO_fname,MACRO_uri)==io::Format::NIfTI) { \
+        MACRO_iostate = io::IOnifti(MACRO_fname).ReadDataset(&map); \
+    } else { \
+        io::IOh5 MACRO_ifile(MACRO_fname,io::Mode::In); \
+        MACRO_iostate = MACRO_ifile.ReadDataset(&map,"/",MACRO_uri); \
+    } \
     if (MACRO_iostate!=io::State::Success) { \
         string msg = "FATAL ERROR: "+ToString(MACRO_iostate)+" '"+addr+"'"; \
         throw runtime_error(msg); \
@@ -83,12 +105,19 @@
     string MACRO_uri; \
     string MACRO_url; \
     string MACRO_urn; \
-    io::GetAddress(addr,MACRO_fname,MACRO_uri); \
+    io::Format MACRO_format = io::GetAddress(addr,MACRO_fname,MACRO_uri); \
     auto const pos = MACRO_uri.find_last_of("/"); \
     MACRO_url = MACRO_uri.substr(0,pos+1); \
     MACRO_urn = MACRO_uri.substr(pos+1); \
-    io::IOh5 MACRO_ofile(MACRO_fname,io::Mode::Append); \
-    io::State MACRO_iostate = MACRO_ofile.WriteDataset(map,MACRO_url,MACRO_urn); \
+    io::State MACRO_iostate; \
+    if (MACRO_format==io::Format::NPY) { \
+        MACRO_iostate = io::IOnpy(MACRO_fname).WriteDataset(map); \
+    } else if (MACRO_format==io::Format::NIfTI) { \
+        MACRO_iostate = io::IOnifti(MACRO_fname).WriteDataset(map); \
+    } else { \
+        io::IOh5 MACRO_ofile(MACRO_fname,io::Mode::Append); \
+        MACRO_iostate = MACRO_ofile.WriteDataset(map,MACRO_url,MACRO_urn); \
+    } \
     if (MACRO_iostate!=io::State::Success) { \
         string msg = "FATAL ERROR: "+ToString(MACRO_iostate)+" '"+addr+"'"; \
         throw runtime_error(msg); \
@@ -101,22 +130,89 @@ using namespace b1map;
 template <class T> using cfgdata = pair<T,string>;
 template <class T> using cfglist = pair<array<T,NDIM>,string>;
 
-void SaveComplexMap(Image<complex<double> > img,string addr);
+void SaveComplexMap(const Image<complex<double> > &img,string addr,const bool split);
+void LoadComplexMap(Image<complex<double> > *img,string addr,const bool split);
+Image<Index> CheckpointRecord(const int next,const uint64_t seed,const int m_begin,const int m_end,const int slot,const Index slab,const Index slabs_done);
+string ShardAddress(const string &addr,const int shard);
+template <typename T> void LoadSlab(Image<T> *map,const string &addr,const Index z0,const Index nz,const vector<Index> &nn);
+void LoadB1Slab(Image<complex<double> > *b1,const string &sens_addr,const string &phase_addr,const Index z0,const Index nz,const vector<Index> &nn);
+template <typename T> void CreateMap(const vector<Index> &nn,const string &addr);
+template <typename T> void SaveSlab(const Image<T> &img,const string &addr,const Index z0);
+void CreateComplexMap(const vector<Index> &nn,const string &addr,const bool split);
+void SaveComplexSlab(const Image<complex<double> > &img,const string &addr,const Index z0,const bool split);
+void LoadComplexSlab(Image<complex<double> > *img,const string &addr,const Index z0,const Index nz,const vector<Index> &nn,const bool split);
+
+int Run(int argc, char **argv);
 
 int main(int argc, char **argv) {
+    InitRanks(&argc,&argv);
+    // only the first rank reports, the others keep their log for the errors
+    ostringstream rank_log;
+    streambuf *cout_buf = cout.rdbuf();
+    if (GetRank()>0) {
+        cout.rdbuf(rank_log.rdbuf());
+    }
+    int status = Run(argc,argv);
+    cout.rdbuf(cout_buf);
+    if (status!=0 && GetRank()>0) {
+        cerr<<"Rank "<<GetRank()<<":\n"<<rank_log.str()<<endl;
+    }
+    FinalizeRanks(status);
+    return status;
+}
+
+int Run(int argc, char **argv) {
     auto start = chrono::system_clock::now();
     // opening boilerplate
     cout<<project::str()<<" ("<<build::str()<<") ["<<compiler::str()<<"]\n"<<endl;
     cout<<LicenseBoilerplate()<<endl;
     // check the number of input
     if (argc<2) {
-        cout<<"Usage example: "<<std::string(project::name)<<" <config file>"<<endl;
+        cout<<"Usage example: "<<std::string(project::name)<<" <config file | case file> [--shard i/N] [--resume]"<<endl;
         return -1;
     }
-    // load the config file
+    // shard of the Monte Carlo samples, and resumption of a previous run
+    int shard = 0;
+    int n_shards = 1;
+    bool resume = false;
+    for (int arg = 2; arg<argc; ++arg) {
+        if (string(argv[arg])=="--resume") {
+            resume = true;
+            continue;
+        }
+        smatch match;
+        string value = arg+1<argc ? string(argv[arg+1]) : "";
+        if (string(argv[arg])!="--shard" || !regex_match(value,match,regex("([0-9]+)/([0-9]+)"))) {
+            cout<<"FATAL ERROR in command line: Wrong argument '"<<argv[arg]<<"'"<<endl;
+            return 1;
+        }
+        try {
+            shard = stoi(match[1]);
+            n_shards = stoi(match[2]);
+        } catch (const out_of_range&) {
+            n_shards = 0;
+        }
+        if (n_shards<1 || shard>=n_shards) {
+            cout<<"FATAL ERROR in command line: Out of range '--shard "<<value<<"'"<<endl;
+            return 1;
+        }
+        ++arg;
+    }
+    // load the config file (or the configuration packed in a case file)
     unique_ptr<io::IOtoml> io_toml;
     try {
-        io_toml.reset(new io::IOtoml(string(argv[1]),io::Mode::In));
+        if (io::IsCaseFile(argv[1])) {
+            string content;
+            io::State iostate = io::ReadCase(&content,argv[1]);
+            if (iostate!=io::State::Success) {
+                cout<<"FATAL ERROR in case file: "<<ToString(iostate)<<" '"<<argv[1]<<"'"<<endl;
+                return 1;
+            }
+            istringstream stream(content);
+            io_toml.reset(new io::IOtoml(stream));
+        } else {
+            io_toml.reset(new io::IOtoml(string(argv[1]),io::Mode::In));
+        }
     } catch(const ios_base::failure &e) {
         cout<<"FATAL ERROR in config file: "<<e.what()<<endl;
         return 1;
@@ -129,14 +225,29 @@ int main(int argc, char **argv) {
     cfglist<double> dd; dd.second = "mesh.step";
     cfgdata<string> body_addr; body_addr.second = "input.body";
     cfgdata<string> txsens_addr; txsens_addr.second = "input.tx-sensitivity";
-    cfgdata<string> txphase_addr; txphase_addr.second = "input.tx-phase";
     cfgdata<string> est_addr("","output.alpha-estimate");
     //   optional input
+    cfgdata<string> txphase_addr("","input.tx-phase");
     cfgdata<string> rxsens_addr("","input.rx-sensitivity");
     cfgdata<string> rxphase_addr("","input.rx-phase");
     cfgdata<string> imgs_addr("","output.intermediate-images");
+    cfglist<int> chunk({0,0,0},"output.chunk");
+    cfgdata<int> compression(0,"output.compression-level");
+    cfgdata<bool> split_complex(false,"output.split-complex");
     cfgdata<int> samples(1,"montecarlo.samples");
     cfgdata<double> noise(0.0,"montecarlo.noise");
+    cfgdata<int> seed(-1,"montecarlo.seed");
+    cfgdata<bool> save_samples(true,"montecarlo.save-samples");
+    cfgdata<bool> summary(false,"montecarlo.summary");
+    cfgdata<int> checkpoint(0,"montecarlo.checkpoint");
+    cfgdata<int> mapped_threshold(0,"runtime.mmap-threshold");
+    cfgdata<string> scratch_dir(GetScratchDirectory(),"runtime.scratch-directory");
+    cfgdata<bool> map_inputs(true,"runtime.map-inputs");
+    cfgdata<string> cache_dir("","runtime.cache-directory");
+    cfgdata<int> cache_size(0,"runtime.cache-size");
+    cfgdata<bool> material_runs(false,"runtime.material-runs");
+    cfgdata<string> affinity("none","runtime.affinity");
+    cfgdata<int> slab_size(0,"runtime.slab-size");
     // load the input data
     try {
         //   title
@@ -148,14 +259,30 @@ int main(int argc, char **argv) {
         //   input
         LOADMANDATORYDATA(io_toml,body_addr);
         LOADMANDATORYDATA(io_toml,txsens_addr);
-        LOADMANDATORYDATA(io_toml,txphase_addr);
+        LOADOPTIONALDATA(io_toml,txphase_addr);
         LOADOPTIONALDATA(io_toml,rxsens_addr);
         LOADOPTIONALDATA(io_toml,rxphase_addr);
         //   output
         LOADMANDATORYDATA(io_toml,est_addr);
         LOADOPTIONALDATA(io_toml,imgs_addr);
+        LOADOPTIONALLIST(io_toml,chunk);
+        LOADOPTIONALDATA(io_toml,compression);
+        LOADOPTIONALDATA(io_toml,split_complex);
         LOADOPTIONALDATA(io_toml,samples);
         LOADOPTIONALDATA(io_toml,noise);
+        LOADOPTIONALDATA(io_toml,seed);
+        LOADOPTIONALDATA(io_toml,save_samples);
+        LOADOPTIONALDATA(io_toml,summary);
+        LOADOPTIONALDATA(io_toml,checkpoint);
+        //   runtime
+        LOADOPTIONALDATA(io_toml,mapped_threshold);
+        LOADOPTIONALDATA(io_toml,scratch_dir);
+        LOADOPTIONALDATA(io_toml,map_inputs);
+        LOADOPTIONALDATA(io_toml,cache_dir);
+        LOADOPTIONALDATA(io_toml,cache_size);
+        LOADOPTIONALDATA(io_toml,material_runs);
+        LOADOPTIONALDATA(io_toml,affinity);
+        LOADOPTIONALDATA(io_toml,slab_size);
     } catch (const runtime_error &e) {
         cout<<e.what()<<endl;
         return 1;
@@ -163,7 +290,7 @@ int main(int argc, char **argv) {
     cout<<endl;
     // check the provided data
     B1MapMethod b1map_method = static_cast<B1MapMethod>(method.first);
-    bool thereis_b1m = (rxsens_addr.first!="" && rxphase_addr.first!="");
+    bool thereis_b1m = rxsens_addr.first!="";
     bool thereis_imgs = imgs_addr.first!="";
     bool thereis_noise = noise.first>0;
     //   B1-mapping method
@@ -180,6 +307,141 @@ int main(int argc, char **argv) {
         cout<<"WARNING in config file: Without noise the number of samples is set equal to 1"<<endl;
         samples.first = 1;
     }
+    //   the samples of this shard, with the noise drawn from the seed
+    int m_begin = static_cast<int>(static_cast<Index>(samples.first)*shard/n_shards);
+    int m_end = static_cast<int>(static_cast<Index>(samples.first)*(shard+1)/n_shards);
+    uint64_t noise_seed = static_cast<uint64_t>(seed.first);
+    if (seed.first<0) {
+        random_device generator;
+        noise_seed = (static_cast<uint64_t>(generator())<<32)^generator();
+        BroadcastSeed(&noise_seed);
+    }
+    if (n_shards>1) {
+        est_addr.first = ShardAddress(est_addr.first,shard);
+        if (thereis_imgs) {
+            imgs_addr.first = ShardAddress(imgs_addr.first,shard);
+        }
+    }
+    //   output
+    if (chunk.first[0]<0||chunk.first[1]<0||chunk.first[2]<0) {
+        cout<<"FATAL ERROR in config file: Negative '"<<chunk.second<<"'"<<endl;
+        return 1;
+    }
+    if (compression.first<0||compression.first>9) {
+        cout<<"FATAL ERROR in config file: Out of range '"<<compression.second<<"'"<<endl;
+        return 1;
+    }
+    if (chunk.first[0]>0||chunk.first[1]>0||chunk.first[2]>0) {
+        io::SetChunkShape(vector<Index>(chunk.first.begin(),chunk.first.end()));
+    }
+    io::SetCompressionLevel(compression.first);
+    io::SetVoxelSize(vector<double>(dd.first.begin(),dd.first.end()));
+    //   runtime
+    if (mapped_threshold.first<0) {
+        cout<<"FATAL ERROR in config file: Negative '"<<mapped_threshold.second<<"'"<<endl;
+        return 1;
+    }
+    SetMappedThreshold(static_cast<size_t>(mapped_threshold.first)<<20);
+    SetScratchDirectory(scratch_dir.first);
+    io::SetInputMapping(map_inputs.first);
+    if (cache_size.first<0) {
+        cout<<"FATAL ERROR in config file: Negative '"<<cache_size.second<<"'"<<endl;
+        return 1;
+    }
+    SetCacheDirectory(cache_dir.first);
+    SetCacheSize(static_cast<size_t>(cache_size.first)<<20);
+    SetMaterialRuns(material_runs.first);
+    Affinity thread_affinity;
+    if (!ParseAffinity(&thread_affinity,affinity.first)) {
+        cout<<"FATAL ERROR in config file: Wrong data format '"<<affinity.second<<"'"<<endl;
+        return 1;
+    }
+    if (!SetAffinity(thread_affinity)) {
+        cout<<"WARNING: Impossible to pin the threads with '"<<affinity.first<<"' affinity"<<endl;
+    }
+    if (slab_size.first<0) {
+        cout<<"FATAL ERROR in config file: Negative '"<<slab_size.second<<"'"<<endl;
+        return 1;
+    }
+    // each rank takes a contiguous range of planes, processed in slabs
+    Index z_begin = nn.first[2]*GetRank()/GetNumRanks();
+    Index z_end = nn.first[2]*(GetRank()+1)/GetNumRanks();
+    Index slab = max<Index>(1,slab_size.first>0 ? slab_size.first : z_end-z_begin);
+    bool out_of_core = GetNumRanks()>1 || slab<nn.first[2];
+    // without an explicit chunk the outputs are chunked as the slabs, so
+    // that the slabs are written as whole chunks
+    bool chunk_slab = slab_size.first>0 && chunk.first[0]==0 && chunk.first[1]==0 && chunk.first[2]==0;
+    if (chunk_slab) {
+        io::SetChunkShape(vector<Index>{0,0,slab});
+    }
+    // with parallel HDF5 the ranks write their slabs together, otherwise in
+    // turn through a lock of the file
+    io::SetParallelWrites(GetNumRanks()>1 && GetSerializedRanks());
+    //   checkpoints of the Monte Carlo samples
+    if (checkpoint.first<0) {
+        cout<<"FATAL ERROR in config file: Negative '"<<checkpoint.second<<"'"<<endl;
+        return 1;
+    }
+    string checkpoint_fname;
+    string checkpoint_uri;
+    if ((checkpoint.first>0 || resume) && io::GetAddress(est_addr.first,checkpoint_fname,checkpoint_uri)==io::Format::NPY) {
+        cout<<"WARNING: Checkpoints cannot be read back from npy outputs"<<endl;
+        checkpoint.first = 0;
+        resume = false;
+    }
+    string checkpoint_addr = est_addr.first+"-MCcheckpoint";
+    bool thereis_checkpoint = false;
+    int m_resume = m_begin;
+    int summary_slot = -1;
+    // out-of-core, the record refers to the slabs of each rank whose samples
+    // are all written, so the planes must be split in the same way
+    Index record_slab = out_of_core ? slab_size.first : 0;
+    Index slabs_done = 0;
+    double record_sigma = 0.0;
+    if (resume) {
+        // next sample, seed and range of samples of the interrupted run
+        Image<Index> record;
+        io::GetAddress(checkpoint_addr,checkpoint_fname,checkpoint_uri);
+        try {
+            if (ifstream(checkpoint_fname).good()) {
+                LOADMAP(record,checkpoint_addr);
+                thereis_checkpoint = true;
+            }
+        } catch (const runtime_error&) {
+            thereis_checkpoint = false;
+        }
+        if (!thereis_checkpoint) {
+            cout<<"WARNING: Missing checkpoint '"<<checkpoint_addr<<"', the run starts from the beginning"<<endl;
+        } else {
+            if (record.GetNVox()!=8 || record[2]!=m_begin || record[3]!=m_end || record[0]<m_begin || record[0]>m_end
+                || record[4]<-1 || record[4]>1 || (seed.first>=0 && static_cast<uint64_t>(record[1])!=noise_seed)
+                || record[5]!=record_slab || record[6]!=GetNumRanks() || record[7]<0) {
+                cout<<"FATAL ERROR: Checkpoint not matching the configuration '"<<checkpoint_addr<<"'"<<endl;
+                return 1;
+            }
+            m_resume = static_cast<int>(record[0]);
+            noise_seed = static_cast<uint64_t>(record[1]);
+            summary_slot = static_cast<int>(record[4]);
+            slabs_done = record[7];
+            if (out_of_core) {
+                // the noise level computed by the noiseless pass
+                Image<double> sigma;
+                try {
+                    LOADMAP(sigma,checkpoint_addr+"-sigma");
+                } catch (const runtime_error &e) {
+                    cout<<e.what()<<endl;
+                    return 1;
+                }
+                if (sigma.GetNVox()!=1) {
+                    cout<<"FATAL ERROR: Checkpoint not matching the configuration '"<<checkpoint_addr<<"-sigma'"<<endl;
+                    return 1;
+                }
+                record_sigma = sigma[0];
+            }
+        }
+        // the ranks do not keep the outputs open while the others write
+        io::CloseFiles();
+    }
     // report the readen values
     cout<<"  "<<title.first<<"\n";
     cout<<"\n  Method: ("<<method.first<<") "<<ToString(b1map_method)<<"\n";
@@ -187,6 +449,18 @@ int main(int argc, char **argv) {
     cout<<"  Mesh step: ["<<dd.first[0]<<", "<<dd.first[1]<<", "<<dd.first[2]<<"] m\n";
     cout<<"\n  Number of Monte Carlo samples: "<<samples.first<<"\n";
     cout<<"  Additive noise: "<<noise.first*100.0<<" %\n";
+    cout<<"  Noise seed: "<<noise_seed<<"\n";
+    if (n_shards>1) {
+        cout<<"  Shard: "<<shard<<"/"<<n_shards<<" (samples "<<m_begin<<" to "<<m_end-1<<")\n";
+    }
+    if (checkpoint.first>0) {
+        cout<<"  Checkpoint: every "<<checkpoint.first<<" samples\n";
+    }
+    if (thereis_checkpoint && !out_of_core) {
+        cout<<"  Resumed from: sample "<<m_resume<<"\n";
+    } else if (thereis_checkpoint) {
+        cout<<"  Resumed from: slab "<<slabs_done<<" of each rank\n";
+    }
     cout<<"\n  Body details addr.: '"<<body_addr.first<<"'\n";
     cout<<"\n  Tx sensitivity addr.: '"<<txsens_addr.first<<"'\n";
     cout<<"  Tx phase addr.: '"<<txphase_addr.first<<"'\n";
@@ -194,64 +468,104 @@ int main(int argc, char **argv) {
     cout<<"  Rx phase addr.: '"<<rxphase_addr.first<<"'\n";
     cout<<"\n  Output estimate addr.: '"<<est_addr.first<<"'\n";
     cout<<"  Output intermediate images addr.: '"<<imgs_addr.first<<"'\n";
-    cout<<endl;
-    // load the body details
-    Body body;
-    try {
-        body = Body(body_addr.first);
-    } catch (const runtime_error &e) {
-        cout<<e.what()<<endl;
-        return 1;
+    if (compression.first>0) {
+        cout<<"  Output compression level: "<<compression.first<<"\n";
     }
-    // load b1p and b1m
-    Image<complex<double> > b1p(nn.first[0],nn.first[1],nn.first[2]);
-    Image<complex<double> > b1m(nn.first[0],nn.first[1],nn.first[2]);
-    {
-        cout<<"Loading Tx sensitivity and phase:\n"<<flush;
-        Image<double> txsens(nn.first[0],nn.first[1],nn.first[2]);
+    if (chunk.first[0]>0||chunk.first[1]>0||chunk.first[2]>0) {
+        cout<<"  Output chunk: ["<<chunk.first[0]<<", "<<chunk.first[1]<<", "<<chunk.first[2]<<"]\n";
+    } else if (chunk_slab) {
+        cout<<"  Output chunk: [0, 0, "<<slab<<"] (slab)\n";
+    }
+    if (GetNumRanks()>1) {
+        cout<<"\n  Ranks: "<<GetNumRanks()<<" (planes split along the third direction)";
+        cout<<"\n  Writes: "<<(io::GetParallelWrites() ? "collective (parallel HDF5)" : "in turn (file lock)");
+    }
+    cout<<"\n  Threads: "<<GetNumThreads()<<" (affinity: "<<affinity.first<<")\n";
+    if (mapped_threshold.first>0) {
+        cout<<"  Memory-mapped images above: "<<mapped_threshold.first<<" MiB\n";
+        cout<<"  Scratch directory: '"<<scratch_dir.first<<"'\n";
+    }
+    cout<<"  Memory-mapped inputs: "<<(map_inputs.first ? "yes" : "no")<<"\n";
+    if (cache_dir.first!="") {
+        cout<<"  Cache of the simulated images: '"<<cache_dir.first<<"'";
+        if (cache_size.first>0) {
+            cout<<" (up to "<<cache_size.first<<" MiB)";
+        }
+        cout<<"\n";
+    }
+    cout<<"  Material runs: "<<(material_runs.first ? "yes" : "no")<<"\n";
+    if (out_of_core) {
+        cout<<"  Out-of-core slabs: "<<slab<<" planes\n";
+    }
+    cout<<endl;
+    // parse the body details once (they can be in the config itself)
+    unique_ptr<io::IOtoml> body_file;
+    const io::IOtoml *body_toml = io_toml.get();
+    if (body_addr.first!=string(argv[1])) {
         try {
-            LOADMAP(txsens,txsens_addr.first);
-        } catch (const runtime_error &e) {
-            cout<<e.what()<<endl;
+            body_file.reset(new io::IOtoml(body_addr.first,io::Mode::In));
+        } catch(const ios_base::failure &e) {
+            cout<<"FATAL ERROR in body file: "<<e.what()<<endl;
             return 1;
         }
-        cout<<"  '"<<txsens_addr.first<<"'\n"<<flush;
-        Image<double> txphase(nn.first[0],nn.first[1],nn.first[2]);
+        body_toml = body_file.get();
+    }
+    // the images simulated before the checkpoint spare the body and b1
+    array<Image<complex<double> >,2> cached_imgs;
+    bool thereis_cache = false;
+    if (thereis_checkpoint && thereis_imgs && !out_of_core) {
         try {
-            LOADMAP(txphase,txphase_addr.first);
-        } catch (const runtime_error &e) {
-            cout<<e.what()<<endl;
-            return 1;
+            LoadComplexMap(&cached_imgs[0],imgs_addr.first+"1",split_complex.first);
+            LoadComplexMap(&cached_imgs[1],imgs_addr.first+"2",split_complex.first);
+            vector<Index> mesh(nn.first.begin(),nn.first.end());
+            thereis_cache = cached_imgs[0].GetSize()==mesh && cached_imgs[1].GetSize()==mesh;
+        } catch (const runtime_error&) {
+            thereis_cache = false;
         }
-        cout<<"  '"<<txphase_addr.first<<"'\n"<<flush;
-        for (int idx = 0; idx<b1p.GetNVox(); ++idx) {
-            b1p[idx] = txsens[idx]*exp(complex<double>(0.0,txphase[idx]));
+        if (thereis_cache) {
+            cout<<"Loading simulated images:\n";
+            cout<<"  '"<<imgs_addr.first<<"1'\n";
+            cout<<"  '"<<imgs_addr.first<<"2'\n";
+            cout<<endl;
         }
     }
-    if (thereis_b1m) {
-        cout<<"Loading Rx sensitivity and phase:\n"<<flush;
-        Image<double> rxsens(nn.first[0],nn.first[1],nn.first[2]);
+    // load the whole body and b1 (or just a slab at a time, later on)
+    Body body;
+    Image<complex<double> > b1p;
+    Image<complex<double> > b1m;
+    if (!out_of_core && !thereis_cache) {
+        b1p = Image<complex<double> >(nn.first[0],nn.first[1],nn.first[2]);
+        b1m = Image<complex<double> >(nn.first[0],nn.first[1],nn.first[2]);
+        vector<Index> mesh(nn.first.begin(),nn.first.end());
+        // load the body details
         try {
-            LOADMAP(rxsens,rxsens_addr.first);
+            body = Body(*body_toml,mesh);
         } catch (const runtime_error &e) {
+            cout<<e.what()<<endl;
             return 1;
         }
-        cout<<"  '"<<rxsens_addr.first<<"'\n"<<flush;
-        Image<double> rxphase(nn.first[0],nn.first[1],nn.first[2]);
+        // load b1p and b1m
         try {
-            LOADMAP(rxphase,rxphase_addr.first);
+            cout<<"Loading Tx sensitivity and phase:\n"<<flush;
+            LoadB1Slab(&b1p,txsens_addr.first,txphase_addr.first,0,nn.first[2],mesh);
+            cout<<"  '"<<txsens_addr.first<<"'\n"<<flush;
+            if (txphase_addr.first!="") {
+                cout<<"  '"<<txphase_addr.first<<"'\n"<<flush;
+            }
+            if (thereis_b1m) {
+                cout<<"Loading Rx sensitivity and phase:\n"<<flush;
+                LoadB1Slab(&b1m,rxsens_addr.first,rxphase_addr.first,0,nn.first[2],mesh);
+                cout<<"  '"<<rxsens_addr.first<<"'\n"<<flush;
+                if (rxphase_addr.first!="") {
+                    cout<<"  '"<<rxphase_addr.first<<"'\n"<<flush;
+                }
+            } else {
+                ParallelFill(b1m.GetData().data(),b1m.GetNVox(),complex<double>(1.0));
+            }
         } catch (const runtime_error &e) {
             cout<<e.what()<<endl;
             return 1;
         }
-        cout<<"  '"<<rxphase_addr.first<<"'\n"<<flush;
-        for (int idx = 0; idx<b1m.GetNVox(); ++idx) {
-            b1m[idx] = rxsens[idx]*exp(complex<double>(0.0,rxphase[idx]));
-        }
-    } else {
-        for (int idx = 0; idx<b1m.GetNVox(); ++idx) {
-            b1m[idx] = 1.0;
-        }
     }
     // load the method parameters and run the method
     Image<double> alpha_est;
@@ -286,6 +600,8 @@ int main(int argc, char **argv) {
     }
     // set-up the B1-mapping method
     std::unique_ptr<B1Mapping> b1mapping;
+    function<B1Mapping*(const Image<complex<double> >&,const Image<complex<double> >&,const Body&,const double)> new_b1mapping;
+    function<B1Mapping*(array<Image<complex<double> >,2>&&)> cached_b1mapping;
     switch (b1map_method) {
         case B1MapMethod::DA: {
             // report the parameters
@@ -296,7 +612,12 @@ int main(int argc, char **argv) {
             cout<<"  Spoiling coefficient: "<<spoiling.first<<"\n";
             cout<<endl;
             // initialise the method
-            b1mapping.reset(new DoubleAngle(alpha_nom.first,TR.first,TE.first,b1p,b1m,spoiling.first,body));
+            new_b1mapping = [=](const Image<complex<double> > &b1p,const Image<complex<double> > &b1m,const Body &body,const double b1p_avg) {
+                return new DoubleAngle(alpha_nom.first,TR.first,TE.first,b1p,b1m,spoiling.first,body,b1p_avg);
+            };
+            cached_b1mapping = [=](array<Image<complex<double> >,2> &&imgs) {
+                return new DoubleAngle(move(imgs));
+            };
             break;
         }
         case B1MapMethod::AFI: {
@@ -324,7 +645,12 @@ int main(int argc, char **argv) {
             cout<<"  Spoiling coefficient: "<<spoiling.first<<"\n";
             cout<<endl;
             // initialise the method
-            b1mapping.reset(new ActualFlipAngle(alpha_nom.first,TR.first,TR2,TE.first,b1p,b1m,spoiling.first,body));
+            new_b1mapping = [=](const Image<complex<double> > &b1p,const Image<complex<double> > &b1m,const Body &body,const double b1p_avg) {
+                return new ActualFlipAngle(alpha_nom.first,TR.first,TR2,TE.first,b1p,b1m,spoiling.first,body,b1p_avg);
+            };
+            cached_b1mapping = [=](array<Image<complex<double> >,2> &&imgs) {
+                return new ActualFlipAngle(TR.first,TR2,move(imgs));
+            };
             break;
         }
         case B1MapMethod::BSS: {
@@ -359,7 +685,12 @@ int main(int argc, char **argv) {
             cout<<"  BSS pulse length: "<<bss_length.first<<" ms\n";
             cout<<endl;
             // initialise the method
-            b1mapping.reset(new BlochSiegertShift(alpha_nom.first,TR.first,TE.first,2.0*PI*bss_offres.first,bss_length.first,b1p,b1m,spoiling.first,body));
+            new_b1mapping = [=](const Image<complex<double> > &b1p,const Image<complex<double> > &b1m,const Body &body,const double b1p_avg) {
+                return new BlochSiegertShift(alpha_nom.first,TR.first,TE.first,2.0*PI*bss_offres.first,bss_length.first,b1p,b1m,spoiling.first,body,b1p_avg);
+            };
+            cached_b1mapping = [=](array<Image<complex<double> >,2> &&imgs) {
+                return new BlochSiegertShift(2.0*PI*bss_offres.first,bss_length.first,move(imgs));
+            };
             break;
         }
         case B1MapMethod::TRX: {
@@ -371,50 +702,503 @@ int main(int argc, char **argv) {
             cout<<"  Spoiling coefficient: "<<spoiling.first<<"\n";
             cout<<endl;
             // initialise the method
-            b1mapping.reset(new TRxPhaseGRE(alpha_nom.first,TR.first,TE.first,b1p,b1m,spoiling.first,body));
+            new_b1mapping = [=](const Image<complex<double> > &b1p,const Image<complex<double> > &b1m,const Body &body,const double b1p_avg) {
+                return new TRxPhaseGRE(alpha_nom.first,TR.first,TE.first,b1p,b1m,spoiling.first,body,b1p_avg);
+            };
+            cached_b1mapping = [=](array<Image<complex<double> >,2> &&imgs) {
+                return new TRxPhaseGRE(move(imgs));
+            };
             break;
         }
     }
-    // save the images
-    std::array<Image<complex<double> >,2> imgs;
-    imgs[0] = b1mapping->GetImg(0);
-    imgs[1] = b1mapping->GetImg(1);
-    if (thereis_imgs) {
-        try {
-                SaveComplexMap(imgs[0],imgs_addr.first+"1");
-                SaveComplexMap(imgs[1],imgs_addr.first+"2");
-        } catch (const runtime_error &e) {
-            cout<<e.what()<<endl;
-            return 1;
+    if (!out_of_core) {
+        if (thereis_cache) {
+            b1mapping.reset(cached_b1mapping(move(cached_imgs)));
+        } else {
+            b1mapping.reset(new_b1mapping(b1p,b1m,body,0.0));
         }
-    }
-    // apply the method noiseless
-    cout<<"Noiseless B1-mapping..."<<flush;
-    b1mapping->Run(&alpha_est,0.0);
-    // save the result
-    try {
-        SAVEMAP(alpha_est,est_addr.first);
-    } catch (const runtime_error &e) {
-        cout<<e.what()<<endl;
-        return 1;
-    }
-    cout<<"done!\n";
-    cout<<endl;
-    // apply the Monte Carlo with noisy input
-    double sigma = ComputeSigma(imgs,noise.first);
-    cout<<"Monte Carlo sampling:\n";
-    for (int m = 0; m<samples.first; ++m) {
-        cout<<"  MC"<<to_string(m)<<"..."<<flush;
-        b1mapping->Run(&alpha_est,sigma);
+        b1mapping->SetNoise(noise_seed,0);
+        // save the images
+        const std::array<Image<complex<double> >,2> &imgs = b1mapping->GetImgs();
+        if (thereis_imgs && !thereis_cache) {
+            try {
+                    SaveComplexMap(imgs[0],imgs_addr.first+"1",split_complex.first);
+                    SaveComplexMap(imgs[1],imgs_addr.first+"2",split_complex.first);
+            } catch (const runtime_error &e) {
+                cout<<e.what()<<endl;
+                return 1;
+            }
+        }
+        // apply the method noiseless (already saved before the checkpoint)
+        if (!thereis_checkpoint) {
+            cout<<"Noiseless B1-mapping..."<<flush;
+            b1mapping->Run(&alpha_est,0.0);
+            // save the result
+            try {
+                SAVEMAP(alpha_est,est_addr.first);
+            } catch (const runtime_error &e) {
+                cout<<e.what()<<endl;
+                return 1;
+            }
+            cout<<"done!\n";
+            cout<<endl;
+        }
+        // apply the Monte Carlo with noisy input
+        double sigma = ComputeSigma(imgs,noise.first);
+        cout<<"Monte Carlo sampling:\n";
+        {
+            // the samples are written in background while the next ones are computed
+            io::AsyncWriter<double> writer(2);
+            RunningStats stats;
+            // the summary of a checkpoint is written in the slot not referred
+            // by the last record, which is written after it, so that an
+            // interruption at any point leaves a record and its summary
+            // (slot -1 is the final summary)
+            auto summary_addr = [&](const int slot, const string &name) {
+                return slot<0 ? est_addr.first+"-MC"+name : checkpoint_addr+"-"+name+to_string(slot);
+            };
+            if (summary.first && m_resume>m_begin) {
+                // restore the summary accumulated before the checkpoint
+                Image<Index> count;
+                Image<double> mean;
+                Image<double> m2;
+                try {
+                    LOADMAP(count,summary_addr(summary_slot,"count"));
+                    LOADMAP(mean,summary_addr(summary_slot,"mean"));
+                    LOADMAP(m2,summary_addr(summary_slot,"m2"));
+                    stats = RunningStats(count,mean,m2);
+                } catch (const runtime_error &e) {
+                    cout<<e.what()<<endl;
+                    return 1;
+                }
+            }
+            Image<double> alpha_tmp;
+            for (int m = m_resume; m<m_end; ++m) {
+                cout<<"  MC"<<to_string(m)<<"..."<<flush;
+                Image<double> *alpha_mc = save_samples.first ? writer.Acquire() : &alpha_tmp;
+                b1mapping->Run(alpha_mc,sigma,m);
+                if (summary.first) {
+                    stats.Add(*alpha_mc);
+                }
+                if (save_samples.first) {
+                    io::State iostate = writer.Push(alpha_mc,est_addr.first+"-MC"+to_string(m));
+                    if (iostate!=io::State::Success) {
+                        cout<<"FATAL ERROR: "<<ToString(iostate)<<" '"<<writer.GetFailedAddress()<<"'"<<endl;
+                        return 1;
+                    }
+                }
+                cout<<"done!\n";
+                // checkpoint: the samples and the summary so far, then the next sample
+                if (checkpoint.first>0 && (m+1-m_begin)%checkpoint.first==0 && m+1<m_end) {
+                    io::State iostate = writer.Flush();
+                    if (iostate!=io::State::Success) {
+                        cout<<"FATAL ERROR: "<<ToString(iostate)<<" '"<<writer.GetFailedAddress()<<"'"<<endl;
+                        return 1;
+                    }
+                    try {
+                        if (summary.first) {
+                            summary_slot = summary_slot==0 ? 1 : 0;
+                            SAVEMAP(stats.GetCount(),summary_addr(summary_slot,"count"));
+                            SAVEMAP(stats.GetMean(),summary_addr(summary_slot,"mean"));
+                            SAVEMAP(stats.GetM2(),summary_addr(summary_slot,"m2"));
+                            io::FlushFiles();
+                        }
+                        SAVEMAP(CheckpointRecord(m+1,noise_seed,m_begin,m_end,summary_slot,0,0),checkpoint_addr);
+                    } catch (const runtime_error &e) {
+                        cout<<e.what()<<endl;
+                        return 1;
+                    }
+                    io::FlushFiles();
+                }
+            }
+            io::State iostate = writer.Finish();
+            if (iostate!=io::State::Success) {
+                cout<<"FATAL ERROR: "<<ToString(iostate)<<" '"<<writer.GetFailedAddress()<<"'"<<endl;
+                return 1;
+            }
+            if (summary.first && m_end>m_begin) {
+                try {
+                    SAVEMAP(stats.GetCount(),est_addr.first+"-MCcount");
+                    SAVEMAP(stats.GetMean(),est_addr.first+"-MCmean");
+                    SAVEMAP(stats.GetM2(),est_addr.first+"-MCm2");
+                } catch (const runtime_error &e) {
+                    cout<<e.what()<<endl;
+                    return 1;
+                }
+            }
+            if (checkpoint.first>0) {
+                try {
+                    io::FlushFiles();
+                    SAVEMAP(CheckpointRecord(m_end,noise_seed,m_begin,m_end,-1,0,0),checkpoint_addr);
+                } catch (const runtime_error &e) {
+                    cout<<e.what()<<endl;
+                    return 1;
+                }
+            }
+        }
+        cout<<endl;
+    } else {
+        // out-of-core execution: the global averages are accumulated plane by
+        // plane, as over the whole volume
+        vector<Index> mesh(nn.first.begin(),nn.first.end());
         try {
-            SAVEMAP(alpha_est,est_addr.first+"-MC"+to_string(m));
+            // first pass: average of the B1+ magnitude
+            cout<<"Averaging Tx sensitivity..."<<flush;
+            vector<double> b1p_sum(nn.first[2],0.0);
+            vector<Index> b1p_num(nn.first[2],0);
+            for (Index z0 = z_begin; z0<z_end; z0 += slab) {
+                Index nz = min<Index>(slab,z_end-z0);
+                LoadB1Slab(&b1p,txsens_addr.first,txphase_addr.first,z0,nz,mesh);
+                AccumulatePlanes(&b1p_sum,&b1p_num,b1p,z0);
+            }
+            AllReduceSum(&b1p_sum);
+            AllReduceSum(&b1p_num);
+            double b1p_avg = PlaneAvg(b1p_sum,b1p_num);
+            cout<<"done!\n";
+            cout<<endl;
+            // the property maps are clustered over the whole body, so that
+            // the materials of the slabs do not depend on the slab size
+            BodyClusters clusters(*body_toml);
+            if (clusters.IsEnabled()) {
+                cout<<"Clustering body properties..."<<flush;
+                for (Index z0 = z_begin; z0<z_end; z0 += slab) {
+                    clusters.AddSlab(*body_toml,z0,min<Index>(slab,z_end-z0),mesh);
+                }
+            }
+            clusters.Finish();
+            if (clusters.IsEnabled()) {
+                cout<<"done!\n";
+                cout<<endl;
+            }
+            // create the outputs (once, before the ranks write their slabs),
+            // unless they are those of the interrupted run; with collective
+            // writes the .h5 files are open by all the ranks together
+            if (!thereis_checkpoint && (GetRank()==0 || io::GetParallelWrites())) {
+                CreateMap<double>(mesh,est_addr.first);
+                for (int m = m_begin; m<m_end && save_samples.first; ++m) {
+                    CreateMap<double>(mesh,est_addr.first+"-MC"+to_string(m));
+                }
+                if (summary.first && m_end>m_begin) {
+                    CreateMap<Index>(mesh,est_addr.first+"-MCcount");
+                    CreateMap<double>(mesh,est_addr.first+"-MCmean");
+                    CreateMap<double>(mesh,est_addr.first+"-MCm2");
+                }
+                if (thereis_imgs) {
+                    CreateComplexMap(mesh,imgs_addr.first+"1",split_complex.first);
+                    CreateComplexMap(mesh,imgs_addr.first+"2",split_complex.first);
+                }
+                if (GetNumRanks()>1 && !io::GetParallelWrites()) {
+                    io::CloseFiles();
+                }
+            } else if (io::GetParallelWrites()) {
+                set<string> fnames;
+                for (const string &addr : {est_addr.first,imgs_addr.first}) {
+                    string fname;
+                    string uri;
+                    if (addr!="" && io::GetAddress(addr,fname,uri)==io::Format::HDF5) {
+                        fnames.insert(fname);
+                    }
+                }
+                for (const string &fname : fnames) {
+                    io::IOh5 ofile(fname,io::Mode::Append);
+                }
+            }
+            BarrierRanks();
+            // the images written by the noiseless pass are read back by the
+            // Monte Carlo one, instead of simulating the steady state again
+            string imgs_fname;
+            string imgs_uri;
+            bool reuse_imgs = thereis_imgs && io::GetAddress(imgs_addr.first,imgs_fname,imgs_uri)!=io::Format::NPY;
+            // number of slabs of the rank with the most planes, so that all
+            // the ranks go through the same batches of slabs
+            Index n_slabs = 0;
+            for (int r = 0; r<GetNumRanks(); ++r) {
+                Index zb = nn.first[2]*r/GetNumRanks();
+                Index ze = nn.first[2]*(r+1)/GetNumRanks();
+                Index s = max<Index>(1,slab_size.first>0 ? slab_size.first : ze-zb);
+                n_slabs = max<Index>(n_slabs,(ze-zb+s-1)/s);
+            }
+            // pipeline over the slabs: the reading of the next slab and the
+            // writing of the previous ones overlap with the simulation
+            struct SlabTask {
+                Index z0;
+                Index nz;
+                Body body;
+                Image<complex<double> > b1p;
+                Image<complex<double> > b1m;
+                array<Image<complex<double> >,2> imgs;
+                shared_ptr<B1Mapping> b1mapping;
+            };
+            array<vector<double>,2> imgs_sum;
+            array<vector<Index>,2> imgs_num;
+            for (int d = 0; d<2; ++d) {
+                imgs_sum[d].assign(nn.first[2],0.0);
+                imgs_num[d].assign(nn.first[2],0);
+            }
+            auto run_pipeline = [&](const bool noiseless, const double sigma, const Index k_begin, const Index k_end) {
+                bool reload = !noiseless && reuse_imgs;
+                BoundedQueue<SlabTask> loaded(1);
+                BoundedQueue<SlabTask> simulated(1);
+                BoundedQueue<function<void()> > results(2);
+                Stage reader("read");
+                Stage simulator("simulate");
+                Stage estimator("estimate");
+                Stage writer("write");
+                int n_threads = GetNumThreads();
+                auto push_slab = [&](const shared_ptr<Image<double> > &alpha, const string &addr, const Index z0) {
+                    return results.Push([alpha,addr,z0]() {
+                        SaveSlab(*alpha,addr,z0);
+                    });
+                };
+                reader.Start([&]() {
+                    for (Index k = k_begin; k<k_end; ++k) {
+                        // a rank out of planes goes on with empty slabs, to
+                        // take part in the collective writes of the others
+                        Index z0 = z_begin+k*slab;
+                        if (z0>=z_end && !io::GetParallelWrites()) {
+                            break;
+                        }
+                        reader.BeginWork();
+                        SlabTask task;
+                        task.z0 = min<Index>(z0,z_end);
+                        task.nz = z0<z_end ? min<Index>(slab,z_end-z0) : 0;
+                        if (reload || task.nz==0) {
+                            if (task.nz>0) {
+                                LoadComplexSlab(&task.imgs[0],imgs_addr.first+"1",task.z0,task.nz,mesh,split_complex.first);
+                                LoadComplexSlab(&task.imgs[1],imgs_addr.first+"2",task.z0,task.nz,mesh,split_complex.first);
+                            }
+                            reader.EndWork();
+                            if (!loaded.Push(std::move(task))) {
+                                break;
+                            }
+                            continue;
+                        }
+                        task.body = Body(*body_toml,task.z0,task.nz,mesh,clusters);
+                        LoadB1Slab(&task.b1p,txsens_addr.first,txphase_addr.first,task.z0,task.nz,mesh);
+                        if (thereis_b1m) {
+                            LoadB1Slab(&task.b1m,rxsens_addr.first,rxphase_addr.first,task.z0,task.nz,mesh);
+                        } else {
+                            task.b1m = Image<complex<double> >(task.b1p.GetSize());
+                            ParallelFill(task.b1m.GetData().data(),task.b1m.GetNVox(),complex<double>(1.0));
+                        }
+                        reader.EndWork();
+                        if (!loaded.Push(std::move(task))) {
+                            break;
+                        }
+                    }
+                },[&]() {
+                    loaded.Close();
+                },1);
+                simulator.Start([&]() {
+                    SlabTask task;
+                    while (loaded.Pop(&task)) {
+                        if (task.nz==0) {
+                            if (!simulated.Push(std::move(task))) {
+                                break;
+                            }
+                            continue;
+                        }
+                        simulator.BeginWork();
+                        if (reload) {
+                            task.b1mapping.reset(cached_b1mapping(std::move(task.imgs)));
+                        } else {
+                            task.b1mapping.reset(new_b1mapping(task.b1p,task.b1m,task.body,b1p_avg));
+                        }
+                        task.b1mapping->SetNoise(noise_seed,task.z0*nn.first[0]*nn.first[1]);
+                        task.body = Body();
+                        task.b1p = Image<complex<double> >();
+                        task.b1m = Image<complex<double> >();
+                        if (noiseless) {
+                            const std::array<Image<complex<double> >,2> &imgs = task.b1mapping->GetImgs();
+                            for (int d = 0; d<2; ++d) {
+                                AccumulatePlanes(&imgs_sum[d],&imgs_num[d],imgs[d],task.z0);
+                            }
+                        }
+                        simulator.EndWork();
+                        if (!simulated.Push(std::move(task))) {
+                            break;
+                        }
+                    }
+                },[&]() {
+                    loaded.Close();
+                    simulated.Close();
+                },max(1,n_threads-n_threads/2));
+                estimator.Start([&]() {
+                    SlabTask task;
+                    Index nx = nn.first[0];
+                    Index ny = nn.first[1];
+                    while (simulated.Pop(&task)) {
+                        // the empty slabs write images without planes
+                        Index z0 = task.z0;
+                        shared_ptr<B1Mapping> b1mapping = task.b1mapping;
+                        if (noiseless && thereis_imgs) {
+                            bool split = split_complex.first;
+                            string addr = imgs_addr.first;
+                            bool pushed = results.Push([b1mapping,addr,z0,split,nx,ny]() {
+                                Image<complex<double> > none(nx,ny,0);
+                                SaveComplexSlab(b1mapping ? b1mapping->GetImgs()[0] : none,addr+"1",z0,split);
+                                SaveComplexSlab(b1mapping ? b1mapping->GetImgs()[1] : none,addr+"2",z0,split);
+                            });
+                            if (!pushed) {
+                                return;
+                            }
+                        }
+                        // noiseless estimate
+                        if (noiseless) {
+                            estimator.BeginWork();
+                            shared_ptr<Image<double> > alpha(new Image<double>(nx,ny,0));
+                            if (b1mapping) {
+                                b1mapping->Run(alpha.get(),0.0);
+                            }
+                            estimator.EndWork();
+                            if (!push_slab(alpha,est_addr.first,z0)) {
+                                return;
+                            }
+                        }
+                        // Monte Carlo samples of this shard
+                        if (noiseless!=thereis_noise && m_end>m_begin) {
+                            shared_ptr<RunningStats> stats(new RunningStats);
+                            if (!b1mapping) {
+                                stats.reset(new RunningStats(Image<Index>(nx,ny,0),Image<double>(nx,ny,0),Image<double>(nx,ny,0)));
+                            }
+                            for (int m = m_begin; m<m_end; ++m) {
+                                estimator.BeginWork();
+                                shared_ptr<Image<double> > alpha(new Image<double>(nx,ny,0));
+                                if (b1mapping) {
+                                    b1mapping->Run(alpha.get(),sigma,m);
+                                }
+                                if (summary.first && b1mapping) {
+                                    stats->Add(*alpha);
+                                }
+                                estimator.EndWork();
+                                if (save_samples.first && !push_slab(alpha,est_addr.first+"-MC"+to_string(m),z0)) {
+                                    return;
+                                }
+                            }
+                            if (summary.first) {
+                                string addr = est_addr.first;
+                                bool pushed = results.Push([stats,addr,z0]() {
+                                    SaveSlab(stats->GetCount(),addr+"-MCcount",z0);
+                                    SaveSlab(stats->GetMean(),addr+"-MCmean",z0);
+                                    SaveSlab(stats->GetM2(),addr+"-MCm2",z0);
+                                });
+                                if (!pushed) {
+                                    return;
+                                }
+                            }
+                        }
+                        if (task.nz>0) {
+                            cout<<"  slab ["<<z0<<", "<<z0+task.nz<<")...done!\n"<<flush;
+                        }
+                    }
+                },[&]() {
+                    simulated.Close();
+                    results.Close();
+                },max(1,n_threads/2));
+                writer.Start([&]() {
+                    function<void()> write;
+                    while (results.Pop(&write)) {
+                        writer.BeginWork();
+                        write();
+                        writer.EndWork();
+                    }
+                },[&]() {
+                    results.Close();
+                },1);
+                // wait for the stages and report their occupancy
+                array<Stage*,4> stages{&reader,&simulator,&estimator,&writer};
+                for (Stage *stage : stages) {
+                    stage->Join();
+                }
+                cout<<"  occupancy:";
+                for (Stage *stage : stages) {
+                    cout<<" "<<stage->GetName()<<" "<<static_cast<int>(stage->GetOccupancy()*100.0+0.5)<<"%";
+                }
+                cout<<"\n"<<endl;
+                for (Stage *stage : stages) {
+                    if (stage->GetError()!="") {
+                        throw runtime_error(stage->GetError());
+                    }
+                }
+            };
+            // checkpoint: once all the ranks are done with a batch of slabs,
+            // the first one writes the noise level and then the record
+            //   (with collective writes the .h5 files are flushed and written by
+            //   all the ranks together)
+            auto save_checkpoint = [&](const Index slabs, const double sigma) {
+                bool together = io::GetParallelWrites();
+                string fname;
+                string uri;
+                bool flush = GetRank()==0 || together;
+                bool write = GetRank()==0 || (together && io::GetAddress(checkpoint_addr,fname,uri)==io::Format::HDF5);
+                BarrierRanks();
+                if (flush) {
+                    io::FlushFiles();
+                }
+                if (write) {
+                    Image<double> sigma_img(1);
+                    sigma_img[0] = sigma;
+                    SAVEMAP(sigma_img,checkpoint_addr+"-sigma");
+                }
+                if (flush) {
+                    io::FlushFiles();
+                }
+                if (write) {
+                    int next = slabs<n_slabs ? m_begin : m_end;
+                    SAVEMAP(CheckpointRecord(next,noise_seed,m_begin,m_end,-1,record_slab,slabs),checkpoint_addr);
+                }
+                if (flush) {
+                    io::FlushFiles();
+                }
+                if (GetRank()==0 && GetNumRanks()>1 && !together) {
+                    io::CloseFiles();
+                }
+                BarrierRanks();
+            };
+            // the pass of the samples goes through the slabs in batches as
+            // long as the checkpoint period, skipping the ones already done
+            auto run_batches = [&](const bool noiseless, const double sigma) {
+                Index batch = n_slabs;
+                if (checkpoint.first>0 && m_end>m_begin) {
+                    batch = max<Index>(1,(static_cast<Index>(checkpoint.first)*n_slabs+m_end-m_begin-1)/(m_end-m_begin));
+                }
+                for (Index k = slabs_done; k<n_slabs; k += batch) {
+                    run_pipeline(noiseless,sigma,k,min<Index>(k+batch,n_slabs));
+                    if (checkpoint.first>0) {
+                        save_checkpoint(min<Index>(k+batch,n_slabs),sigma);
+                    }
+                }
+            };
+            // second pass: images and noiseless estimate (and the samples too,
+            // when their noise does not depend on the whole images)
+            if (!thereis_noise) {
+                cout<<"Noiseless B1-mapping:\n";
+                run_batches(true,0.0);
+            } else {
+                // third pass: Monte Carlo with noisy input
+                double sigma = record_sigma;
+                if (!thereis_checkpoint) {
+                    cout<<"Noiseless B1-mapping:\n";
+                    run_pipeline(true,0.0,0,n_slabs);
+                    for (int d = 0; d<2; ++d) {
+                        AllReduceSum(&imgs_sum[d]);
+                        AllReduceSum(&imgs_num[d]);
+                    }
+                    array<double,2> imgs_avg{PlaneAvg(imgs_sum[0],imgs_num[0]),PlaneAvg(imgs_sum[1],imgs_num[1])};
+                    sigma = ComputeSigma(imgs_avg,noise.first);
+                    if (checkpoint.first>0) {
+                        save_checkpoint(0,sigma);
+                    }
+                }
+                cout<<"Monte Carlo sampling:\n";
+                run_batches(false,sigma);
+            }
         } catch (const runtime_error &e) {
             cout<<e.what()<<endl;
             return 1;
         }
-        cout<<"done!\n";
     }
-    cout<<endl;
+    io::CloseFiles();
     //
     auto end = chrono::system_clock::now();
     auto elapsed = chrono::duration_cast<chrono::seconds>(end - start);
@@ -423,17 +1207,321 @@ int main(int argc, char **argv) {
     return 0;
 }
 
-void SaveComplexMap(Image<complex<double> > img,string addr) {
+void SaveComplexMap(const Image<complex<double> > &img,string addr,const bool split) {
+    if (!split) {
+        SAVEMAP(img,addr);
+        return;
+    }
     Image<double> tmp(img.GetSize(0),img.GetSize(1),img.GetSize(2));
-    for (int idx = 0; idx<tmp.GetNVox(); ++idx) {
+    #pragma omp parallel for schedule(static)
+    for (Index idx = 0; idx<tmp.GetNVox(); ++idx) {
         tmp[idx] = real(img[idx]);
     }
     string real_addr = addr+"/real";
     SAVEMAP(tmp,real_addr);
-    for (int idx = 0; idx<tmp.GetNVox(); ++idx) {
+    #pragma omp parallel for schedule(static)
+    for (Index idx = 0; idx<tmp.GetNVox(); ++idx) {
         tmp[idx] = imag(img[idx]);
     }
     string imag_addr = addr+"/imag";
     SAVEMAP(tmp,imag_addr)
     return;
 }
+
+void LoadComplexMap(Image<complex<double> > *img,string addr,const bool split) {
+    if (!split) {
+        LOADMAP(*img,addr);
+        return;
+    }
+    Image<double> re;
+    Image<double> im;
+    string real_addr = addr+"/real";
+    LOADMAP(re,real_addr);
+    string imag_addr = addr+"/imag";
+    LOADMAP(im,imag_addr);
+    if (re.GetSize()!=im.GetSize()) {
+        throw runtime_error("FATAL ERROR: Mismatching real and imaginary parts '"+addr+"'");
+    }
+    *img = Image<complex<double> >(re.GetSize());
+    #pragma omp parallel for schedule(static)
+    for (Index idx = 0; idx<re.GetNVox(); ++idx) {
+        (*img)[idx] = complex<double>(re[idx],im[idx]);
+    }
+    return;
+}
+
+Image<Index> CheckpointRecord(const int next,const uint64_t seed,const int m_begin,const int m_end,const int slot,const Index slab,const Index slabs_done) {
+    Image<Index> record(8);
+    record[0] = next;
+    record[1] = static_cast<Index>(seed);
+    record[2] = m_begin;
+    record[3] = m_end;
+    record[4] = slot;
+    record[5] = slab;
+    record[6] = GetNumRanks();
+    record[7] = slabs_done;
+    return record;
+}
+
+template <typename T>
+void LoadSlab(Image<T> *map,const string &addr,const Index z0,const Index nz,const vector<Index> &nn) {
+    string fname;
+    string uri;
+    vector<Index> size;
+    vector<Index> count{nn[0],nn[1],nz};
+    io::State iostate;
+    if (io::GetAddress(addr,fname,uri)==io::Format::NIfTI) {
+        io::IOnifti ifile(fname);
+        iostate = ifile.GetDatasetSize(&size);
+        if (iostate==io::State::Success && size!=nn) {
+            iostate = io::State::NIfTIFormatException;
+        }
+        if (iostate==io::State::Success) {
+            if (map->GetSize()!=count) {
+                *map = Image<T>(count);
+            }
+            iostate = ifile.ReadSlab(map->GetData().data(),{0,0,z0},count);
+        }
+    } else {
+        io::IOh5 ifile(fname,io::Mode::In);
+        iostate = ifile.GetDatasetSize(&size,"/",uri);
+        if (iostate==io::State::Success && size!=nn) {
+            iostate = io::State::HDF5DataspaceException;
+        }
+        if (iostate==io::State::Success) {
+            if (map->GetSize()!=count) {
+                *map = Image<T>(count);
+            }
+            iostate = ifile.ReadSlab(map->GetData().data(),{0,0,z0},count,"/",uri);
+        }
+    }
+    if (iostate!=io::State::Success) {
+        string msg = "FATAL ERROR: "+ToString(iostate)+" '"+addr+"'";
+        throw runtime_error(msg);
+    }
+    return;
+}
+
+void LoadB1Slab(Image<complex<double> > *b1,const string &sens_addr,const string &phase_addr,const Index z0,const Index nz,const vector<Index> &nn) {
+    // complex-valued source
+    if (phase_addr=="") {
+        if (z0>0 || nz<nn[2]) {
+            LoadSlab(b1,sens_addr,z0,nz,nn);
+            return;
+        }
+        // the whole volume is read (or mapped) at once
+        LOADMAP(*b1,sens_addr);
+        if (b1->GetSize()!=nn) {
+            string msg = "FATAL ERROR: "+ToString(io::State::HDF5DataspaceException)+" '"+sens_addr+"'";
+            throw runtime_error(msg);
+        }
+        return;
+    }
+    // magnitude and phase are streamed in chunks of planes, composed directly
+    // into the destination while the next chunk is read
+    vector<Index> count{nn[0],nn[1],nz};
+    if (b1->GetSize()!=count) {
+        *b1 = Image<complex<double> >(count);
+    }
+    const Index chunk_bytes = 16<<20;
+    Index plane = nn[0]*nn[1];
+    Index chunk = max<Index>(1,min<Index>(nz,chunk_bytes/static_cast<Index>(sizeof(double))/max<Index>(plane,1)));
+    array<Image<double>,2> sens;
+    array<Image<double>,2> phase;
+    auto read = [&](const int b,const Index c0) {
+        Index nc = min<Index>(chunk,nz-c0);
+        LoadSlab(&sens[b],sens_addr,z0+c0,nc,nn);
+        LoadSlab(&phase[b],phase_addr,z0+c0,nc,nn);
+    };
+    read(0,0);
+    int b = 0;
+    for (Index c0 = 0; c0<nz; c0 += chunk) {
+        string error;
+        thread reader;
+        if (c0+chunk<nz) {
+            reader = thread([&,b,c0]() {
+                try {
+                    read(1-b,c0+chunk);
+                } catch (const runtime_error &e) {
+                    error = e.what();
+                }
+            });
+        }
+        complex<double> *dst = b1->GetData().data()+c0*plane;
+        const Image<double> &s = sens[b];
+        const Image<double> &p = phase[b];
+        #pragma omp parallel for schedule(static)
+        for (Index idx = 0; idx<s.GetNVox(); ++idx) {
+            dst[idx] = s[idx]*exp(complex<double>(0.0,p[idx]));
+        }
+        if (reader.joinable()) {
+            reader.join();
+        }
+        if (error!="") {
+            throw runtime_error(error);
+        }
+        b = 1-b;
+    }
+    return;
+}
+
+template <typename T>
+void CreateMap(const vector<Index> &nn,const string &addr) {
+    string fname;
+    string uri;
+    io::Format format = io::GetAddress(addr,fname,uri);
+    auto const pos = uri.find_last_of("/");
+    // with collective writes all the ranks create the .h5 datasets together,
+    // while the other files are created by the first rank alone
+    if (format!=io::Format::HDF5 && GetRank()>0) {
+        return;
+    }
+    io::State iostate;
+    if (format==io::Format::NPY) {
+        iostate = io::IOnpy(fname).CreateDataset<T>(nn);
+    } else if (format==io::Format::NIfTI) {
+        iostate = io::IOnifti(fname).CreateDataset<T>(nn);
+    } else {
+        io::IOh5 ofile(fname,io::Mode::Append);
+        iostate = ofile.CreateDataset<T>(nn,uri.substr(0,pos+1),uri.substr(pos+1));
+    }
+    if (iostate!=io::State::Success) {
+        string msg = "FATAL ERROR: "+ToString(iostate)+" '"+addr+"'";
+        throw runtime_error(msg);
+    }
+    return;
+}
+
+template <typename T>
+void SaveSlab(const Image<T> &img,const string &addr,const Index z0) {
+    string fname;
+    string uri;
+    io::Format format = io::GetAddress(addr,fname,uri);
+    auto const pos = uri.find_last_of("/");
+    // the .npy and NIfTI-1 files are written in place, the ranks touching
+    // disjoint planes
+    if (format!=io::Format::HDF5) {
+        io::State iostate = format==io::Format::NPY ?
+            io::IOnpy(fname).WriteSlab(img.GetData().data(),{0,0,z0},img.GetSize()) :
+            io::IOnifti(fname).WriteSlab(img.GetData().data(),{0,0,z0},img.GetSize());
+        if (iostate!=io::State::Success) {
+            string msg = "FATAL ERROR: "+ToString(iostate)+" '"+addr+"'";
+            throw runtime_error(msg);
+        }
+        return;
+    }
+    // the ranks write together with parallel HDF5, otherwise in turn, each
+    // closing the file before the next one
+    bool in_turn = GetNumRanks()>1 && !io::GetParallelWrites();
+    unique_ptr<FileLock> turn;
+    if (in_turn) {
+        try {
+            turn.reset(new FileLock(fname));
+        } catch (const runtime_error &e) {
+            throw runtime_error("FATAL ERROR: "+string(e.what()));
+        }
+    }
+    io::State iostate;
+    {
+        io::IOh5 ofile(fname,io::Mode::Append);
+        iostate = ofile.WriteSlab(img.GetData().data(),{0,0,z0},img.GetSize(),uri.substr(0,pos+1),uri.substr(pos+1));
+    }
+    if (in_turn) {
+        io::CloseFile(fname);
+    }
+    if (iostate!=io::State::Success) {
+        string msg = "FATAL ERROR: "+ToString(iostate)+" '"+addr+"'";
+        throw runtime_error(msg);
+    }
+    return;
+}
+
+void CreateComplexMap(const vector<Index> &nn,const string &addr,const bool split) {
+    if (!split) {
+        CreateMap<complex<double> >(nn,addr);
+        return;
+    }
+    CreateMap<double>(nn,addr+"/real");
+    CreateMap<double>(nn,addr+"/imag");
+    return;
+}
+
+void SaveComplexSlab(const Image<complex<double> > &img,const string &addr,const Index z0,const bool split) {
+    if (!split) {
+        SaveSlab(img,addr,z0);
+        return;
+    }
+    Image<double> tmp(img.GetSize());
+    #pragma omp parallel for schedule(static)
+    for (Index idx = 0; idx<tmp.GetNVox(); ++idx) {
+        tmp[idx] = real(img[idx]);
+    }
+    SaveSlab(tmp,addr+"/real",z0);
+    #pragma omp parallel for schedule(static)
+    for (Index idx = 0; idx<tmp.GetNVox(); ++idx) {
+        tmp[idx] = imag(img[idx]);
+    }
+    SaveSlab(tmp,addr+"/imag",z0);
+    return;
+}
+
+void LoadComplexSlab(Image<complex<double> > *img,const string &addr,const Index z0,const Index nz,const vector<Index> &nn,const bool split) {
+    // the ranks read in turn with the ones writing to the same file (with
+    // collective writes, through the file open by all the ranks)
+    string fname;
+    string uri;
+    bool hdf5 = io::GetAddress(addr,fname,uri)==io::Format::HDF5 && !io::GetParallelWrites();
+    unique_ptr<FileLock> turn;
+    if (hdf5 && GetNumRanks()>1) {
+        try {
+            turn.reset(new FileLock(fname));
+        } catch (const runtime_error &e) {
+            throw runtime_error("FATAL ERROR: "+string(e.what()));
+        }
+    }
+    string error;
+    try {
+        if (!split) {
+            LoadSlab(img,addr,z0,nz,nn);
+        } else {
+            Image<double> re;
+            Image<double> im;
+            LoadSlab(&re,addr+"/real",z0,nz,nn);
+            LoadSlab(&im,addr+"/imag",z0,nz,nn);
+            *img = Image<complex<double> >(re.GetSize());
+            #pragma omp parallel for schedule(static)
+            for (Index idx = 0; idx<re.GetNVox(); ++idx) {
+                (*img)[idx] = complex<double>(re[idx],im[idx]);
+            }
+        }
+    } catch (const runtime_error &e) {
+        error = e.what();
+    }
+    if (hdf5 && GetNumRanks()>1) {
+        io::CloseFile(fname);
+    }
+    if (error!="") {
+        throw runtime_error(error);
+    }
+    return;
+}
+
+string ShardAddress(const string &addr,const int shard) {
+    string fname;
+    string uri;
+    io::Format format = io::GetAddress(addr,fname,uri);
+    size_t dot = format==io::Format::NIfTI ? fname.rfind(".nii") : fname.find_last_of('.');
+    size_t slash = fname.find_last_of('/');
+    if (dot==string::npos || (slash!=string::npos && dot<slash)) {
+        dot = fname.size();
+    }
+    fname.insert(dot,"-shard"+to_string(shard));
+    switch (format) {
+        case io::Format::NPY:
+            return "npy:"+fname;
+        case io::Format::NIfTI:
+            return fname;
+        default:
+            return fname+":"+uri;
+    }
+}
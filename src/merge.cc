@@ -0,0 +1,162 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "b1map/io/io_hdf5.h"
+
+#include "b1map/statistics.h"
+#include "b1map/version.h"
+
+using namespace std;
+using namespace b1map;
+
+// suffixes of the Monte Carlo summary datasets
+static const vector<string> summary_suffix = {"-MCcount","-MCmean","-MCm2"};
+
+bool IsSummary(const string &uri,string *prefix,int *which);
+template <typename T> io::State ReadUri(io::IOh5 &ifile,Image<T> *img,const string &uri);
+template <typename T> io::State WriteUri(const io::IOh5 &ofile,const Image<T> &img,const string &uri);
+
+int main(int argc, char **argv) {
+    // opening boilerplate
+    cout<<project::str()<<" ("<<build::str()<<") ["<<compiler::str()<<"]\n"<<endl;
+    // check the number of input
+    if (argc<3) {
+        cout<<"Usage example: b1map-merge <output file> <shard file> [<shard file> ...]"<<endl;
+        return -1;
+    }
+    string out_fname(argv[1]);
+    cout<<"Merging "<<argc-2<<" shard(s) into '"<<out_fname<<"'"<<endl;
+    io::IOh5 ofile(out_fname,io::Mode::Append);
+    map<string,RunningStats> stats;
+    set<string> copied;
+    for (int arg = 2; arg<argc; ++arg) {
+        string in_fname(argv[arg]);
+        cout<<"  "<<in_fname<<"..."<<flush;
+        io::IOh5 ifile(in_fname,io::Mode::In);
+        vector<string> uris;
+        io::State iostate = ifile.ListDatasets(&uris);
+        if (iostate!=io::State::Success) {
+            cout<<"FATAL ERROR: "<<ToString(iostate)<<" '"<<in_fname<<"'"<<endl;
+            return 1;
+        }
+        for (const string &uri : uris) {
+            string prefix;
+            int which;
+            if (IsSummary(uri,&prefix,&which)) {
+                // the summary is merged once its three datasets are read
+                if (which!=0) {
+                    continue;
+                }
+                Image<Index> count;
+                Image<double> mean;
+                Image<double> m2;
+                iostate = ReadUri(ifile,&count,prefix+summary_suffix[0]);
+                if (iostate==io::State::Success) {
+                    iostate = ReadUri(ifile,&mean,prefix+summary_suffix[1]);
+                }
+                if (iostate==io::State::Success) {
+                    iostate = ReadUri(ifile,&m2,prefix+summary_suffix[2]);
+                }
+                if (iostate!=io::State::Success) {
+                    cout<<"FATAL ERROR: "<<ToString(iostate)<<" '"<<in_fname<<":"<<prefix<<"-MC*'"<<endl;
+                    return 1;
+                }
+                if (stats.count(prefix)>0 && stats[prefix].GetMean().GetSize()!=mean.GetSize()) {
+                    cout<<"FATAL ERROR: Inconsistent size '"<<in_fname<<":"<<prefix<<"-MC*'"<<endl;
+                    return 1;
+                }
+                stats[prefix].Merge(RunningStats(count,mean,m2));
+            } else if (copied.insert(uri).second) {
+                // the other datasets (the samples) are copied from their first shard
+                iostate = ofile.CopyDataset(ifile,uri);
+                if (iostate!=io::State::Success) {
+                    cout<<"FATAL ERROR: "<<ToString(iostate)<<" '"<<in_fname<<":"<<uri<<"'"<<endl;
+                    return 1;
+                }
+            }
+        }
+        cout<<"done!\n";
+    }
+    // write the merged summaries with their standard deviation
+    for (const pair<const string,RunningStats> &entry : stats) {
+        cout<<"  "<<entry.first<<"-MCstd..."<<flush;
+        Image<double> std_dev;
+        entry.second.EvalStd(&std_dev);
+        io::State iostate = WriteUri(ofile,entry.second.GetCount(),entry.first+summary_suffix[0]);
+        if (iostate==io::State::Success) {
+            iostate = WriteUri(ofile,entry.second.GetMean(),entry.first+summary_suffix[1]);
+        }
+        if (iostate==io::State::Success) {
+            iostate = WriteUri(ofile,entry.second.GetM2(),entry.first+summary_suffix[2]);
+        }
+        if (iostate==io::State::Success) {
+            iostate = WriteUri(ofile,std_dev,entry.first+"-MCstd");
+        }
+        if (iostate!=io::State::Success) {
+            cout<<"FATAL ERROR: "<<ToString(iostate)<<" '"<<out_fname<<":"<<entry.first<<"-MC*'"<<endl;
+            return 1;
+        }
+        cout<<"done!\n";
+    }
+    cout<<endl;
+    return 0;
+}
+
+bool IsSummary(const string &uri,string *prefix,int *which) {
+    for (int s = 0; s<static_cast<int>(summary_suffix.size()); ++s) {
+        const string &suffix = summary_suffix[s];
+        if (uri.size()>suffix.size() && uri.compare(uri.size()-suffix.size(),suffix.size(),suffix)==0) {
+            *prefix = uri.substr(0,uri.size()-suffix.size());
+            *which = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename T>
+io::State ReadUri(io::IOh5 &ifile,Image<T> *img,const string &uri) {
+    size_t pos = uri.find_last_of("/");
+    return ifile.ReadDataset(img,uri.substr(0,pos+1),uri.substr(pos+1));
+}
+
+template <typename T>
+io::State WriteUri(const io::IOh5 &ofile,const Image<T> &img,const string &uri) {
+    size_t pos = uri.find_last_of("/");
+    return ofile.WriteDataset(img,uri.substr(0,pos+1),uri.substr(pos+1));
+}
@@ -0,0 +1,350 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include <complex>
+#include <initializer_list>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "b1map/io/io_case.h"
+#include "b1map/io/io_hdf5.h"
+#include "b1map/io/io_nifti.h"
+#include "b1map/io/io_toml.h"
+
+#include "b1map/image.h"
+#include "b1map/version.h"
+
+using namespace std;
+using namespace b1map;
+
+// alignment of the packed maps (a page, so that they can be mapped)
+static const Index case_alignment = 4096;
+
+/**
+ * Map to be packed in the case file.
+ */
+struct CaseEntry {
+    /// Key of the address in the configuration.
+    string key;
+    /// Address of the map.
+    string addr;
+    /// Typename of the map ("int32", "float64" or "complex128").
+    string type;
+};
+
+int Pack(const string &cfg_fname,const string &case_fname);
+int Verify(const string &case_fname);
+template <typename T> bool PackMap(toml::Value *index,io::IOh5 &ofile,const CaseEntry &entry,string *msg);
+template <typename T> bool VerifyMap(io::IOh5 &ifile,const string &uri,const toml::Value &entry,string *msg);
+string Checksum(const uint64_t hash);
+void WriteToml(ostream *os,const toml::Value &table,const string &prefix);
+void WriteTomlValue(ostream *os,const toml::Value &value);
+
+int main(int argc, char **argv) {
+    // opening boilerplate
+    cout<<project::str()<<" ("<<build::str()<<") ["<<compiler::str()<<"]\n"<<endl;
+    // check the number of input
+    if (argc==3 && string(argv[1])=="--verify") {
+        return Verify(argv[2]);
+    }
+    if (argc!=3) {
+        cout<<"Usage example: b1map-pack <config file> <case file>\n";
+        cout<<"               b1map-pack --verify <case file>"<<endl;
+        return -1;
+    }
+    return Pack(argv[1],argv[2]);
+}
+
+int Pack(const string &cfg_fname,const string &case_fname) {
+    // load the config and the body files
+    toml::Value packed;
+    vector<CaseEntry> entries;
+    try {
+        io::IOtoml io_toml(cfg_fname,io::Mode::In);
+        packed = io_toml.GetContent();
+        string body_fname;
+        if (io_toml.GetValue(body_fname,"input.body")!=io::IOError::Success) {
+            cout<<"FATAL ERROR in config file: Missing data 'input.body'"<<endl;
+            return 1;
+        }
+        io::IOtoml body_toml(body_fname,io::Mode::In);
+        // maps of the config file (the fields without phase are complex)
+        for (const string &dir : initializer_list<string>{"tx","rx"}) {
+            string sens;
+            string phase;
+            if (io_toml.GetValue(sens,"input."+dir+"-sensitivity")!=io::IOError::Success) {
+                continue;
+            }
+            bool thereis_phase = io_toml.GetValue(phase,"input."+dir+"-phase")==io::IOError::Success;
+            entries.push_back({"input."+dir+"-sensitivity",sens,thereis_phase ? "float64" : "complex128"});
+            if (thereis_phase) {
+                entries.push_back({"input."+dir+"-phase",phase,"float64"});
+            }
+        }
+        // maps of the body file
+        for (const string &key : initializer_list<string>{"materials","proton-density","longitudinal-relaxation","transverse-relaxation"}) {
+            string addr;
+            if (body_toml.GetValue(addr,"body."+key)!=io::IOError::Success) {
+                // without materials the properties are maps over the voxels
+                if (key=="materials") {
+                    continue;
+                }
+                cout<<"FATAL ERROR in body file: Missing data 'body."<<key<<"'"<<endl;
+                return 1;
+            }
+            entries.push_back({"body."+key,addr,key=="materials" ? "int32" : "float64"});
+        }
+        double tolerance;
+        if (body_toml.GetValue(tolerance,"body.clustering-tolerance")==io::IOError::Success) {
+            packed.set("body.clustering-tolerance",tolerance);
+        }
+    } catch (const ios_base::failure &e) {
+        cout<<"FATAL ERROR in config file: "<<e.what()<<endl;
+        return 1;
+    }
+    // copy the maps in the case file, aligned to the pages
+    cout<<"Packing '"<<cfg_fname<<"' into '"<<case_fname<<"':\n";
+    io::SetAlignment(case_alignment);
+    io::IOh5 ofile(case_fname,io::Mode::Out);
+    toml::Value index = toml::Table();
+    for (const CaseEntry &entry : entries) {
+        cout<<"  '"<<entry.addr<<"'..."<<flush;
+        string msg;
+        bool packed_map;
+        if (entry.type=="int32") {
+            packed_map = PackMap<int>(&index,ofile,entry,&msg);
+        } else if (entry.type=="float64") {
+            packed_map = PackMap<double>(&index,ofile,entry,&msg);
+        } else {
+            packed_map = PackMap<complex<double> >(&index,ofile,entry,&msg);
+        }
+        if (!packed_map) {
+            cout<<"\nFATAL ERROR: "<<msg<<endl;
+            return 1;
+        }
+        packed.set(entry.key,io::CASE_PLACEHOLDER+":/"+entry.key);
+        cout<<"done!\n";
+    }
+    // the body details are moved in the packed configuration itself
+    packed.set("input.body",io::CASE_PLACEHOLDER);
+    packed.set("case.version",1);
+    packed.set("case.index",index);
+    ostringstream content;
+    WriteToml(&content,packed,"");
+    io::State iostate = ofile.WriteAttribute(content.str(),io::CASE_ATTRIBUTE);
+    if (iostate!=io::State::Success) {
+        cout<<"FATAL ERROR: "<<ToString(iostate)<<" '"<<case_fname<<"'"<<endl;
+        return 1;
+    }
+    cout<<endl;
+    return 0;
+}
+
+int Verify(const string &case_fname) {
+    cout<<"Verifying '"<<case_fname<<"':\n";
+    string content;
+    io::State iostate = io::ReadCase(&content,case_fname);
+    if (iostate!=io::State::Success) {
+        cout<<"FATAL ERROR in case file: "<<ToString(iostate)<<" '"<<case_fname<<"'"<<endl;
+        return 1;
+    }
+    istringstream stream(content);
+    toml::ParseResult parsed(toml::parse(stream));
+    const toml::Value *index = parsed.valid() ? parsed.value.find("case.index") : nullptr;
+    if (index==nullptr || !index->is<toml::Table>()) {
+        cout<<"FATAL ERROR in case file: Missing data 'case.index'"<<endl;
+        return 1;
+    }
+    io::IOh5 ifile(case_fname,io::Mode::In);
+    int n_corrupted = 0;
+    for (const auto &section : index->as<toml::Table>()) {
+        if (!section.second.is<toml::Table>()) {
+            cout<<"  '/"<<section.first<<"'...malformed index\n";
+            ++n_corrupted;
+            continue;
+        }
+        for (const auto &map : section.second.as<toml::Table>()) {
+            string uri = "/"+section.first+"."+map.first;
+            cout<<"  '"<<uri<<"'..."<<flush;
+            string msg;
+            bool verified;
+            // a malformed entry of the index (missing or mistyped fields)
+            // makes the map corrupted
+            try {
+                string type = map.second.get<string>("type");
+                if (type=="int32") {
+                    verified = VerifyMap<int>(ifile,uri,map.second,&msg);
+                } else if (type=="float64") {
+                    verified = VerifyMap<double>(ifile,uri,map.second,&msg);
+                } else {
+                    verified = VerifyMap<complex<double> >(ifile,uri,map.second,&msg);
+                }
+            } catch (const runtime_error&) {
+                msg = "malformed index";
+                verified = false;
+            }
+            if (verified) {
+                cout<<"done!\n";
+            } else {
+                cout<<msg<<"\n";
+                ++n_corrupted;
+            }
+        }
+    }
+    cout<<endl;
+    if (n_corrupted>0) {
+        cout<<"FATAL ERROR in case file: "<<n_corrupted<<" corrupted map(s) '"<<case_fname<<"'"<<endl;
+        return 1;
+    }
+    return 0;
+}
+
+template <typename T>
+bool PackMap(toml::Value *index,io::IOh5 &ofile,const CaseEntry &entry,string *msg) {
+    string fname;
+    string uri;
+    Image<T> map;
+    {
+        io::State iostate;
+        if (io::GetAddress(entry.addr,fname,uri)==io::Format::NIfTI) {
+            iostate = io::IOnifti(fname).ReadDataset(&map);
+        } else {
+            io::IOh5 ifile(fname,io::Mode::In);
+            iostate = ifile.ReadDataset(&map,"/",uri);
+        }
+        if (iostate!=io::State::Success) {
+            *msg = ToString(iostate)+" '"+entry.addr+"'";
+            return false;
+        }
+    }
+    io::State iostate = ofile.WriteDataset(map,"/",entry.key);
+    Index offset = -1;
+    if (iostate==io::State::Success) {
+        iostate = ofile.GetDatasetOffset(&offset,"/",entry.key);
+    }
+    if (iostate!=io::State::Success) {
+        *msg = ToString(iostate)+" '"+entry.key+"'";
+        return false;
+    }
+    toml::Array shape;
+    for (Index n : map.GetSize()) {
+        shape.push_back(toml::Value(n));
+    }
+    index->set(entry.key+".shape",shape);
+    index->set(entry.key+".type",entry.type);
+    index->set(entry.key+".offset",offset);
+    index->set(entry.key+".checksum",Checksum(Fnv1a64(map.GetData().data(),map.GetNVox()*sizeof(T))));
+    return true;
+}
+
+template <typename T>
+bool VerifyMap(io::IOh5 &ifile,const string &uri,const toml::Value &entry,string *msg) {
+    Image<T> map;
+    io::State iostate = ifile.ReadDataset(&map,"/",uri);
+    if (iostate!=io::State::Success) {
+        *msg = ToString(iostate);
+        return false;
+    }
+    const toml::Array &shape = entry.get<toml::Array>("shape");
+    bool same_shape = static_cast<int>(shape.size())==map.GetNDim();
+    for (int d = 0; same_shape && d<map.GetNDim(); ++d) {
+        same_shape = shape[d].as<int64_t>()==map.GetSize(d);
+    }
+    if (!same_shape) {
+        *msg = "wrong shape";
+        return false;
+    }
+    if (Checksum(Fnv1a64(map.GetData().data(),map.GetNVox()*sizeof(T)))!=entry.get<string>("checksum")) {
+        *msg = "wrong checksum";
+        return false;
+    }
+    return true;
+}
+
+string Checksum(const uint64_t hash) {
+    ostringstream hex;
+    hex<<std::hex<<setw(16)<<setfill('0')<<hash;
+    return hex.str();
+}
+
+// tinytoml writes the doubles in fixed notation with 6 decimals, losing the
+// small parameters: the packed configuration is written at full precision
+void WriteToml(ostream *os,const toml::Value &table,const string &prefix) {
+    auto key_of = [](const string &key) {
+        if (key.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-")==string::npos) {
+            return key;
+        }
+        return "\""+toml::internal::escapeString(key)+"\"";
+    };
+    for (const auto &kv : table.as<toml::Table>()) {
+        if (!kv.second.is<toml::Table>()) {
+            *os<<key_of(kv.first)<<" = ";
+            WriteTomlValue(os,kv.second);
+            *os<<"\n";
+        }
+    }
+    for (const auto &kv : table.as<toml::Table>()) {
+        if (kv.second.is<toml::Table>()) {
+            string key = prefix.empty() ? key_of(kv.first) : prefix+"."+key_of(kv.first);
+            *os<<"\n["<<key<<"]\n";
+            WriteToml(os,kv.second,key);
+        }
+    }
+    return;
+}
+
+void WriteTomlValue(ostream *os,const toml::Value &value) {
+    if (value.is<double>()) {
+        ostringstream number;
+        number<<setprecision(17)<<value.as<double>();
+        string str = number.str();
+        if (str.find_first_of(".eEin")==string::npos) {
+            str += ".0";
+        }
+        *os<<str;
+    } else if (value.is<toml::Array>()) {
+        const toml::Array &array = value.as<toml::Array>();
+        *os<<"[";
+        for (size_t i = 0; i<array.size(); ++i) {
+            *os<<(i>0 ? ", " : "");
+            WriteTomlValue(os,array[i]);
+        }
+        *os<<"]";
+    } else {
+        value.write(os);
+    }
+    return;
+}
@@ -0,0 +1,116 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/pipeline.h"
+
+#include <exception>
+#include <stdexcept>
+
+#include "b1map/runtime.h"
+
+namespace b1map {
+
+// Stage constructor
+Stage::
+Stage(const std::string &name) :
+	name_(name), busy_(0), life_(0) {
+	return;
+}
+// Stage destructor
+Stage::
+~Stage() {
+	Join();
+	return;
+}
+
+// Stage start
+void Stage::
+Start(const std::function<void()> &body, const std::function<void()> &on_exit,
+	const int n_threads) {
+	thread_ = std::thread([this,body,on_exit,n_threads]() {
+		SetNumThreads(n_threads);
+		auto start = std::chrono::steady_clock::now();
+		try {
+			body();
+		} catch (const std::exception &e) {
+			error_ = e.what();
+			if (error_=="") {
+				error_ = "Unknown error in stage '"+name_+"'";
+			}
+		} catch (...) {
+			error_ = "Unknown error in stage '"+name_+"'";
+		}
+		on_exit();
+		life_ = std::chrono::steady_clock::now()-start;
+	});
+	return;
+}
+
+// Stage join
+void Stage::
+Join() {
+	if (thread_.joinable()) {
+		thread_.join();
+	}
+	return;
+}
+
+// Stage work timing
+void Stage::
+BeginWork() {
+	work_start_ = std::chrono::steady_clock::now();
+	return;
+}
+void Stage::
+EndWork() {
+	busy_ += std::chrono::steady_clock::now()-work_start_;
+	return;
+}
+
+// Getters
+const std::string& Stage::
+GetName() const {
+	return name_;
+}
+double Stage::
+GetOccupancy() const {
+	if (life_.count()==0) {
+		return 0.0;
+	}
+	return std::chrono::duration<double>(busy_).count()/std::chrono::duration<double>(life_).count();
+}
+const std::string& Stage::
+GetError() const {
+	return error_;
+}
+
+}  // namespace b1map
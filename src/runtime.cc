@@ -0,0 +1,336 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/runtime.h"
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#ifdef B1MAPSIM_USE_MPI
+#include <mpi.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define B1MAPSIM_HAS_FCNTL
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace b1map {
+
+#ifdef B1MAPSIM_USE_MPI
+namespace {
+
+	/// Thread support provided by the MPI library.
+	int thread_support = MPI_THREAD_SINGLE;
+
+}  //
+#endif
+
+// Parse the affinity policy
+bool ParseAffinity(Affinity *affinity, const std::string &str) {
+	if (str=="none") {
+		*affinity = Affinity::None;
+	} else if (str=="close") {
+		*affinity = Affinity::Close;
+	} else if (str=="spread") {
+		*affinity = Affinity::Spread;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// Pin the worker threads
+bool SetAffinity(const Affinity affinity) {
+	if (affinity==Affinity::None) {
+		return true;
+	}
+	#if defined(_OPENMP) && defined(__linux__)
+	// list the processors available to the process
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if (sched_getaffinity(0,sizeof(mask),&mask)!=0) {
+		return false;
+	}
+	std::vector<int> cpus;
+	for (int cpu = 0; cpu<CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu,&mask)) {
+			cpus.push_back(cpu);
+		}
+	}
+	if (cpus.empty()) {
+		return false;
+	}
+	// pin each thread
+	int n_cpus = static_cast<int>(cpus.size());
+	bool success = true;
+	#pragma omp parallel reduction(&&:success)
+	{
+		int n_threads = omp_get_num_threads();
+		int tid = omp_get_thread_num();
+		int slot = 0;
+		switch (affinity) {
+			case Affinity::Close:
+				slot = tid%n_cpus;
+				break;
+			case Affinity::Spread:
+				slot = n_threads<n_cpus ? tid*n_cpus/n_threads : tid%n_cpus;
+				break;
+			case Affinity::None:
+				break;
+		}
+		cpu_set_t thread_mask;
+		CPU_ZERO(&thread_mask);
+		CPU_SET(cpus[slot],&thread_mask);
+		success = sched_setaffinity(0,sizeof(thread_mask),&thread_mask)==0;
+	}
+	return success;
+	#else
+	return false;
+	#endif
+}
+
+// Number of threads
+int GetNumThreads() {
+	#ifdef _OPENMP
+	return omp_get_max_threads();
+	#else
+	return 1;
+	#endif
+}
+
+// Set the number of threads
+void SetNumThreads(const int n_threads) {
+	#ifdef _OPENMP
+	omp_set_num_threads(n_threads);
+	#else
+	(void)n_threads;
+	#endif
+	return;
+}
+
+// Initialise the ranks
+void InitRanks(int *argc, char ***argv) {
+	#ifdef B1MAPSIM_USE_MPI
+	// the main thread talks to the other ranks, and so does the writing
+	// stage of the pipeline for the collective writes (one at a time)
+	MPI_Init_thread(argc,argv,MPI_THREAD_SERIALIZED,&thread_support);
+	#else
+	(void)argc;
+	(void)argv;
+	#endif
+	return;
+}
+
+// Finalise the ranks
+void FinalizeRanks(const int status) {
+	#ifdef B1MAPSIM_USE_MPI
+	if (status!=0 && GetNumRanks()>1) {
+		MPI_Abort(MPI_COMM_WORLD,status);
+	}
+	MPI_Finalize();
+	#else
+	(void)status;
+	#endif
+	return;
+}
+
+// Rank
+int GetRank() {
+	int rank = 0;
+	#ifdef B1MAPSIM_USE_MPI
+	MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+	#endif
+	return rank;
+}
+
+// Number of ranks
+int GetNumRanks() {
+	int n_ranks = 1;
+	#ifdef B1MAPSIM_USE_MPI
+	MPI_Comm_size(MPI_COMM_WORLD,&n_ranks);
+	#endif
+	return n_ranks;
+}
+
+// Serialized thread support
+bool GetSerializedRanks() {
+	#ifdef B1MAPSIM_USE_MPI
+	return thread_support>=MPI_THREAD_SERIALIZED;
+	#else
+	return false;
+	#endif
+}
+
+// Barrier
+void BarrierRanks() {
+	#ifdef B1MAPSIM_USE_MPI
+	MPI_Barrier(MPI_COMM_WORLD);
+	#endif
+	return;
+}
+
+// Sum over the ranks
+void AllReduceSum(std::vector<double> *v) {
+	#ifdef B1MAPSIM_USE_MPI
+	MPI_Allreduce(MPI_IN_PLACE,v->data(),static_cast<int>(v->size()),MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+	#else
+	(void)v;
+	#endif
+	return;
+}
+void AllReduceSum(std::vector<Index> *v) {
+	#ifdef B1MAPSIM_USE_MPI
+	MPI_Allreduce(MPI_IN_PLACE,v->data(),static_cast<int>(v->size()),MPI_INT64_T,MPI_SUM,MPI_COMM_WORLD);
+	#else
+	(void)v;
+	#endif
+	return;
+}
+
+#ifdef B1MAPSIM_USE_MPI
+namespace {
+
+	/**
+	 * Concatenate a vector over all the ranks, in the order of the ranks.
+	 * 
+	 * @tparam T scalar typename.
+	 * 
+	 * @param v Pointer to the vector, replaced by the concatenation.
+	 * @param type MPI datatype of the scalars.
+	 */
+	template <typename T>
+	void AllGatherT(std::vector<T> *v, MPI_Datatype type) {
+		if (v->size()>static_cast<size_t>(std::numeric_limits<int>::max())) {
+			throw std::runtime_error("Too many values to gather among the ranks");
+		}
+		int n_ranks = GetNumRanks();
+		std::vector<int> counts(static_cast<size_t>(n_ranks));
+		int count = static_cast<int>(v->size());
+		MPI_Allgather(&count,1,MPI_INT,counts.data(),1,MPI_INT,MPI_COMM_WORLD);
+		std::vector<int> displs(static_cast<size_t>(n_ranks),0);
+		for (int r = 1; r<n_ranks; ++r) {
+			if (counts[r-1]>std::numeric_limits<int>::max()-displs[r-1]-counts[r]) {
+				throw std::runtime_error("Too many values to gather among the ranks");
+			}
+			displs[r] = displs[r-1]+counts[r-1];
+		}
+		std::vector<T> all(static_cast<size_t>(displs.back()+counts.back()));
+		MPI_Allgatherv(v->data(),count,type,all.data(),counts.data(),displs.data(),type,MPI_COMM_WORLD);
+		*v = std::move(all);
+		return;
+	}
+
+}  //
+#endif
+
+// Concatenate a vector over the ranks
+void AllGather(std::vector<double> *v) {
+	#ifdef B1MAPSIM_USE_MPI
+	AllGatherT(v,MPI_DOUBLE);
+	#else
+	(void)v;
+	#endif
+	return;
+}
+void AllGather(std::vector<Index> *v) {
+	#ifdef B1MAPSIM_USE_MPI
+	AllGatherT(v,MPI_INT64_T);
+	#else
+	(void)v;
+	#endif
+	return;
+}
+
+// Broadcast the seed
+void BroadcastSeed(std::uint64_t *seed) {
+	#ifdef B1MAPSIM_USE_MPI
+	MPI_Bcast(seed,1,MPI_UINT64_T,0,MPI_COMM_WORLD);
+	#else
+	(void)seed;
+	#endif
+	return;
+}
+
+// FileLock constructor
+FileLock::
+FileLock(const std::string &fname) :
+	fd_(-1) {
+	#ifdef B1MAPSIM_HAS_FCNTL
+	fd_ = open(fname.c_str(),O_RDWR|O_CREAT,0644);
+	if (fd_<0) {
+		throw std::runtime_error("Impossible to lock '"+fname+"': "+std::strerror(errno));
+	}
+	struct flock lock = {};
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	int result;
+	do {
+		result = fcntl(fd_,F_SETLKW,&lock);
+	} while (result<0 && errno==EINTR);
+	if (result<0) {
+		int error = errno;
+		close(fd_);
+		fd_ = -1;
+		throw std::runtime_error("Impossible to lock '"+fname+"': "+std::strerror(error));
+	}
+	#else
+	(void)fname;
+	#endif
+	return;
+}
+// FileLock destructor
+FileLock::
+~FileLock() {
+	#ifdef B1MAPSIM_HAS_FCNTL
+	if (fd_>=0) {
+		// closing the descriptor releases the lock
+		close(fd_);
+	}
+	#endif
+	return;
+}
+
+}  // namespace b1map
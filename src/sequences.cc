@@ -32,56 +32,240 @@
 
 #include "b1map/sequences.h"
 
+#include <cmath>
 #include <iostream>
+#include <vector>
 
 namespace b1map {
 
+namespace {
+
+	/**
+	 * Apply a kernel to the voxels grouped by material, one voxel at a time.
+	 * 
+	 * @param mat Material ids.
+	 * @param kernel Kernel called with the range [begin,end) of the voxels
+	 *     and their material id.
+	 */
+	template <typename Id, typename F>
+	void ForEachMaterial(const Image<Id> &mat, F kernel) {
+		#pragma omp parallel for schedule(static)
+		for (Index idx = 0; idx<mat.GetNVox(); ++idx) {
+			kernel(idx,idx+1,static_cast<Index>(mat[idx]));
+		}
+		return;
+	}
+	/**
+	 * Apply a kernel to the voxels grouped by material, one run at a time.
+	 * 
+	 * @param runs Runs of the material ids.
+	 * @param kernel Kernel called with the range [begin,end) of the voxels
+	 *     and their material id.
+	 */
+	template <typename F>
+	void ForEachMaterial(const MaterialRuns &runs, F kernel) {
+		Index n_blocks = static_cast<Index>(runs.block_first.size())-1;
+		#pragma omp parallel for schedule(static)
+		for (Index block = 0; block<n_blocks; ++block) {
+			for (Index run = runs.block_first[block]; run<runs.block_first[block+1]; ++run) {
+				kernel(runs.begin[run],runs.begin[run+1],static_cast<Index>(runs.id[run]));
+			}
+		}
+		return;
+	}
+	/**
+	 * Apply a kernel to the voxels of properties given voxel by voxel.
+	 * 
+	 * @param ids Identity layout of the material ids.
+	 * @param kernel Kernel called with the range [idx,idx+1) of each voxel
+	 *     and its index as material id.
+	 */
+	template <typename F>
+	void ForEachMaterial(const VoxelIds &ids, F kernel) {
+		#pragma omp parallel for schedule(static)
+		for (Index idx = 0; idx<ids.n_vox; ++idx) {
+			kernel(idx,idx+1,idx);
+		}
+		return;
+	}
+
+	// GRE image with a given layout of the material ids
+	template <typename Mat>
+	void GREImageOf(Image<std::complex<double> > *img, const double alpha_nom,
+		const double TR, const double TE, const Image<std::complex<double> > &b1p,
+		const Image<std::complex<double> > &b1m, const double spoiling,
+		const Body &body, const Mat &mat, const double b1p_avg) {
+		// initialize the result
+		*img = Image<std::complex<double> >(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		// actual flip-angle distribution
+		Image<double> alpha;
+		EvalAlpha(&alpha,b1p,alpha_nom,b1p_avg);
+		// relaxation coefficients and signal scale of the materials
+		const MaterialTable &table = body.GetTable(TR,TE,spoiling);
+		Image<std::uint8_t> valid;
+		EvalValidity(&valid,alpha,table,mat);
+		// solve Bloch equations
+		Image<double> my_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> mx(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> my(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> mz(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		ParallelFill(mz.GetData().data(),mz.GetNVox(),1.0);
+		while (true) {
+			RFPulse(&mx,&my,&mz,alpha);
+			if (IsSteadyState(my,my_old,valid)) {
+				break;
+			}
+			ParallelCopy(my.GetData().data(),my.GetNVox(),my_old.GetData().data());
+			Relax(&mx,&my,&mz,table,mat);
+		}
+		// synthesize the image
+		const double *scale = table.scale.GetData().data();
+		ForEachMaterial(mat,[&](const Index begin, const Index end, const Index id_mat) {
+			double scale_mat = scale[id_mat];
+			for (Index idx = begin; idx<end; ++idx) {
+				(*img)[idx] = std::complex<double>(mx[idx],my[idx]) *
+					scale_mat *
+					b1m[idx]*b1p[idx]/std::abs(b1p[idx]);
+			}
+		});
+		return;
+	}
+
+	// AFI images with a given layout of the material ids
+	template <typename Mat>
+	void AFIImageOf(Image<std::complex<double> > *img1, Image<std::complex<double> > *img2,
+	 	const double alpha_nom, const double TR1, const double TR2, const double TE,
+		const Image<std::complex<double> > &b1p, const Image<std::complex<double> > &b1m,
+		const double spoiling, const Body &body, const Mat &mat,
+		const double b1p_avg) {
+		// initialize the result
+		*img1 = Image<std::complex<double> >(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		*img2 = Image<std::complex<double> >(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		// actual flip-angle distribution
+		Image<double> alpha;
+		EvalAlpha(&alpha,b1p,alpha_nom,b1p_avg);
+		// relaxation coefficients and signal scale of the materials
+		const MaterialTable &table1 = body.GetTable(TR1,TE,spoiling);
+		const MaterialTable &table2 = body.GetTable(TR2,TE,spoiling);
+		Image<std::uint8_t> valid;
+		EvalValidity(&valid,alpha,table1,mat);
+		RestrictValidity(&valid,table2,mat);
+		// solve Bloch equations
+		Image<double> mx(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> my(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> mz(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> m1(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> m2(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> m1_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> m2_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		ParallelFill(mz.GetData().data(),mz.GetNVox(),1.0);
+		while (true) {
+			RFPulse(&mx,&my,&mz,alpha);
+			ParallelCopy(my.GetData().data(),my.GetNVox(),m1.GetData().data());
+			Relax(&mx,&my,&mz,table1,mat);
+			RFPulse(&mx,&my,&mz,alpha);
+			ParallelCopy(my.GetData().data(),my.GetNVox(),m2.GetData().data());
+			if (IsSteadyState(m1,m1_old,valid) && IsSteadyState(m2,m2_old,valid)) {
+				break;
+			}
+			ParallelCopy(m1.GetData().data(),m1.GetNVox(),m1_old.GetData().data());
+			ParallelCopy(m2.GetData().data(),m2.GetNVox(),m2_old.GetData().data());
+			Relax(&mx,&my,&mz,table2,mat);
+		}
+		// synthesize the image
+		const double *scale = table1.scale.GetData().data();
+		ForEachMaterial(mat,[&](const Index begin, const Index end, const Index id_mat) {
+			double scale_mat = scale[id_mat];
+			for (Index idx = begin; idx<end; ++idx) {
+				std::complex<double> tmp = scale_mat *
+					b1m[idx]*b1p[idx]/std::abs(b1p[idx]);
+				(*img1)[idx] = std::complex<double>(0.0,m1[idx])*tmp;
+				(*img2)[idx] = std::complex<double>(0.0,m2[idx])*tmp;
+			}
+		});
+		return;
+	}
+
+	// BSS image with a given layout of the material ids
+	template <typename Mat>
+	void BSSImageOf(Image<std::complex<double> > *img, const double alpha_nom,
+		const double TR, const double TE, const double bss_offres,
+		const double bss_length, const Image<std::complex<double> > &b1p,
+		const Image<std::complex<double> > &b1m, const double spoiling,
+		const Body &body, const Mat &mat, const double b1p_avg) {
+		// initialize the result
+		*img = Image<std::complex<double> >(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		// actual flip-angle distribution
+		Image<double> alpha;
+		EvalAlpha(&alpha,b1p,alpha_nom,b1p_avg);
+		// relaxation coefficients and signal scale of the materials
+		const MaterialTable &table = body.GetTable(TR,TE,spoiling);
+		Image<std::uint8_t> valid;
+		EvalValidity(&valid,alpha,table,mat);
+		// Bloch-Siegert angle
+		double bss_angle = bss_offres*bss_length;
+		Image<double> phi(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		#pragma omp parallel for schedule(static)
+		for (Index idx = 0; idx<b1p.GetNVox(); ++idx) {
+			phi[idx] = std::sqrt(GAMMA*std::abs(b1p[idx])*GAMMA*std::abs(b1p[idx]) + bss_offres*bss_offres)*bss_length;
+		}
+		// solve Bloch equations
+		Image<double> mx_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> my_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> mx(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> my(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		Image<double> mz(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
+		ParallelFill(mz.GetData().data(),mz.GetNVox(),1.0);
+		while (true) {
+			RFPulse(&mx,&my,&mz,alpha);
+			#pragma omp parallel for schedule(static)
+			for (Index idx = 0; idx<mx.GetNVox(); ++idx) {
+				double angle_x = GAMMA*std::abs(b1p[idx])*bss_length;
+				double tmpx = -bss_angle/phi[idx]*my[idx]*std::sin(phi[idx]/2.0);
+				double tmpy = (bss_angle*mx[idx]-angle_x*mz[idx])/phi[idx]*std::sin(phi[idx]/2.0);
+				double tmpz = angle_x*my[idx]/phi[idx]*std::sin(phi[idx]/2.0);
+				mx[idx] += 2.0*std::cos(phi[idx]/2.0)*tmpx - 2.0*bss_angle/phi[idx]*tmpy*std::sin(phi[idx]/2.0);
+				my[idx] += 2.0*std::cos(phi[idx]/2.0)*tmpy + 2.0*(bss_angle*tmpx - angle_x*tmpz)/phi[idx]*std::sin(phi[idx]/2.0);
+				mz[idx] += 2.0*std::cos(phi[idx]/2.0)*tmpz + 2.0*angle_x/phi[idx]*tmpy*std::sin(phi[idx]/2.0);
+				tmpx = mx[idx];
+				mx[idx] =   std::cos(bss_angle)*tmpx + std::sin(bss_angle)*my[idx];
+				my[idx] = - std::sin(bss_angle)*tmpx + std::cos(bss_angle)*my[idx];
+			}
+			if (IsSteadyState(mx,my,mx_old,my_old,valid)) {
+				break;
+			}
+			ParallelCopy(mx.GetData().data(),mx.GetNVox(),mx_old.GetData().data());
+			ParallelCopy(my.GetData().data(),my.GetNVox(),my_old.GetData().data());
+			Relax(&mx,&my,&mz,table,mat);
+		}
+		// synthesize the image
+		const double *scale = table.scale.GetData().data();
+		ForEachMaterial(mat,[&](const Index begin, const Index end, const Index id_mat) {
+			double scale_mat = scale[id_mat];
+			for (Index idx = begin; idx<end; ++idx) {
+				(*img)[idx] = std::complex<double>(mx[idx],my[idx]) *
+					scale_mat *
+					b1m[idx]*b1p[idx]/std::abs(b1p[idx]);
+			}
+		});
+		return;
+	}
+
+}  //
+
 // GRE image
 void GREImage(Image<std::complex<double> > *img, const double alpha_nom,
 	const double TR, const double TE, const Image<std::complex<double> > &b1p,
 	const Image<std::complex<double> > &b1m, const double spoiling,
-	const Body &body) {
-	// initialize the result
-	*img = Image<std::complex<double> >(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	// shortcut variables
-	const Image<int> &mat = body.GetMaterials();
-	const Image<double> &rho = body.GetRho();
-	const Image<double> &t1 = body.GetT1();
-	const Image<double> &t2star = body.GetT2Star();
-	// actual flip-angle distribution
-	Image<double> alpha;
-	EvalAlpha(&alpha,b1p,alpha_nom);
-	// relaxation coefficients
-	int n_mat = body.GetT1().GetNVox();
-	Image<double> e1(n_mat);
-	Image<double> e2(n_mat);
-	for (int id_mat = 0; id_mat<n_mat; ++id_mat) {
-		e1[id_mat] = std::exp(-TR/t1[id_mat]);
-		e2[id_mat] = std::exp(-TR/t2star[id_mat])*(1.0-spoiling);
-	}
-	// solve Bloch equations
-	Image<double> my_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> mx(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> my(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> mz(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	std::fill(my_old.GetData().begin(),my_old.GetData().end(),0.0);
-	std::fill(mx.GetData().begin(),mx.GetData().end(),0.0);
-	std::fill(my.GetData().begin(),my.GetData().end(),0.0);
-	std::fill(mz.GetData().begin(),mz.GetData().end(),1.0);
-	while (true) {
-		RFPulse(&mx,&my,&mz,alpha);
-		if (IsSteadyState(my,my_old)) {
-			break;
-		}
-		std::copy(my.GetData().begin(),my.GetData().end(),my_old.GetData().begin());
-		Relax(&mx,&my,&mz,e1,e2,mat);
-	}
-	// synthesize the image
-	for (int idx = 0; idx<img->GetNVox(); ++idx) {
-		(*img)[idx] = std::complex<double>(mx[idx],my[idx]) *
-			rho[mat[idx]] *
-			std::exp(-TE/t2star[mat[idx]]) *
-			b1m[idx]*b1p[idx]/std::abs(b1p[idx]);
+	const Body &body, const double b1p_avg) {
+	if (body.IsPerVoxel()) {
+		GREImageOf(img,alpha_nom,TR,TE,b1p,b1m,spoiling,body,VoxelIds{body.GetRho().GetNVox()},b1p_avg);
+	} else if (body.HasRuns()) {
+		GREImageOf(img,alpha_nom,TR,TE,b1p,b1m,spoiling,body,body.GetRuns(),b1p_avg);
+	} else if (body.GetMaterialBytes()==1) {
+		GREImageOf(img,alpha_nom,TR,TE,b1p,b1m,spoiling,body,body.GetMaterials<std::uint8_t>(),b1p_avg);
+	} else {
+		GREImageOf(img,alpha_nom,TR,TE,b1p,b1m,spoiling,body,body.GetMaterials<std::uint16_t>(),b1p_avg);
 	}
 	return;
 }
@@ -90,65 +274,15 @@ void GREImage(Image<std::complex<double> > *img, const double alpha_nom,
 void AFIImage(Image<std::complex<double> > *img1, Image<std::complex<double> > *img2,
  	const double alpha_nom, const double TR1, const double TR2, const double TE,
 	const Image<std::complex<double> > &b1p, const Image<std::complex<double> > &b1m,
-	const double spoiling, const Body &body) {
-	// initialize the result
-	*img1 = Image<std::complex<double> >(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	*img2 = Image<std::complex<double> >(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	// shortcut variables
-	const Image<int> &mat = body.GetMaterials();
-	const Image<double> &rho = body.GetRho();
-	const Image<double> &t1 = body.GetT1();
-	const Image<double> &t2star = body.GetT2Star();
-	// actual flip-angle distribution
-	Image<double> alpha;
-	EvalAlpha(&alpha,b1p,alpha_nom);
-	// relaxation coefficients
-	int n_mat = body.GetT1().GetNVox();
-	Image<double> e11(n_mat);
-	Image<double> e12(n_mat);
-	Image<double> e21(n_mat);
-	Image<double> e22(n_mat);
-	for (int id_mat = 0; id_mat<n_mat; ++id_mat) {
-		e11[id_mat] = std::exp(-TR1/t1[id_mat]);
-		e12[id_mat] = std::exp(-TR1/t2star[id_mat])*(1.0-spoiling);
-		e21[id_mat] = std::exp(-TR2/t1[id_mat]);
-		e22[id_mat] = std::exp(-TR2/t2star[id_mat])*(1.0-spoiling);
-	}
-	// solve Bloch equations
-	Image<double> mx(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> my(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> mz(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> m1(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> m2(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> m1_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> m2_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	std::fill(mx.GetData().begin(),mx.GetData().end(),0.0);
-	std::fill(my.GetData().begin(),my.GetData().end(),0.0);
-	std::fill(mz.GetData().begin(),mz.GetData().end(),1.0);
-	std::fill(m1.GetData().begin(),m1.GetData().end(),0.0);
-	std::fill(m2.GetData().begin(),m2.GetData().end(),0.0);
-	std::fill(m1_old.GetData().begin(),m1_old.GetData().end(),0.0);
-	std::fill(m2_old.GetData().begin(),m2_old.GetData().end(),0.0);
-	while (true) {
-		RFPulse(&mx,&my,&mz,alpha);
-		std::copy(my.GetData().begin(),my.GetData().end(),m1.GetData().begin());
-		Relax(&mx,&my,&mz,e11,e12,mat);
-		RFPulse(&mx,&my,&mz,alpha);
-		std::copy(my.GetData().begin(),my.GetData().end(),m2.GetData().begin());
-		if (IsSteadyState(m1,m1_old) && IsSteadyState(m2,m2_old)) {
-			break;
-		}
-		std::copy(m1.GetData().begin(),m1.GetData().end(),m1_old.GetData().begin());
-		std::copy(m2.GetData().begin(),m2.GetData().end(),m2_old.GetData().begin());
-		Relax(&mx,&my,&mz,e21,e22,mat);
-	}
-	// synthesize the image
-	for (int idx = 0; idx<img1->GetNVox(); ++idx) {
-		std::complex<double> tmp = rho[mat[idx]] *
-			std::exp(-TE/t2star[mat[idx]]) *
-			b1m[idx]*b1p[idx]/std::abs(b1p[idx]);
-		(*img1)[idx] = std::complex<double>(0.0,m1[idx])*tmp;
-		(*img2)[idx] = std::complex<double>(0.0,m2[idx])*tmp;
+	const double spoiling, const Body &body, const double b1p_avg) {
+	if (body.IsPerVoxel()) {
+		AFIImageOf(img1,img2,alpha_nom,TR1,TR2,TE,b1p,b1m,spoiling,body,VoxelIds{body.GetRho().GetNVox()},b1p_avg);
+	} else if (body.HasRuns()) {
+		AFIImageOf(img1,img2,alpha_nom,TR1,TR2,TE,b1p,b1m,spoiling,body,body.GetRuns(),b1p_avg);
+	} else if (body.GetMaterialBytes()==1) {
+		AFIImageOf(img1,img2,alpha_nom,TR1,TR2,TE,b1p,b1m,spoiling,body,body.GetMaterials<std::uint8_t>(),b1p_avg);
+	} else {
+		AFIImageOf(img1,img2,alpha_nom,TR1,TR2,TE,b1p,b1m,spoiling,body,body.GetMaterials<std::uint16_t>(),b1p_avg);
 	}
 	return;
 }
@@ -158,81 +292,36 @@ void BSSImage(Image<std::complex<double> > *img, const double alpha_nom,
 	const double TR, const double TE, const double bss_offres,
 	const double bss_length, const Image<std::complex<double> > &b1p,
 	const Image<std::complex<double> > &b1m, const double spoiling,
-	const Body &body) {
-	// initialize the result
-	*img = Image<std::complex<double> >(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	// shortcut variables
-	const Image<int> &mat = body.GetMaterials();
-	const Image<double> &rho = body.GetRho();
-	const Image<double> &t1 = body.GetT1();
-	const Image<double> &t2star = body.GetT2Star();
-	// actual flip-angle distribution
-	Image<double> alpha;
-	EvalAlpha(&alpha,b1p,alpha_nom);
-	// relaxation coefficients
-	int n_mat = body.GetT1().GetNVox();
-	Image<double> e1(n_mat);
-	Image<double> e2(n_mat);
-	for (int id_mat = 0; id_mat<n_mat; ++id_mat) {
-		e1[id_mat] = std::exp(-TR/t1[id_mat]);
-		e2[id_mat] = std::exp(-TR/t2star[id_mat])*(1.0-spoiling);
-	}
-	// Bloch-Siegert angle
-	double bss_angle = bss_offres*bss_length;
-	Image<double> phi(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	for (int idx = 0; idx<b1p.GetNVox(); ++idx) {
-		phi[idx] = std::sqrt(GAMMA*std::abs(b1p[idx])*GAMMA*std::abs(b1p[idx]) + bss_offres*bss_offres)*bss_length;
-	}
-	// solve Bloch equations
-	Image<double> mx_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> my_old(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> mx(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> my(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	Image<double> mz(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	std::fill(mx_old.GetData().begin(),mx_old.GetData().end(),0.0);
-	std::fill(my_old.GetData().begin(),my_old.GetData().end(),0.0);
-	std::fill(mx.GetData().begin(),mx.GetData().end(),0.0);
-	std::fill(my.GetData().begin(),my.GetData().end(),0.0);
-	std::fill(mz.GetData().begin(),mz.GetData().end(),1.0);
-	while (true) {
-		RFPulse(&mx,&my,&mz,alpha);
-		for (int idx = 0; idx<mx.GetNVox(); ++idx) {
-			double angle_x = GAMMA*std::abs(b1p[idx])*bss_length;
-			double tmpx = -bss_angle/phi[idx]*my[idx]*std::sin(phi[idx]/2.0);
-			double tmpy = (bss_angle*mx[idx]-angle_x*mz[idx])/phi[idx]*std::sin(phi[idx]/2.0);
-			double tmpz = angle_x*my[idx]/phi[idx]*std::sin(phi[idx]/2.0);
-			mx[idx] += 2.0*std::cos(phi[idx]/2.0)*tmpx - 2.0*bss_angle/phi[idx]*tmpy*std::sin(phi[idx]/2.0);
-			my[idx] += 2.0*std::cos(phi[idx]/2.0)*tmpy + 2.0*(bss_angle*tmpx - angle_x*tmpz)/phi[idx]*std::sin(phi[idx]/2.0);
-			mz[idx] += 2.0*std::cos(phi[idx]/2.0)*tmpz + 2.0*angle_x/phi[idx]*tmpy*std::sin(phi[idx]/2.0);
-			tmpx = mx[idx];
-			mx[idx] =   std::cos(bss_angle)*tmpx + std::sin(bss_angle)*my[idx];
-			my[idx] = - std::sin(bss_angle)*tmpx + std::cos(bss_angle)*my[idx];
-		}
-		if (IsSteadyState(mx,my,mx_old,my_old)) {
-			break;
-		}
-		std::copy(mx.GetData().begin(),mx.GetData().end(),mx_old.GetData().begin());
-		std::copy(my.GetData().begin(),my.GetData().end(),my_old.GetData().begin());
-		Relax(&mx,&my,&mz,e1,e2,mat);
-	}
-	// synthesize the image
-	for (int idx = 0; idx<img->GetNVox(); ++idx) {
-		(*img)[idx] = std::complex<double>(mx[idx],my[idx]) *
-			rho[mat[idx]] *
-			std::exp(-TE/t2star[mat[idx]]) *
-			b1m[idx]*b1p[idx]/std::abs(b1p[idx]);
+	const Body &body, const double b1p_avg) {
+	if (body.IsPerVoxel()) {
+		BSSImageOf(img,alpha_nom,TR,TE,bss_offres,bss_length,b1p,b1m,spoiling,body,VoxelIds{body.GetRho().GetNVox()},b1p_avg);
+	} else if (body.HasRuns()) {
+		BSSImageOf(img,alpha_nom,TR,TE,bss_offres,bss_length,b1p,b1m,spoiling,body,body.GetRuns(),b1p_avg);
+	} else if (body.GetMaterialBytes()==1) {
+		BSSImageOf(img,alpha_nom,TR,TE,bss_offres,bss_length,b1p,b1m,spoiling,body,body.GetMaterials<std::uint8_t>(),b1p_avg);
+	} else {
+		BSSImageOf(img,alpha_nom,TR,TE,bss_offres,bss_length,b1p,b1m,spoiling,body,body.GetMaterials<std::uint16_t>(),b1p_avg);
 	}
 	return;
 }
 
 // Evaluate the actual flip-angle
-void EvalAlpha(Image<double> *alpha, const Image<std::complex<double> > &b1p, const double alpha_nom) {
+void EvalAlpha(Image<double> *alpha, const Image<std::complex<double> > &b1p,
+	const double alpha_nom, const double b1p_avg) {
 	*alpha = Image<double>(b1p.GetSize(0),b1p.GetSize(1),b1p.GetSize(2));
-	for (int idx = 0; idx<alpha->GetNVox(); ++idx) {
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<alpha->GetNVox(); ++idx) {
 		(*alpha)[idx] = std::abs(b1p[idx]);
 	}
-	double avg = Avg(alpha->GetData());
-	for (int idx = 0; idx<alpha->GetNVox(); ++idx) {
+	double avg = b1p_avg;
+	if (avg<=0.0) {
+		std::vector<double> sum(alpha->GetSize(2),0.0);
+		std::vector<Index> num(alpha->GetSize(2),0);
+		AccumulatePlanes(&sum,&num,*alpha);
+		avg = PlaneAvg(sum,num);
+	}
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<alpha->GetNVox(); ++idx) {
 		(*alpha)[idx] *= alpha_nom/avg;
 	}
 	return;
@@ -241,7 +330,8 @@ void EvalAlpha(Image<double> *alpha, const Image<std::complex<double> > &b1p, co
 // RF pulse
 void RFPulse(Image<double> *mx, Image<double> *my, Image<double> *mz,
 	const Image<double> &alpha) {
-	for (int idx = 0; idx<mx->GetNVox(); ++idx) {
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<mx->GetNVox(); ++idx) {
 		double tmp = (*my)[idx];
 		(*my)[idx] = std::cos(alpha[idx])*tmp - std::sin(alpha[idx])*(*mz)[idx];
 		(*mz)[idx] = std::sin(alpha[idx])*tmp + std::cos(alpha[idx])*(*mz)[idx];
@@ -250,30 +340,84 @@ void RFPulse(Image<double> *mx, Image<double> *my, Image<double> *mz,
 }
 
 // Relaxation
+template <typename Mat>
 void Relax(Image<double> *mx, Image<double> *my, Image<double> *mz,
-	const Image<double> &e1, const Image<double> &e2, const Image<int> &mat) {
-	for (int idx = 0; idx<mx->GetNVox(); ++idx) {
-		(*mx)[idx] *= e2[mat[idx]];
-		(*my)[idx] *= e2[mat[idx]];
-		(*mz)[idx] = 1.0 + e1[mat[idx]]*((*mz)[idx]-1.0);
-	}
+	const MaterialTable &table, const Mat &mat) {
+	const double *e1 = table.e1.GetData().data();
+	const double *e2 = table.e2.GetData().data();
+	double *px = mx->GetData().data();
+	double *py = my->GetData().data();
+	double *pz = mz->GetData().data();
+	ForEachMaterial(mat,[&](const Index begin, const Index end, const Index id_mat) {
+		double e1_mat = e1[id_mat];
+		double e2_mat = e2[id_mat];
+		for (Index idx = begin; idx<end; ++idx) {
+			px[idx] *= e2_mat;
+			py[idx] *= e2_mat;
+			pz[idx] = 1.0 + e1_mat*(pz[idx]-1.0);
+		}
+	});
+	return;
+}
+
+// Validity mask
+template <typename Mat>
+void EvalValidity(Image<std::uint8_t> *valid, const Image<double> &alpha,
+	const MaterialTable &table, const Mat &mat) {
+	*valid = Image<std::uint8_t>(alpha.GetSize(0),alpha.GetSize(1),alpha.GetSize(2));
+	ForEachMaterial(mat,[&](const Index begin, const Index end, const Index id_mat) {
+		std::uint8_t valid_mat = table.valid[id_mat];
+		for (Index idx = begin; idx<end; ++idx) {
+			(*valid)[idx] = std::isfinite(alpha[idx]) && valid_mat;
+		}
+	});
+	return;
+}
+template <typename Mat>
+void RestrictValidity(Image<std::uint8_t> *valid, const MaterialTable &table,
+	const Mat &mat) {
+	ForEachMaterial(mat,[&](const Index begin, const Index end, const Index id_mat) {
+		std::uint8_t valid_mat = table.valid[id_mat];
+		for (Index idx = begin; idx<end; ++idx) {
+			(*valid)[idx] = (*valid)[idx] && valid_mat;
+		}
+	});
 	return;
 }
 
 // Is steady-state?
 bool IsSteadyState(const Image<double> &mx, const Image<double> &my,
-	const Image<double> &mx_old, const Image<double> &my_old) {
-	double res = DiffNorm2(mx.GetData(),mx_old.GetData()) +
-		DiffNorm2(my.GetData(),my_old.GetData());
-	double ref = Norm2(mx_old.GetData()) + Norm2(my_old.GetData());
-	bool isss = std::sqrt(res) < 1e-10*std::sqrt(ref);
+	const Image<double> &mx_old, const Image<double> &my_old,
+	const Image<std::uint8_t> &valid) {
+	double res = 0.0;
+	double ref = 0.0;
+	ResidualNorm2(&res,&ref,mx.GetData(),mx_old.GetData(),valid.GetData());
+	ResidualNorm2(&res,&ref,my.GetData(),my_old.GetData(),valid.GetData());
+	// an empty residual (e.g., a slab without magnetization) is steady too
+	bool isss = res==0.0 || std::sqrt(res) < 1e-10*std::sqrt(ref);
 	return isss;
 }
-bool IsSteadyState(const Image<double> &m, const Image<double> &m_old) {
-	double res = DiffNorm2(m.GetData(),m_old.GetData());
-	double ref = Norm2(m_old.GetData());
-	bool isss = (std::sqrt(res) < 1e-10*std::sqrt(ref));
+bool IsSteadyState(const Image<double> &m, const Image<double> &m_old,
+	const Image<std::uint8_t> &valid) {
+	double res = 0.0;
+	double ref = 0.0;
+	ResidualNorm2(&res,&ref,m.GetData(),m_old.GetData(),valid.GetData());
+	// an empty residual (e.g., a slab without magnetization) is steady too
+	bool isss = res==0.0 || std::sqrt(res) < 1e-10*std::sqrt(ref);
 	return isss;
 }
 
+template void Relax<Image<std::uint8_t> >(Image<double> *mx, Image<double> *my, Image<double> *mz, const MaterialTable &table, const Image<std::uint8_t> &mat);
+template void Relax<Image<std::uint16_t> >(Image<double> *mx, Image<double> *my, Image<double> *mz, const MaterialTable &table, const Image<std::uint16_t> &mat);
+template void Relax<MaterialRuns>(Image<double> *mx, Image<double> *my, Image<double> *mz, const MaterialTable &table, const MaterialRuns &mat);
+template void Relax<VoxelIds>(Image<double> *mx, Image<double> *my, Image<double> *mz, const MaterialTable &table, const VoxelIds &mat);
+template void EvalValidity<Image<std::uint8_t> >(Image<std::uint8_t> *valid, const Image<double> &alpha, const MaterialTable &table, const Image<std::uint8_t> &mat);
+template void EvalValidity<Image<std::uint16_t> >(Image<std::uint8_t> *valid, const Image<double> &alpha, const MaterialTable &table, const Image<std::uint16_t> &mat);
+template void EvalValidity<MaterialRuns>(Image<std::uint8_t> *valid, const Image<double> &alpha, const MaterialTable &table, const MaterialRuns &mat);
+template void EvalValidity<VoxelIds>(Image<std::uint8_t> *valid, const Image<double> &alpha, const MaterialTable &table, const VoxelIds &mat);
+template void RestrictValidity<Image<std::uint8_t> >(Image<std::uint8_t> *valid, const MaterialTable &table, const Image<std::uint8_t> &mat);
+template void RestrictValidity<Image<std::uint16_t> >(Image<std::uint8_t> *valid, const MaterialTable &table, const Image<std::uint16_t> &mat);
+template void RestrictValidity<MaterialRuns>(Image<std::uint8_t> *valid, const MaterialTable &table, const MaterialRuns &mat);
+template void RestrictValidity<VoxelIds>(Image<std::uint8_t> *valid, const MaterialTable &table, const VoxelIds &mat);
+
 }  // namespace b1map
@@ -0,0 +1,127 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/statistics.h"
+
+#include <cmath>
+#include <limits>
+
+namespace b1map {
+
+// RunningStats constructors
+RunningStats::
+RunningStats() :
+	count_(), mean_(), m2_() {
+	return;
+}
+RunningStats::
+RunningStats(const Image<Index> &count, const Image<double> &mean,
+	const Image<double> &m2) :
+	count_(count), mean_(mean), m2_(m2) {
+	return;
+}
+
+// RunningStats add
+void RunningStats::
+Add(const Image<double> &x) {
+	if (count_.GetSize()!=x.GetSize()) {
+		count_ = Image<Index>(x.GetSize());
+		mean_ = Image<double>(x.GetSize());
+		m2_ = Image<double>(x.GetSize());
+	}
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<x.GetNVox(); ++idx) {
+		if (x[idx]==x[idx]) {
+			++count_[idx];
+			double delta = x[idx]-mean_[idx];
+			mean_[idx] += delta/static_cast<double>(count_[idx]);
+			m2_[idx] += delta*(x[idx]-mean_[idx]);
+		}
+	}
+	return;
+}
+
+// RunningStats merge
+void RunningStats::
+Merge(const RunningStats &other) {
+	if (count_.GetSize()!=other.count_.GetSize()) {
+		*this = other;
+		return;
+	}
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<count_.GetNVox(); ++idx) {
+		Index na = count_[idx];
+		Index nb = other.count_[idx];
+		if (nb==0) {
+			continue;
+		}
+		double n = static_cast<double>(na+nb);
+		double delta = other.mean_[idx]-mean_[idx];
+		mean_[idx] += delta*static_cast<double>(nb)/n;
+		m2_[idx] += other.m2_[idx]+delta*delta*static_cast<double>(na)*static_cast<double>(nb)/n;
+		count_[idx] = na+nb;
+	}
+	return;
+}
+
+// Getters
+const Image<Index>& RunningStats::
+GetCount() const {
+	return count_;
+}
+const Image<double>& RunningStats::
+GetMean() const {
+	return mean_;
+}
+const Image<double>& RunningStats::
+GetM2() const {
+	return m2_;
+}
+
+// RunningStats standard deviation
+void RunningStats::
+EvalStd(Image<double> *std) const {
+	if (std->GetSize()!=count_.GetSize()) {
+		*std = Image<double>(count_.GetSize());
+	}
+	#pragma omp parallel for schedule(static)
+	for (Index idx = 0; idx<count_.GetNVox(); ++idx) {
+		if (count_[idx]>1) {
+			(*std)[idx] = std::sqrt(m2_[idx]/static_cast<double>(count_[idx]-1));
+		} else {
+			(*std)[idx] = std::numeric_limits<double>::quiet_NaN();
+		}
+	}
+	return;
+}
+
+}  // namespace b1map
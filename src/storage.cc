@@ -0,0 +1,188 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+#include "b1map/storage.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define B1MAPSIM_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace b1map {
+
+namespace {
+
+	/// Size above which the data are memory-mapped (0 means never).
+	size_t mapped_threshold = 0;
+	/// Directory of the scratch files.
+	std::string scratch_directory = "/tmp";
+	/// Failure of a scratch file already reported.
+	std::atomic<bool> scratch_warned(false);
+
+	#ifdef B1MAPSIM_HAS_MMAP
+	/**
+	 * Map a block of memory on an unlinked scratch file.
+	 * 
+	 * @param bytes Size of the block in bytes.
+	 * 
+	 * @return a pointer to the block, or nullptr if the mapping fails.
+	 */
+	void* MapScratch(const size_t bytes) {
+		std::string templ = scratch_directory+"/b1map-sim-XXXXXX";
+		std::vector<char> fname(templ.begin(),templ.end());
+		fname.push_back('\0');
+		int fd = mkstemp(fname.data());
+		if (fd<0) {
+			return nullptr;
+		}
+		unlink(fname.data());
+		if (ftruncate(fd,static_cast<off_t>(bytes))!=0) {
+			close(fd);
+			return nullptr;
+		}
+		void *ptr = mmap(nullptr,bytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+		close(fd);
+		if (ptr==MAP_FAILED) {
+			return nullptr;
+		}
+		madvise(ptr,bytes,MADV_SEQUENTIAL);
+		return ptr;
+	}
+	#endif
+
+}  //
+
+// Mapped storage threshold
+void SetMappedThreshold(const size_t bytes) {
+	mapped_threshold = bytes;
+	return;
+}
+size_t GetMappedThreshold() {
+	return mapped_threshold;
+}
+
+// Scratch directory
+void SetScratchDirectory(const std::string &dir) {
+	scratch_directory = dir;
+	return;
+}
+const std::string& GetScratchDirectory() {
+	return scratch_directory;
+}
+
+// Allocate a block of memory
+void* Allocate(Storage *storage, const size_t bytes) {
+	#ifdef B1MAPSIM_HAS_MMAP
+	if (mapped_threshold>0 && bytes>=mapped_threshold) {
+		void *ptr = MapScratch(bytes);
+		if (ptr!=nullptr) {
+			*storage = Storage::Mapped;
+			return ptr;
+		}
+		if (!scratch_warned.exchange(true)) {
+			std::cout<<"WARNING: Impossible to map a scratch file in '"<<scratch_directory<<
+				"', the images are kept in the main memory"<<std::endl;
+		}
+	}
+	#endif
+	void *ptr = std::malloc(bytes);
+	if (ptr==nullptr) {
+		throw std::bad_alloc();
+	}
+	*storage = Storage::Heap;
+	return ptr;
+}
+
+// Map a region of a file
+void* MapFile(const std::string &fname, const size_t offset, const size_t bytes) {
+	#ifdef B1MAPSIM_HAS_MMAP
+	// the mapping starts at the page boundary before the region
+	size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t shift = offset%page;
+	int fd = open(fname.c_str(),O_RDONLY);
+	if (fd<0) {
+		return nullptr;
+	}
+	struct stat info;
+	if (fstat(fd,&info)!=0 || static_cast<size_t>(info.st_size)<offset+bytes) {
+		close(fd);
+		return nullptr;
+	}
+	void *ptr = mmap(nullptr,shift+bytes,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,static_cast<off_t>(offset-shift));
+	close(fd);
+	if (ptr==MAP_FAILED) {
+		return nullptr;
+	}
+	return static_cast<char*>(ptr)+shift;
+	#else
+	(void)fname;
+	(void)offset;
+	(void)bytes;
+	return nullptr;
+	#endif
+}
+
+// Release a block of memory
+void Release(void *ptr, const Storage storage, const size_t bytes) {
+	switch (storage) {
+		case Storage::Heap:
+			std::free(ptr);
+			break;
+		case Storage::Mapped:
+			#ifdef B1MAPSIM_HAS_MMAP
+			munmap(ptr,bytes);
+			#endif
+			break;
+		case Storage::FileMapped:
+			#ifdef B1MAPSIM_HAS_MMAP
+			{
+				size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+				size_t shift = reinterpret_cast<std::uintptr_t>(ptr)%page;
+				munmap(static_cast<char*>(ptr)-shift,shift+bytes);
+			}
+			#endif
+			break;
+	}
+	return;
+}
+
+}  // namespace b1map
@@ -0,0 +1,135 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+
+// Clustering of the property maps of a body in-core and slab by slab.
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "b1map/body.h"
+#include "b1map/image.h"
+#include "b1map/io/io_hdf5.h"
+#include "b1map/io/io_toml.h"
+#include "b1map/util.h"
+
+using namespace std;
+using namespace b1map;
+
+#define CHECK(MACRO_cond) \
+    if (!(MACRO_cond)) { \
+        cout<<"FAILED at line "<<__LINE__<<": "<<#MACRO_cond<<endl; \
+        return 1; \
+    }
+
+// properties of each voxel of a body
+array<double,3> GetProperties(const Body &body, const Index idx) {
+    Index id = idx;
+    if (!body.IsPerVoxel()) {
+        id = body.GetMaterialBytes()==1 ? body.GetMaterials<uint8_t>()[idx] :
+            body.GetMaterials<uint16_t>()[idx];
+    }
+    return array<double,3>{body.GetRho()[id],body.GetT1()[id],body.GetT2Star()[id]};
+}
+
+int main() {
+    // maps of a few tissues with a small spread, which the tolerance merges
+    // into materials whose means depend on all their voxels
+    const char *tmpdir = getenv("TMPDIR");
+    const string fname = string(tmpdir!=nullptr ? tmpdir : "/tmp")+"/b1map-test-body.h5";
+    const vector<Index> nn{7,5,9};
+    const array<array<double,3>,3> tissues{{{0.7,800.0,40.0},{0.9,1200.0,60.0},{1.0,3000.0,200.0}}};
+    array<Image<double>,3> maps;
+    for (Image<double> &map : maps) {
+        map = Image<double>(nn);
+    }
+    uint64_t state = 12345;
+    for (Index idx = 0; idx<Prod(nn); ++idx) {
+        state = state*6364136223846793005ull+1442695040888963407ull;
+        size_t tissue = static_cast<size_t>(state>>62)%tissues.size();
+        for (size_t i = 0; i<maps.size(); ++i) {
+            state = state*6364136223846793005ull+1442695040888963407ull;
+            double spread = static_cast<double>(state>>11)/static_cast<double>(uint64_t(1)<<53);
+            maps[i][idx] = tissues[tissue][i]*(1.0+0.004*(spread-0.5));
+        }
+    }
+    maps[0][3] = 0.0;
+    {
+        io::IOh5 ofile(fname,io::Mode::Out);
+        CHECK(ofile.WriteDataset(maps[0],"/","rho")==io::State::Success);
+        CHECK(ofile.WriteDataset(maps[1],"/","t1")==io::State::Success);
+        CHECK(ofile.WriteDataset(maps[2],"/","t2star")==io::State::Success);
+    }
+    io::CloseFiles();
+    stringstream toml;
+    toml<<"[body]\n";
+    toml<<"    proton-density = \""<<fname<<":/rho\"\n";
+    toml<<"    longitudinal-relaxation = \""<<fname<<":/t1\"\n";
+    toml<<"    transverse-relaxation = \""<<fname<<":/t2star\"\n";
+    toml<<"    clustering-tolerance = 0.01\n";
+    io::IOtoml config(toml);
+    // in-core
+    Body body(config,nn);
+    CHECK(!body.IsPerVoxel());
+    CHECK(body.GetRho().GetNVox()<Prod(nn));
+    // slab by slab, against the clusters of the whole body
+    for (Index slab : {1,2,4}) {
+        BodyClusters clusters(config);
+        CHECK(clusters.IsEnabled());
+        for (Index z0 = 0; z0<nn[2]; z0 += slab) {
+            clusters.AddSlab(config,z0,min(slab,nn[2]-z0),nn);
+        }
+        clusters.Finish();
+        CHECK(clusters.IsFinished());
+        for (Index z0 = 0; z0<nn[2]; z0 += slab) {
+            Body slab_body(config,z0,min(slab,nn[2]-z0),nn,clusters);
+            CHECK(!slab_body.IsPerVoxel());
+            Index n_plane = nn[0]*nn[1];
+            for (Index idx = 0; idx<slab_body.GetMaterials<uint8_t>().GetNVox(); ++idx) {
+                array<double,3> in_core = GetProperties(body,z0*n_plane+idx);
+                array<double,3> in_slab = GetProperties(slab_body,idx);
+                CHECK(memcmp(in_core.data(),in_slab.data(),sizeof(in_core))==0);
+            }
+        }
+    }
+    io::CloseFiles();
+    remove(fname.c_str());
+    cout<<"Clustering in-core and slab by slab: OK"<<endl;
+    return 0;
+}
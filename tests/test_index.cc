@@ -0,0 +1,89 @@
+/*****************************************************************************
+*
+*     Program: b1map-sim
+*     Author: Alessandro Arduino <a.arduino@inrim.it>
+*
+*  MIT License
+*
+*  Copyright (c) 2020  Alessandro Arduino
+*  Istituto Nazionale di Ricerca Metrologica (INRiM)
+*  Strada delle cacce 91, 10135 Torino
+*  ITALY
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in all
+*  copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+*  SOFTWARE.
+*
+*****************************************************************************/
+
+// Indexing of an image above 2^31 voxels, backed by a scratch file.
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "b1map/image.h"
+#include "b1map/storage.h"
+#include "b1map/util.h"
+
+using namespace std;
+using namespace b1map;
+
+#define CHECK(MACRO_cond) \
+    if (!(MACRO_cond)) { \
+        cout<<"FAILED at line "<<__LINE__<<": "<<#MACRO_cond<<endl; \
+        return 1; \
+    }
+
+int main() {
+    // only the pages around the boundary are touched, the rest of the
+    // scratch file stays a hole
+    const char *tmpdir = getenv("TMPDIR");
+    SetScratchDirectory(tmpdir!=nullptr ? tmpdir : "/tmp");
+    SetMappedThreshold(1);
+    const Index boundary = Index(1)<<31;
+    const vector<Index> nn{Index(1)<<16,Index(1)<<8,(Index(1)<<7)+1};
+    Image<uint8_t> img(nn);
+    CHECK(img.GetNVox()==Prod(nn));
+    CHECK(img.GetNVox()>boundary);
+    CHECK(img.GetData().GetStorage()==Storage::Mapped);
+    // multi-index round trip across the boundary
+    for (Index idx : {boundary-1,boundary,boundary+1,img.GetNVox()-1}) {
+        array<Index,3> ii;
+        IdxToMultiIdx(ii,idx,nn);
+        CHECK(ii[2]<nn[2]);
+        CHECK(MultiIdxToIdx(ii,nn)==idx);
+    }
+    array<Index,3> ii{0,0,Index(1)<<7};
+    CHECK(MultiIdxToIdx(ii,nn)==boundary);
+    // parallel fill of a range across the boundary
+    const Index half = Index(1)<<20;
+    ParallelFill(img.GetData().data()+boundary-half,2*half,uint8_t(7));
+    CHECK(img[boundary-half-1]==0);
+    CHECK(img[boundary-half]==7);
+    CHECK(img[boundary-1]==7);
+    CHECK(img[boundary]==7);
+    CHECK(img[boundary+half-1]==7);
+    CHECK(img[boundary+half]==0);
+    CHECK(img[img.GetNVox()-1]==0);
+    img[img.GetNVox()-1] = 9;
+    CHECK(img.GetData()[static_cast<size_t>(img.GetNVox()-1)]==9);
+    cout<<"Indexing above 2^31 voxels: OK"<<endl;
+    return 0;
+}